@@ -0,0 +1,179 @@
+// Sequential vs parallel evaluation of generated compute-heavy program.
+//
+// Program is balanced tree of arithmetic builtins, calls of two-arg lambda
+// and conditions with heavy comparisons, leaves call lambda chain with about
+// two hundred evaluated nodes per call:
+//
+//   let f = \x -> let a = * x x in .. in
+//   let g = \x -> f (f (f x)) in
+//   let h = \x -> g (g (g x)) in
+//   let mix = \a b -> + (* a 31) (- b a) in
+//   <tree of depth N>
+
+#include "eval.hpp"
+#include "generator.hpp"
+#include "mode_check.hpp"
+#include "prelude.hpp"
+#include "type_check.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string_view>
+
+namespace {
+
+using namespace nodes;
+
+using gen::Random;
+
+ExprPtr var(const std::string &name) { return make_expr<Var>(name); }
+
+ExprPtr call1(const std::string &func, ExprPtr arg) {
+  return make_expr<Call>(var(func), ExprPtrV{std::move(arg)});
+}
+
+ExprPtr chain(const std::string &func) {
+  return lambda1(Arg("x"), call1(func, call1(func, call1(func, var("x")))));
+}
+
+// iterative, so deep trees can be generated too
+ExprPtr make_tree(size_t depth, Random &random) {
+  struct Frame {
+    size_t depth;
+    size_t kind = 0;
+    ExprPtrV parts = {};
+  };
+
+  const char *operators[] = {"+", "-", "*"};
+  std::vector<Frame> frames{Frame{depth}};
+  ExprPtr result;
+  while (not frames.empty()) {
+    Frame &frame = frames.back();
+    if (result != nullptr) {
+      frame.parts.push_back(std::move(result));
+    }
+
+    if (frame.depth == 0) {
+      result = call1("h", make_expr<Const>(static_cast<int>(random.below(100))));
+      frames.pop_back();
+      continue;
+    }
+
+    if (frame.kind == 0) {
+      frame.kind = 1 + random.below(6);
+    }
+    // condition: heavy comparison and two branches
+    const size_t needed = frame.kind == 6 ? 4 : 2;
+    if (frame.parts.size() < needed) {
+      frames.push_back(Frame{frame.depth - 1});
+      continue;
+    }
+
+    auto &p = frame.parts;
+    if (frame.kind <= 3) {
+      result = operator_call(operators[frame.kind - 1], p[0], p[1]);
+    } else if (frame.kind <= 5) {
+      result = make_expr<Call>(var("mix"), ExprPtrV{p[0], p[1]});
+    } else {
+      result = make_expr<Condition>(operator_call("<", p[0], p[1]), p[2], p[3]);
+    }
+    frames.pop_back();
+  }
+  return result;
+}
+
+ExprPtr make_program(size_t depth, uint64_t seed) {
+  Random random(seed);
+
+  auto f_body = make_expr<Let>(
+      Arg("a"), operator_call("*", var("x"), var("x")),
+      make_expr<Let>(
+          Arg("b"), operator_call("+", var("a"), var("x")),
+          make_expr<Let>(Arg("c"),
+                         operator_call("*", var("b"), make_expr<Const>(3)),
+                         operator_call("-", var("c"), var("a")))));
+  auto mix = lambda2(
+      Arg("a"), Arg("b"),
+      operator_call("+", operator_call("*", var("a"), make_expr<Const>(31)),
+                    operator_call("-", var("b"), var("a"))));
+
+  return make_expr<Let>(
+      Arg("f"), lambda1(Arg("x"), f_body),
+      make_expr<Let>(
+          Arg("g"), chain("f"),
+          make_expr<Let>(Arg("h"), chain("g"),
+                         make_expr<Let>(Arg("mix"), mix,
+                                        make_tree(depth, random)))));
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t depth = 16;
+  uint64_t seed = 1;
+  eval::Options options;
+  options.min_parallel_size = 256;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--depth" and i + 1 < argc) {
+      depth = std::stoul(argv[++i]);
+    } else if (arg == "--seed" and i + 1 < argc) {
+      seed = std::stoull(argv[++i]);
+    } else if (arg == "--threads" and i + 1 < argc) {
+      options.threads = std::stoul(argv[++i]);
+    } else if (arg == "--min-size" and i + 1 < argc) {
+      options.min_parallel_size = std::stoul(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--depth N] [--seed N] [--threads N] [--min-size N]\n";
+      return 1;
+    }
+  }
+
+  const auto program = make_program(depth, seed);
+  const auto prelude = prelude::core(false);
+
+  auto start = std::chrono::steady_clock::now();
+  type_check::State type_state(prelude->storage, prelude->types);
+  try {
+    type_check::check_expr_iterative(program, type_state);
+    mode_check::State mode_state(prelude->modes, type_state.type_storage,
+                                 type_state.node_types);
+    mode_check::check_expr_iterative(program, mode_state);
+  } catch (utils::Error error) {
+    std::cerr << "check error: " << error.message << "\n";
+    return 1;
+  }
+  std::cout << "check: " << seconds_since(start) << "s\n";
+
+  eval::Options sequential = options;
+  sequential.threads = 1;
+  start = std::chrono::steady_clock::now();
+  const auto expected = eval::evaluate(*program, type_state.type_storage,
+                                       type_state.node_types, sequential);
+  const double sequential_time = seconds_since(start);
+  std::cout << "sequential: " << sequential_time << "s\n";
+
+  eval::Stats stats;
+  start = std::chrono::steady_clock::now();
+  const auto result = eval::evaluate(*program, type_state.type_storage,
+                                     type_state.node_types, options, &stats);
+  const double parallel_time = seconds_since(start);
+  std::cout << "parallel: " << parallel_time << "s, tasks " << stats.tasks
+            << ", speculative " << stats.speculative << "\n";
+
+  std::cout << "speedup: " << sequential_time / parallel_time << "\n";
+  std::cout << "result: " << eval::to_string(result) << "\n";
+  if (eval::to_string(result) != eval::to_string(expected)) {
+    std::cerr << "results differ: " << eval::to_string(expected) << "\n";
+    return 1;
+  }
+  return 0;
+}
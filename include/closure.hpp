@@ -0,0 +1,72 @@
+#pragma once
+
+#include "parsing_tree.hpp"
+
+#include <string>
+#include <vector>
+
+// Closure conversion of checked program: lambdas are lifted to functions with
+// explicit environment records of captured bindings.
+//
+// Each lambda (in program and in bodies of lifted functions) is replaced by
+// closure construction, call of function name with captured values:
+//   \x -> + x y   ->   lambda#0 y   (env {y}, params {x}, body + x y)
+//   \x -> x       ->   lambda#1     (empty env)
+// Captures are free non-prelude names of lambda body, including names
+// captured by nested lambdas. Let-bound lambda refers to itself by let name
+// without capture (closure is its own environment).
+//
+// Environment layout depends on mode of closure:
+// - local: inline record on stack of creating function
+// - once: single-use record, released by the call
+// - otherwise: heap record
+// Unique and once values are moved into environment, others are copied.
+// Fields are placed in capture order, aligned to own size: int 8, bool 1,
+// closure 16 (code and environment pointers), unresolved generic 8 (boxed).
+namespace closure {
+
+enum class EnvKind { Stack, SingleUse, Heap };
+enum class CaptureKind { Copy, Move };
+
+struct Capture {
+  std::string name;
+  types::TypeID type;
+  CaptureKind kind;
+  size_t offset; // bytes
+  size_t size;
+};
+
+struct Function {
+  std::string name;
+  std::string self_name; // let name of let-bound lambda, empty otherwise
+  std::vector<nodes::Arg> params;
+  nodes::ExprPtr body;
+  std::vector<Capture> captures = {};
+  EnvKind env = EnvKind::Heap;
+  size_t env_size = 0; // bytes, padded to 8
+};
+
+// sizes are counted once per lambda in program, not per created closure
+struct Stats {
+  size_t functions = 0;
+  size_t captures = 0;
+  size_t moved = 0; // captures with CaptureKind::Move
+  size_t stack_bytes = 0;
+  size_t single_use_bytes = 0;
+  size_t heap_bytes = 0;
+};
+
+struct Program {
+  std::vector<Function> functions; // inner lambdas come after outer ones
+  nodes::ExprPtr main;
+  // types of nodes added by conversion, unchanged subtrees are shared with
+  // input tree and keep its ids and node types
+  nodes::TypeTable types;
+  Stats stats;
+};
+
+// program should be type checked, input tree is not changed
+Program convert(const nodes::ExprPtr &expr, const types::Storage &storage,
+                const nodes::TypeTable &node_types);
+
+} // namespace closure
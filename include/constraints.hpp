@@ -0,0 +1,76 @@
+#pragma once
+
+#include "type_check.hpp"
+
+#include <string>
+#include <vector>
+
+// Alternative type check pipeline: constraints are generated for the whole
+// expression first, then solved in batch.
+//
+// Solving is staged, so constraints can be deduplicated between stages:
+// 1. types: all constraints are unified ignoring modes, calls are expanded
+//    into unify constraints when callee type is known
+// 2. modes join: ApplyStrongest constraints lower modes
+// 3. modes check: CheckLeftIsSubmode constraints are checked
+namespace constraints {
+
+enum class ConstraintKind : uint8_t {
+  Unify,       // left ~ right with policy
+  ApplyArg,    // left is callee, right is arg with arg_index
+  ApplyResult, // left is callee, right is result generic
+};
+
+// error reported for failed constraint, same as type_check errors
+enum class Reason : uint8_t {
+  LetBody,
+  CallArg,
+  CallFunc,
+  ConditionBool,
+  ConditionBranches,
+};
+
+struct Constraint {
+  ConstraintKind kind;
+  Reason reason;
+  types::UnifyModePolicy policy = types::UnifyModePolicy::Ignore;
+  bool duplicate = false;
+  types::TypeID left;
+  types::TypeID right;
+  uint32_t arg_index = 0;  // ApplyArg
+  uint32_t args_count = 0; // ApplyArg, ApplyResult
+};
+
+struct ConstraintSet {
+  std::vector<Constraint> constraints;
+  std::vector<const nodes::Expr *> origins; // expression of each constraint
+};
+
+struct Diagnostic {
+  std::string message;
+  const nodes::Expr *origin;
+};
+
+struct Stats {
+  size_t generated = 0;  // constraints after generation
+  size_t expanded = 0;   // call constraints expanded to unify
+  size_t duplicates = 0; // constraints skipped as duplicates
+};
+
+struct Solution {
+  std::vector<Diagnostic> diagnostics; // in order of constraints
+  Stats stats;
+};
+
+// stores types of nodes to state.node_types (unresolved generics before
+// solving), returns type of the expression, Storage is not unified
+types::TypeID generate(const nodes::ExprPtr &expr, type_check::State &state,
+                       ConstraintSet &set);
+
+Solution solve(ConstraintSet &set, types::Storage &storage);
+
+// generate and solve, first diagnostic is thrown as utils::Error
+types::TypeID check_expr_batch(const nodes::ExprPtr &expr,
+                               type_check::State &state);
+
+} // namespace constraints
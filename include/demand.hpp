@@ -0,0 +1,30 @@
+#pragma once
+
+#include "prelude.hpp"
+
+#include <unordered_set>
+
+// Demand-driven check: bodies of lets that can not affect the program result
+// are not checked. Let body is skipped when
+// - name is not used by checked code (program result, checked let bodies)
+// - body uses only its own bindings, skipped lets and prelude names with
+//   concrete non-unique types, so checking it can not resolve generics or
+//   change use counts of checked code
+// - body has no conditions (branch join can change modes of shared types)
+//
+// Types and modes of checked code are the same as after full check, errors
+// in skipped bodies are reported only by full check.
+//
+//   auto plan = demand::plan(*expr, *prelude);
+//   type_state.skipped_lets = &plan.skipped;
+//   mode_state.skipped_lets = &plan.skipped;
+namespace demand {
+
+struct Plan {
+  std::unordered_set<const nodes::Let *> skipped;
+  size_t lets = 0;
+};
+
+Plan plan(const nodes::Expr &root, const prelude::Prelude &prelude);
+
+} // namespace demand
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "parsing_tree.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+
+// Evaluator of checked programs with parallel evaluation of independent
+// subexpressions on work-stealing pool (task_pool.hpp).
+//
+// Values are ints, bools and closures. Names not bound by program are
+// builtins: + - * < ==, int arithmetic wraps around. Let-bound lambda can
+// call itself by let name.
+//
+// Before evaluation program is planned: sizes of subexpressions (lambda
+// bodies are not counted) and sets of used bindings with unique or exclusive
+// modes. Mode check guarantees that such binding is not accessed by two
+// places at once, so subexpressions with disjoint sets are race-free:
+// - call: function and args with size >= min_parallel_size and disjoint sets
+//   are evaluated as tasks, other parts in place
+// - condition: branches with size >= min_parallel_size, disjoint sets and
+//   only builtin calls (always terminate) are evaluated speculatively while
+//   condition is evaluated, result of other branch is dropped
+// Evaluation is iterative, so deep programs don't overflow stack.
+namespace eval {
+
+struct Closure;
+struct Env;
+using EnvPtr = std::shared_ptr<const Env>;
+
+enum class Builtin { Add, Sub, Mul, Less, Equal };
+
+using Value = std::variant<int, bool, std::shared_ptr<const Closure>, Builtin>;
+
+// refers to program nodes, program should outlive values
+struct Closure {
+  const nodes::Lambda *lambda;
+  EnvPtr env;
+  std::string_view self_name; // empty if lambda is not let body
+};
+
+struct Env {
+  std::string_view name;
+  Value value;
+  EnvPtr next;
+};
+
+struct Options {
+  size_t threads = 0; // 0 - hardware concurrency, 1 - sequential
+  size_t min_parallel_size = 1 << 12; // nodes in subexpression to spawn task
+};
+
+struct Stats {
+  std::atomic<size_t> tasks = 0;       // spawned tasks
+  std::atomic<size_t> speculative = 0; // spawned branches of conditions
+};
+
+// program should be type and mode checked, storage and node types are taken
+// from the type check
+Value evaluate(const nodes::Expr &expr, const types::Storage &storage,
+               const nodes::TypeTable &node_types, const Options &options = {},
+               Stats *stats = nullptr);
+
+std::string to_string(const Value &value);
+
+} // namespace eval
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "parsing_tree.hpp"
+
+// Simplification of checked program before backends (closure.hpp, eval.hpp):
+// - calls of builtins +, -, * with constant args are folded, ints wrap around
+//   as in evaluator:  + 2 3  ->  5
+// - conditions decided by comparison of constants (< or ==) are replaced by
+//   taken branch, other branch is not visited
+// - trivial aliases (let with constant or variable body) are inlined:
+//   let x = 5 in + x 1  ->  6,  let x = y in f x  ->  f y
+//
+// Builtins are names not bound by program, call is folded only if its type
+// in node types is int. Folding never duplicates unique or once values:
+// variable alias of such value is inlined only if it is used at most once,
+// and only if aliased name is not shadowed at uses. Removed lets and branches
+// only drop constraints, so simplified program is accepted by checks too.
+//
+// Original tree is not changed: changed nodes are copied with fresh ids and
+// other subtrees are shared, so simplified program should be checked again.
+namespace fold {
+
+struct Stats {
+  size_t calls = 0;    // folded builtin calls
+  size_t branches = 0; // replaced conditions
+  size_t lets = 0;     // inlined aliases
+
+  bool changed() const { return calls != 0 or branches != 0 or lets != 0; }
+};
+
+// program should be type checked, expr is replaced by simplified tree
+Stats simplify(nodes::ExprPtr &expr, const types::Storage &storage,
+               const nodes::TypeTable &node_types);
+
+} // namespace fold
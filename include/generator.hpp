@@ -0,0 +1,135 @@
+#pragma once
+
+#include "parsing_tree.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Deterministic generator of well-typed and mode-correct programs for stress
+// tests, the same seed and options give the same programs.
+//
+// Programs use only ints, bools of conditions and let-bound lambdas called
+// by name, so they are correct by construction:
+// - unique bindings (let names and params with unique hint) are used at most
+//   once and only where unique value is accepted: body of unique let, arg of
+//   unique param, arg of + with sum_uniq prelude
+// - other expressions in these positions are constants and operator calls,
+//   mode of their types can't be changed by unification
+// - lambda bodies don't capture unique bindings
+// - lambdas are not recursive, let names are not shadowed
+//
+// Declaration with injected error has correct types, but uses unique binding
+// twice, so it is rejected by mode check:
+//   let e<unique> = <body> in let k = \a<unique> b<unique> -> 0 in k e e
+//
+// Generation is recursive, stack depth is bounded by depth option.
+namespace gen {
+
+// splitmix64
+class Random {
+public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  size_t below(size_t bound) { return next() % bound; }
+
+  bool chance(double probability) {
+    return static_cast<double>(next() >> 11) * 0x1.0p-53 < probability;
+  }
+
+private:
+  uint64_t state_;
+};
+
+struct Options {
+  uint64_t seed = 1;
+  size_t depth = 6;              // max nesting of expressions
+  size_t width = 4;              // max bindings in one let chain
+  size_t arity = 3;              // max params of lambda
+  double unique_density = 0.2;   // part of bindings with unique hint
+  size_t condition_nesting = 2;  // max nested conditions
+  double error_rate = 0;         // part of declarations with injected error
+  bool sum_uniq = false;         // checked with prelude::core(true)
+  size_t visible_declarations = 256; // previous declarations used by next
+};
+
+struct Declaration {
+  nodes::Arg name;
+  nodes::ExprPtr body;
+  bool error = false; // injected mode error
+};
+
+class Generator {
+public:
+  explicit Generator(Options options);
+
+  // top-level declaration, for streaming check (server::stream), uses names
+  // of previous declarations
+  Declaration declaration();
+
+  // self-contained program: chain of up to width declarations as lets and
+  // int result, names of declarations are not used
+  nodes::ExprPtr program(bool *error = nullptr);
+
+private:
+  struct Binding {
+    std::string name;
+    bool unique;
+    bool used = false;
+  };
+
+  struct Function {
+    std::string name;
+    std::vector<bool> unique_params;
+  };
+
+  // scope is restored by size, top-level bindings are dropped from front
+  struct Mark {
+    size_t values;
+    size_t functions;
+    size_t unique_floor;
+  };
+
+  Mark mark() const;
+  void restore(const Mark &mark);
+  void forget_old();
+
+  template <typename T> T &pick(std::deque<T> &items, size_t from = 0) {
+    return items[from + random_.below(items.size() - from)];
+  }
+
+  Declaration make_declaration(bool error);
+
+  // int expression, unique_position - unused unique binding can be consumed
+  nodes::ExprPtr expr(size_t depth, size_t conditions, bool unique_position);
+  nodes::ExprPtr leaf(bool unique_position);
+  nodes::ExprPtr operator_call(size_t depth, size_t conditions);
+  nodes::ExprPtr let_chain(size_t depth, size_t conditions);
+  nodes::ExprPtr lambda(size_t depth, size_t conditions,
+                        std::vector<bool> &unique_params);
+  nodes::ExprPtr call(size_t depth, size_t conditions);
+  nodes::ExprPtr condition(size_t depth, size_t conditions);
+  nodes::ExprPtr inject_error(nodes::ExprPtr body);
+
+  nodes::Arg new_arg(const char *prefix, bool unique);
+  types::Mode hint(bool unique) const;
+
+private:
+  Options options_;
+  Random random_;
+  size_t next_name_ = 0;
+
+  std::deque<Binding> values_;
+  std::deque<Function> functions_;
+  size_t unique_floor_ = 0; // unique values below are captured, not usable
+};
+
+} // namespace gen
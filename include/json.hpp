@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace json {
+
+struct Value;
+using Array = std::vector<Value>;
+using Object = std::map<std::string, Value>;
+
+struct Value {
+  Value() = default;
+  Value(std::nullptr_t) {}
+  Value(bool value) : value(value) {}
+  Value(int value) : value(static_cast<double>(value)) {}
+  Value(double value) : value(value) {}
+  Value(std::string value) : value(std::move(value)) {}
+  Value(const char *value) : value(std::string(value)) {}
+  Value(Array value) : value(std::move(value)) {}
+  Value(Object value) : value(std::move(value)) {}
+
+  // non-recursive, so deep values can be released
+  ~Value();
+
+  Value(const Value &) = default;
+  Value(Value &&) = default;
+  Value &operator=(const Value &) = default;
+  Value &operator=(Value &&) = default;
+
+  bool is_null() const { return holds_alternative<std::nullptr_t>(value); }
+  bool is_bool() const { return holds_alternative<bool>(value); }
+  bool is_number() const { return holds_alternative<double>(value); }
+  bool is_string() const { return holds_alternative<std::string>(value); }
+  bool is_array() const { return holds_alternative<Array>(value); }
+  bool is_object() const { return holds_alternative<Object>(value); }
+
+  // throws utils::Error on kind mismatch
+  bool as_bool() const;
+  double as_number() const;
+  // integral number in [min, max], bounds should be exact doubles
+  int64_t as_integer(int64_t min, int64_t max) const;
+  const std::string &as_string() const;
+  const Array &as_array() const;
+  const Object &as_object() const;
+
+  // nullptr if value is not an object or has no such key
+  const Value *find(const std::string &key) const;
+
+  std::variant<std::nullptr_t, bool, double, std::string, Array, Object>
+      value = nullptr;
+};
+
+// whole input should be one value, trailing whitespace is allowed,
+// parse and write don't recurse, so nesting is limited by memory only
+Value parse(std::string_view text);
+
+void write(std::string &out, const Value &value);
+
+std::string dump(const Value &value);
+
+} // namespace json
@@ -4,6 +4,8 @@
 
 #include <map>
 #include <source_location>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace mode_check {
 
@@ -18,40 +20,90 @@ struct VarState {
 
 struct State {
   friend struct Context;
+  friend class IterativeChecker;
 
-  State() { vars_stack.emplace_back(); }
+  State() = default;
+
+  // variables of frozen base are visible below all contexts, node types of
+  // the type check are resolved in its storage
+  State(std::shared_ptr<const State> base, const types::Storage &types,
+        const nodes::TypeTable &node_types)
+      : base_(std::move(base)), types_(&types), node_types_(&node_types) {}
+
+  // without storage, current thread storage is used (StorageScope)
+  Mode get_mode(TypeID id) const {
+    return (types_ != nullptr ? *types_ : types::Storage::current()).mode(id);
+  }
+
+  // type of next occurrence of node, invalid without node types of the type
+  // check; occurrences are counted from start of check_expr_iterative, and
+  // only if some node is repeated (see nodes::Table)
+  TypeID type_of(const nodes::NodeInfo &node) {
+    if (node_types_ == nullptr) {
+      return TypeID();
+    }
+    if (not node_types_->has_repeats()) {
+      return node_types_->get(node.id);
+    }
+    return node_types_->get(node.id, visits_[node.id]++);
+  }
 
   std::optional<VarState *> get_var_state(const std::string &name,
                                           bool last_context_only = false) {
-    for (auto vars_it = vars_stack.rbegin(); vars_it != vars_stack.rend();
-         ++vars_it) {
-      auto var_it = vars_it->find(name);
-      if (var_it == vars_it->end()) {
-        if (last_context_only) {
-          break;
-        }
-
-        continue;
+    if (auto *var_state = vars.find(name, last_context_only);
+        var_state != nullptr) {
+      return var_state;
+    }
+
+    if (not last_context_only and base_) {
+      if (const auto *base_state = base_->find_var_state(name);
+          base_state != nullptr) {
+        // use counters are changed, so base state is copied on first use
+        return &vars.add_outermost(name, *base_state);
       }
-      return &var_it->second;
     }
 
     utils::throw_error("NO_VAR");
     return std::nullopt;
   }
 
+  const VarState *find_var_state(const std::string &name) const {
+    if (const auto *var_state = vars.find(name); var_state != nullptr) {
+      return var_state;
+    }
+
+    return base_ ? base_->find_var_state(name) : nullptr;
+  }
+
+  // body of skipped let is not checked
+  bool skips(const nodes::Let &expr) const {
+    return skipped_lets != nullptr and skipped_lets->contains(&expr);
+  }
+
   void add_var(std::string name, Mode mode = Mode()) {
-    vars_stack.back().insert({std::move(name), VarState{mode}});
+    vars.add(std::move(name), VarState{mode});
     // TODO: check existance
   }
 
+  // replaces variable with the same name in last context
+  void set_var(std::string name, Mode mode = Mode()) {
+    vars.assign(std::move(name), VarState{mode});
+  }
+
+  const std::unordered_set<const nodes::Let *> *skipped_lets =
+      nullptr; // see demand.hpp
+
 private:
-  void enter_context() { vars_stack.emplace_back(); }
+  void enter_context() { vars.enter_context(); }
 
-  void exit_context() { vars_stack.pop_back(); }
+  void exit_context() { vars.exit_context(); }
 
 private:
-  vector<map<string, VarState>> vars_stack;
+  utils::ScopedMap<VarState> vars;
+  std::shared_ptr<const State> base_;
+  const types::Storage *types_ = nullptr;
+  const nodes::TypeTable *node_types_ = nullptr;
+  std::unordered_map<nodes::NodeId, size_t> visits_; // for repeated nodes
 };
 
 struct Context {
@@ -76,4 +128,12 @@ private:
 
 void check_expr(nodes::ExprPtr expr, State &state);
 
+// same results and errors as check_expr, but uses explicit heap stack
+// instead of native recursion, for arbitrary deep expressions
+void check_expr_iterative(nodes::ExprPtr expr, State &state);
+
+// top-level "let name = body" without where, name stays visible after the
+// check, see type_check::check_decl
+void check_decl(const nodes::Arg &name, nodes::ExprPtr body, State &state);
+
 } // mode_check
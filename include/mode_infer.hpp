@@ -0,0 +1,37 @@
+#pragma once
+
+#include "parsing_tree.hpp"
+
+#include <unordered_set>
+
+// Mode inference for bindings without mode hints (let names and lambda args
+// with default hint), runs after type check and before mode check.
+//
+// Each such binding gets mode variable, starting from the most precise mode
+// (local, unique, once). Lower bounds come from uses:
+// - more than one use: shared, many
+// - use as call arg: mode of callee param
+// - use as let body: mode of let name
+// - use as other result (lambda body, condition branch, program result) or
+//   capture in lambda: default mode
+// Params of lambdas are inferred only when lambda is let body and its name is
+// used only as callee, otherwise they get default mode.
+//
+// Bounds are solved by worklist, each variable is changed at most lattice
+// height times. Solved modes are written to binding types (types of args in
+// node_types of the type check), so types of uses see them too.
+namespace mode_infer {
+
+struct Stats {
+  size_t bindings = 0; // inferred bindings
+  size_t refined = 0;  // inferred bindings with mode other than default
+  size_t updates = 0;  // mode variable updates by solver
+};
+
+// bodies of skipped lets are not visited, see demand.hpp
+Stats infer(const nodes::ExprPtr &expr, types::Storage &storage,
+            const nodes::TypeTable &node_types,
+            const std::unordered_set<const nodes::Let *> *skipped_lets =
+                nullptr);
+
+} // namespace mode_infer
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "parsing_tree.hpp"
+
+// Specialization of let-bound lambdas by modes of call args, runs after type
+// check.
+//
+// Param accepts args with the same or less precise mode, so one lambda can be
+// called with args of different modes. Call sites of let-bound lambda are
+// grouped by instantiation: param hints raised to modes of args (raising
+// param mode only relaxes constraints in lambda body). Each instantiation gets
+// own copy of lambda, bound before original let as "name#N", and its call
+// sites are renamed:
+//
+//   let f = \x<unique> -> .. in .. f u .. f s ..
+//   ->
+//   let f#0 = \x -> .. in let f = \x<unique> -> .. in .. f u .. f#0 s ..
+//
+// - when name is used only as callee and all call sites (also in lambdas that
+//   are not called) have one instantiation, original lambda is specialized in
+//   place, otherwise it is kept as is and other sites are renamed to copies
+// - copies of closed lambdas (only prelude names are free) are deduplicated
+//   by structural hash, equal copy bound at enclosing let is reused
+// - recursive lambdas are not specialized, lambdas capturing unique or once
+//   bindings are not copied
+//
+// Only let-bound lambdas called by name are specialized, and only by modes,
+// not by types. Lambdas passed as values, recursive lambdas and copies of
+// lambdas capturing unique or once bindings are not made, so call sites of
+// specialized program can still target lambdas with less precise params.
+//
+// Original tree is not changed: changed nodes are copied with fresh ids and
+// other subtrees are shared, so specialized program should be checked again.
+// Check can reject it: modes of args are read from checked node types, and
+// check gives all uses of resolved generic one mode, so raised hint can reach
+// param that needs unique arg. Original program should be kept then.
+// Copies contain call sites of the original lambda body, so lambdas bound
+// inside copies are specialized by next run.
+namespace mono {
+
+struct Stats {
+  size_t lambdas = 0;  // let-bound lambdas with call sites
+  size_t sites = 0;    // call sites renamed to copies
+  size_t variants = 0; // added copies
+  size_t reused = 0;   // instantiations bound to existing equal copy
+  size_t in_place = 0; // lambdas with changed param hints
+
+  bool changed() const { return sites != 0 or in_place != 0; }
+};
+
+// program should be type checked, modes of args are taken from node types,
+// expr is replaced by specialized tree
+Stats specialize(nodes::ExprPtr &expr, const types::Storage &storage,
+                 const nodes::TypeTable &node_types);
+
+} // namespace mono
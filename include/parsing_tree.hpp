@@ -1,9 +1,12 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -14,12 +17,24 @@ namespace nodes {
 
 using namespace std;
 
+// Tree is immutable after construction: checks don't write into nodes, their
+// results are stored in side tables indexed by node ids (see Table), so one
+// tree can be checked by many checks at once and subtrees can be shared,
+// within one tree too (see Table).
+
+using NodeId = uint64_t;
+
+// unique for the process, never 0
+NodeId next_node_id();
+
 struct NodeInfo {
-  optional<types::TypeID> type = std::nullopt;
+  NodeInfo() : id(next_node_id()) {}
+
+  NodeId id; // copied nodes keep id, see copy_node
 };
 
 struct Expr;
-using ExprPtr = shared_ptr<Expr>;
+using ExprPtr = shared_ptr<const Expr>;
 using ExprPtrV = std::vector<ExprPtr>;
 
 struct Arg : public NodeInfo {
@@ -82,18 +97,139 @@ struct Condition : public NodeInfo {
 // };
 
 struct Expr {
+  // children are released iteratively, so deep trees don't overflow stack
+  ~Expr();
+
   variant<Const, Var, Let, Lambda, Call, Condition> value;
 };
 
+// visits child pointers in order: Let - body, where; Lambda - expr;
+// Call - func, args; Condition - condition, then, else
+template <typename E, typename F> void for_each_child(E &expr, F &&visit) {
+  switch (expr.value.index()) {
+  case 0: // Const
+  case 1: // Var
+    break;
+  case 2: { // Let
+    auto &let = std::get<2>(expr.value);
+    visit(let.body);
+    visit(let.where);
+    break;
+  }
+  case 3: // Lambda
+    visit(std::get<3>(expr.value).expr);
+    break;
+  case 4: { // Call
+    auto &call = std::get<4>(expr.value);
+    visit(call.func);
+    for (auto &arg : call.args) {
+      visit(arg);
+    }
+    break;
+  }
+  case 5: { // Condition
+    auto &condition = std::get<5>(expr.value);
+    visit(condition.condition);
+    visit(condition.then_case);
+    visit(condition.else_case);
+    break;
+  }
+  default:
+    utils::unreachable();
+  }
+}
+
+inline NodeId id_of(const Expr &expr) {
+  return std::visit([](const auto &node) { return node.id; }, expr.value);
+}
+
+// shallow copy with fresh ids of node and its args, children are shared
+Expr copy_node(const Expr &expr);
+
+// deep copy with fresh ids
+ExprPtr clone(const Expr &expr);
+
 template <typename T, typename... Args> ExprPtr make_expr(Args &&...args) {
   return std::make_shared<Expr>(T(std::forward<Args>(args)...));
 }
 
-template <typename T> inline T with_type(T node, types::Type type) {
-  node.type = std::move(type);
-  return node;
+inline ExprPtr make_expr(Expr expr) {
+  return std::make_shared<Expr>(std::move(expr));
 }
 
+// node annotations of one check, ids are spread over process, so values are
+// stored in pages of neighbour ids
+//
+// Node can occur in checked tree many times (shared subtree, copied Arg),
+// each occurrence has own annotation: first one is stored by node id, later
+// ones by keys above all node ids, in order of check (see add).
+template <typename T> class Table {
+public:
+  // default value if not set, value of first occurrence
+  T get(NodeId id) const {
+    const auto it = pages_.find(id >> PAGE_BITS);
+    return it != pages_.end() ? (*it->second)[id & PAGE_MASK] : T{};
+  }
+
+  // value of occurrence of node, counted from 0 in order of add
+  T get(NodeId id, size_t occurrence) const {
+    if (occurrence == 0) {
+      return get(id);
+    }
+    const auto it = repeats_.find(id);
+    return it != repeats_.end() and occurrence <= it->second.size()
+               ? get(it->second[occurrence - 1])
+               : T{};
+  }
+
+  void set(NodeId id, T value) { slot(id) = std::move(value); }
+
+  // value of next occurrence of node, value should not be default
+  void add(NodeId id, T value) {
+    T &first = slot(id);
+    if (first == T{}) {
+      first = std::move(value);
+      return;
+    }
+    const NodeId key = next_repeat_++;
+    repeats_[id].push_back(key);
+    slot(key) = std::move(value);
+  }
+
+  // some node has more than one occurrence
+  bool has_repeats() const { return not repeats_.empty(); }
+
+  void clear() {
+    pages_.clear();
+    repeats_.clear();
+    next_repeat_ = REPEAT_KEYS;
+  }
+
+  bool empty() const { return pages_.empty(); }
+
+private:
+  static constexpr size_t PAGE_BITS = 10;
+  static constexpr NodeId PAGE_MASK = (NodeId(1) << PAGE_BITS) - 1;
+  static constexpr NodeId REPEAT_KEYS = NodeId(1) << 63;
+
+  using Page = std::array<T, size_t(1) << PAGE_BITS>;
+
+  T &slot(NodeId id) {
+    auto &page = pages_[id >> PAGE_BITS];
+    if (page == nullptr) {
+      page = std::make_unique<Page>();
+    }
+    return (*page)[id & PAGE_MASK];
+  }
+
+  std::unordered_map<NodeId, std::unique_ptr<Page>> pages_;
+  std::unordered_map<NodeId, std::vector<NodeId>> repeats_; // later keys
+  NodeId next_repeat_ = REPEAT_KEYS;
+};
+
+// types of expressions, let names and lambda args, invalid if not checked
+using TypeTable = Table<types::TypeID>;
+
 inline Arg with_mode_hint(Arg arg, types::Mode mode) {
   arg.mode_hint = mode;
   return arg;
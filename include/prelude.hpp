@@ -0,0 +1,68 @@
+#pragma once
+
+#include "mode_check.hpp"
+#include "type_check.hpp"
+
+#include <memory>
+#include <string_view>
+
+// Builtin declarations are built once and frozen, every check layers its own
+// state on top of them without copying:
+//
+//   prelude::Builder builder;
+//   builder.load("id : 'a -> 'a");
+//   const auto prelude = builder.freeze();
+//
+//   type_check::State type_state(prelude->storage, prelude->types);
+//   type_check::check_expr_iterative(expr, type_state);
+//   mode_check::State state(prelude->modes, type_state.type_storage,
+//                           type_state.node_types);
+//   mode_check::check_expr_iterative(expr, state);
+//
+// Declaration syntax, one per line, `#` starts a comment:
+//
+//   + : int<unique> -> int<unique> -> int
+//   apply : ('a -> 'b)<local> -> 'a -> 'b
+//
+// generics (`'a`) are shared inside one declaration, every use of declared
+// name gets own instance with fresh generics (VarManager::use_var_type), so
+// `id 1` and `id (< 1 2)` are both correct in one program
+namespace prelude {
+
+struct Prelude {
+  std::shared_ptr<const types::Storage> storage;
+  std::shared_ptr<const type_check::VarManager> types;
+  std::shared_ptr<const mode_check::State> modes;
+};
+
+class Builder {
+public:
+  Builder();
+
+  // generics maps generic names to their types, to share them between parts
+  types::TypeID parse_type(std::string_view text,
+                           std::map<std::string, types::TypeID> &generics);
+
+  void add(const std::string &name, types::TypeID type);
+
+  void load(std::string_view declarations);
+
+  void load_file(const std::string &path);
+
+  // builder should not be used after freeze
+  std::shared_ptr<const Prelude> freeze();
+
+private:
+  std::shared_ptr<types::Storage> storage_;
+  std::shared_ptr<type_check::VarManager> types_;
+  std::shared_ptr<mode_check::State> modes_;
+};
+
+// builtin operators, built once per process
+std::shared_ptr<const Prelude> core(bool sum_uniq);
+
+// builtin operators extended with declarations from file
+std::shared_ptr<const Prelude> load_file(const std::string &path,
+                                         bool sum_uniq);
+
+} // namespace prelude
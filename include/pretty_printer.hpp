@@ -0,0 +1,102 @@
+#pragma once
+
+#include "parsing_tree.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Non-recursive printer for expressions and types: nodes are printed from an
+// explicit work stack into a growable buffer, so deep trees don't overflow
+// the native stack
+namespace pretty {
+
+// growable character buffer, if file descriptor is set, buffer is written to
+// it every time it grows over flush size
+class Buffer {
+public:
+  Buffer() = default;
+
+  explicit Buffer(int fd, size_t flush_size = 1 << 16)
+      : fd_(fd), flush_size_(flush_size) {}
+
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
+  // pending data is written, write errors are dropped here, so call flush
+  // to get them
+  ~Buffer();
+
+  void append(std::string_view text) {
+    data_.insert(data_.end(), text.begin(), text.end());
+    written_ += text.size();
+    flush_if_full();
+  }
+
+  void append(char c) {
+    data_.push_back(c);
+    ++written_;
+    flush_if_full();
+  }
+
+  void append(long long value);
+
+  // total count of appended chars, including flushed ones
+  size_t written() const { return written_; }
+
+  // not flushed part
+  std::string_view view() const { return {data_.data(), data_.size()}; }
+
+  std::string str() const { return std::string(view()); }
+
+  void clear() { data_.clear(); }
+
+  // no-op without file descriptor, throws utils::Error on write failure
+  void flush();
+
+private:
+  void flush_if_full() {
+    if (fd_ >= 0 and data_.size() >= flush_size_) {
+      flush();
+    }
+  }
+
+  std::vector<char> data_;
+  size_t written_ = 0;
+  int fd_ = -1;
+  size_t flush_size_ = 0;
+};
+
+struct Options {
+  // 0 - unlimited, deeper subtrees are printed as "..."
+  size_t max_depth = 0;
+  // 0 - unlimited, one printed expression or type is cut after this count
+  // of chars and ended with "..."
+  size_t max_width = 0;
+  // print types of let names and lambda args (storage and node types of the
+  // type check are required)
+  const types::Storage *types = nullptr;
+  const nodes::TypeTable *node_types = nullptr;
+};
+
+// components different from default, like `<local, unique>`,
+// nothing for default mode
+void print_mode(Buffer &out, types::Mode mode);
+
+void print_arg(Buffer &out, const nodes::Arg &arg);
+
+// `int<unique> -> int<unique> -> int`
+void print_type(Buffer &out, const types::Storage &storage, types::TypeID type,
+                const Options &options = {});
+
+void print_expr(Buffer &out, const nodes::Expr &expr,
+                const Options &options = {});
+
+std::string to_string(types::Mode mode);
+
+std::string to_string(const types::Storage &storage, types::TypeID type,
+                      const Options &options = {});
+
+std::string to_string(const nodes::Expr &expr, const Options &options = {});
+
+} // namespace pretty
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "json.hpp"
+#include "parsing_tree.hpp"
+#include "pretty_printer.hpp"
+
+#include <vector>
+
+// JSON encoding of programs:
+//   42                                -> Const
+//   "x"                               -> Var
+//   ["let", arg, body, where]         -> Let
+//   ["lambda", [arg, ...], expr]      -> Lambda
+//   ["call", func, arg, ...]          -> Call
+//   ["if", condition, then, else]     -> Condition
+// where arg is "name" or ["name", "unique", "local", ...] (mode hints)
+namespace program_io {
+
+nodes::Arg arg_from_json(const json::Value &value);
+
+nodes::ExprPtr expr_from_json(const json::Value &value);
+
+// compact encoding, readable by arg_from_json and expr_from_json
+void print_arg_json(pretty::Buffer &out, const nodes::Arg &arg);
+
+// non-recursive, so deep trees can be written too
+void print_json(pretty::Buffer &out, const nodes::Expr &expr);
+
+// child indices: Let - body, where; Lambda - expr; Call - func, args...;
+// Condition - condition, then, else
+nodes::ExprPtr &child_at(nodes::Expr &expr, size_t index);
+
+const nodes::ExprPtr &child_at(const nodes::Expr &expr, size_t index);
+
+// new tree with subexpression at path replaced, nodes on path are copied and
+// other subtrees are shared with root, empty path is not allowed
+nodes::ExprPtr replace_at(const nodes::ExprPtr &root,
+                          const std::vector<size_t> &path,
+                          nodes::ExprPtr replacement);
+
+} // namespace program_io
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+// Resident checker: reads newline-delimited JSON requests, writes one JSON
+// response line per request.
+//
+// requests:
+//   {"id": ..., "op": "check", "name": "main", "program": <program>}
+//   {"id": ..., "op": "edit", "name": "main", "path": [1, 0], "expr": <expr>}
+//   {"id": ..., "op": "check_all", "name": "main"}
+//   {"id": ..., "op": "drop", "name": "main"}
+// programs are encoded as in program_io.hpp, "sum_uniq" selects unique
+// operands for builtin "+", builtins are frozen once at startup (prelude.hpp)
+//
+// successful check responses contain printed type of the program,
+// programs are checked by iterative checkers, types can be checked by batch
+// constraint solver instead (constraints.hpp), modes of bindings without
+// hints can be inferred before mode check (mode_infer.hpp)
+//
+// with demand option, bodies of lets that can not affect the result are not
+// checked (demand.hpp, not used by batch solver), "check_all" checks stored
+// program fully
+//
+// with monomorphize option, copy of checked program is specialized by modes
+// of call args and checked again (monomorphize.hpp), response contains
+// number of added lambda copies and specialized program in JSON encoding
+// (program_io.hpp), specialization rejected by check is dropped, not used
+// with demand
+//
+// with fold option, constants of checked program are folded and trivial
+// aliases are inlined (fold.hpp), simplified program is checked again and
+// used by closures and monomorphize options, not used with demand
+//
+// with closures option, response contains closure conversion statistics of
+// checked program before specialization (closure.hpp)
+//
+// requests for the same name are handled in order by one worker, requests
+// for different names are handled concurrently, so responses can come out of
+// order (use "id" to match them)
+namespace server {
+
+struct Options {
+  size_t threads = 0; // 0 - hardware concurrency
+  bool sum_uniq = false;
+  std::string prelude_path; // extra declarations, see prelude.hpp
+  bool batch_types = false;
+  bool infer_modes = false;
+  bool demand = false;
+  bool monomorphize = false;
+  bool fold = false;
+  bool closures = false;
+  size_t compact_types = 1 << 16; // stream: new types between compactions
+};
+
+void serve(std::istream &in, std::ostream &out, Options options = {});
+
+// Streaming check of top-level declarations, one JSON value per line:
+//   ["let", arg, body]  -> declaration, visible in following lines
+//   <expr>              -> expression checked with previous declarations
+// lines are checked as nested lets, one response line is written after
+// each line is checked, last line contains totals
+//
+// ASTs are dropped after check and types not reachable from visible
+// declarations are dropped periodically, so memory depends on live
+// declarations, not on input size
+void stream(std::istream &in, std::ostream &out, Options options = {});
+
+} // namespace server
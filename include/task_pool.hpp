@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Work-stealing pool for fork-join tasks.
+//
+// Each worker owns locked deque: spawned tasks are pushed to and popped from
+// its back, idle workers steal from fronts of other deques (oldest, usually
+// largest tasks). Tasks spawned by other threads go to shared deque. Waiting
+// thread runs pending tasks until its group is finished (helping join), so
+// nested fork-join does not block workers.
+//
+// Helping runs unrelated tasks on stack of waiting thread, so it is limited
+// by depth of nested waits: deeper waits run only tasks of own group from own
+// deque, as sequential code would. Waiting thread with nothing to run blocks
+// after short spin until its group is finished.
+//
+//   task_pool::Group group;
+//   pool.spawn(group, [&] { left = eval(left_expr); });
+//   right = eval(right_expr);
+//   pool.wait(group); // rethrows first exception of group tasks
+namespace task_pool {
+
+class Group {
+public:
+  bool finished() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class Pool;
+
+  std::atomic<size_t> pending_ = 0;
+  std::mutex mutex_;
+  std::exception_ptr error_;
+};
+
+class Pool {
+public:
+  // 0 - hardware concurrency, waiting thread is counted as one of threads
+  explicit Pool(size_t threads = 0);
+  ~Pool();
+
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+
+  void spawn(Group &group, std::function<void()> task);
+
+  void wait(Group &group);
+
+  size_t threads() const { return workers_.size() + 1; }
+
+private:
+  struct Task {
+    Group *group;
+    std::function<void()> run;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void work(size_t index);
+
+  // own queue from back, then other queues from front
+  bool try_run(size_t own);
+
+  // task of group from own queue, from back
+  bool try_run_group(size_t own, Group &group);
+
+  // task is popped from queue
+  void run_popped(Task &task);
+
+  // true if task was last pending task of its group
+  static bool run(Task &task);
+
+private:
+  std::vector<std::unique_ptr<Queue>> queues_; // workers, then shared queue
+  std::vector<std::thread> workers_;
+
+  std::atomic<size_t> queued_ = 0;
+  std::atomic<bool> stopped_ = false;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+
+  // threads blocked in wait, notified when some group is finished
+  std::atomic<size_t> blocked_ = 0;
+  std::mutex join_mutex_;
+  std::condition_variable joined_;
+};
+
+} // namespace task_pool
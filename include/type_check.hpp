@@ -4,6 +4,11 @@
 
 #include <map>
 #include <source_location>
+#include <unordered_set>
+
+namespace constraints {
+class Generator;
+} // namespace constraints
 
 namespace type_check {
 
@@ -11,40 +16,75 @@ using namespace types;
 
 struct VarManager {
   friend struct Context;
+  friend class IterativeChecker;
+  friend class constraints::Generator;
+
+  VarManager() = default;
 
-  VarManager() { vars_stack.emplace_back(); }
+  // variables of frozen base are visible below all contexts
+  explicit VarManager(shared_ptr<const VarManager> base)
+      : base_(std::move(base)) {}
 
   optional<TypeID> get_var_type(const std::string &name,
                                      bool last_context_only = false) {
-    for (auto vars_it = vars_stack.rbegin(); vars_it != vars_stack.rend();
-         ++vars_it) {
-      auto var_it = vars_it->find(name);
-      if (var_it == vars_it->end()) {
-        if (last_context_only) {
-          break;
-        }
-
-        continue;
-      }
-      return var_it->second;
+    if (auto type = find_var_type(name, last_context_only); type.has_value()) {
+      return type;
     }
 
     utils::throw_error("NO_VAR for " + name);
     return std::nullopt;
   }
 
+  optional<TypeID> find_var_type(const std::string &name,
+                                 bool last_context_only = false) const {
+    if (const auto *type = vars.find(name, last_context_only);
+        type != nullptr) {
+      return *type;
+    }
+
+    if (last_context_only) {
+      return std::nullopt;
+    }
+
+    return base_ ? base_->find_var_type(name) : std::nullopt;
+  }
+
+  // type for use of variable, declarations of frozen base are generic, so
+  // every use gets own instance with fresh generics
+  TypeID use_var_type(const std::string &name, Storage &storage) const {
+    if (const auto *type = vars.find(name); type != nullptr) {
+      return *type;
+    }
+    if (auto type = base_ ? base_->find_var_type(name) : std::nullopt;
+        type.has_value()) {
+      return storage.instantiate(*type);
+    }
+    utils::throw_error("NO_VAR for " + name);
+    utils::unreachable();
+  }
+
   void add_var(std::string name, TypeID type) {
-    vars_stack.back().insert({std::move(name), type});
+    vars.add(std::move(name), type);
     // TODO: check existance
   }
 
+  // replaces variable with the same name in last context
+  void set_var(std::string name, TypeID type) {
+    vars.assign(std::move(name), type);
+  }
+
+  template <typename F> void for_each_var_type(F &&visit) {
+    vars.for_each(visit);
+  }
+
 private:
-  void enter_context() { vars_stack.emplace_back(); }
+  void enter_context() { vars.enter_context(); }
 
-  void exit_context() { vars_stack.pop_back(); }
+  void exit_context() { vars.exit_context(); }
 
 private:
-  vector<map<string, TypeID>> vars_stack;
+  utils::ScopedMap<TypeID> vars;
+  shared_ptr<const VarManager> base_;
 };
 
 struct Context {
@@ -59,8 +99,30 @@ private:
 // ---------------
 
 struct State {
+  State() = default;
+
+  // layered on top of frozen prelude, see prelude.hpp
+  State(shared_ptr<const types::Storage> base_storage,
+        shared_ptr<const VarManager> base_manager)
+      : type_storage(std::move(base_storage)),
+        manager(std::move(base_manager)) {}
+
+  // body of skipped let is not checked, name type stays unresolved
+  bool skips(const nodes::Let &expr) const {
+    return skipped_lets != nullptr and skipped_lets->contains(&expr);
+  }
+
+  // each occurrence of node is annotated, see nodes::Table
+  types::TypeID annotate(const nodes::NodeInfo &node, types::TypeID type) {
+    node_types.add(node.id, type);
+    return type;
+  }
+
   types::Storage type_storage;
   VarManager manager;
+  nodes::TypeTable node_types; // types of checked nodes, ids of type_storage
+  const std::unordered_set<const nodes::Let *> *skipped_lets =
+      nullptr; // see demand.hpp
 };
 
 // struct GenericVarContext {
@@ -69,6 +131,20 @@ struct State {
 //     arg)*/ }
 // };
 
+// types of nodes are stored to state.node_types, tree is not changed
 types::TypeID check_expr(nodes::ExprPtr expr, State &state);
 
+// same results and errors as check_expr, but uses explicit heap stack
+// instead of native recursion, for arbitrary deep expressions
+types::TypeID check_expr_iterative(nodes::ExprPtr expr, State &state);
+
+// top-level "let name = body" without where, checked as let, but name stays
+// visible after the check (replaces previous binding with the same name)
+types::TypeID check_decl(const nodes::Arg &name, nodes::ExprPtr body, State &state);
+
+// drops types that are not reachable from visible variables, only variable
+// types are kept (and their ids are changed); node types are cleared, as
+// their ids could refer to dropped or moved types
+void compact(State &state);
+
 } // namespace type_check
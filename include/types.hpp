@@ -1,20 +1,31 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <map>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include <iostream>
 
+#include "utils.hpp"
+
 namespace types {
 
 using namespace std;
 
 struct Mode {
-  enum class Loc { LOCAL = 0, GLOBAL = 1 } loc = Loc::GLOBAL;
-  enum class Uniq { UNIQUE = 0, EXCL = 1, SHARED = 2 } uniq = Uniq::SHARED;
-  enum class Lin { ONCE = 0, SEP = 1, MANY = 2 } lin = Lin::MANY;
+  enum class Loc : uint8_t { LOCAL = 0, GLOBAL = 1 } loc = Loc::GLOBAL;
+  enum class Uniq : uint8_t { UNIQUE = 0, EXCL = 1, SHARED = 2 } uniq =
+      Uniq::SHARED;
+  enum class Lin : uint8_t { ONCE = 0, SEP = 1, MANY = 2 } lin = Lin::MANY;
 
   Mode with(Loc mode) const {
     Mode copy = *this;
@@ -37,6 +48,8 @@ struct Mode {
   Mode(Uniq mode) : uniq(mode) {}
   Mode(Lin mode) : lin(mode) {}
 
+  bool operator==(const Mode &other) const = default;
+
   auto operator<=>(const Mode &other) const {
     return tie(loc, uniq, lin) <=> tie(other.loc, other.uniq, other.lin);
   }
@@ -45,6 +58,31 @@ struct Mode {
     return loc <= other.loc and uniq <= other.uniq and lin <= other.lin;
   }
 
+  // sets one component by its name ("local", "unique", "once", ...),
+  // returns false for unknown names
+  bool set_by_name(string_view name) {
+    if (name == "local") {
+      loc = Loc::LOCAL;
+    } else if (name == "global") {
+      loc = Loc::GLOBAL;
+    } else if (name == "unique") {
+      uniq = Uniq::UNIQUE;
+    } else if (name == "exclusive") {
+      uniq = Uniq::EXCL;
+    } else if (name == "shared") {
+      uniq = Uniq::SHARED;
+    } else if (name == "once") {
+      lin = Lin::ONCE;
+    } else if (name == "separated") {
+      lin = Lin::SEP;
+    } else if (name == "many") {
+      lin = Lin::MANY;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
   static Mode choose_min(const Mode &left, const Mode &right) {
     Mode ans;
     ans.loc = static_cast<Loc>(std::min(static_cast<size_t>(left.loc),
@@ -55,25 +93,51 @@ struct Mode {
                                         static_cast<size_t>(right.lin)));
     return ans;
   }
+
+  static Mode choose_max(const Mode &left, const Mode &right) {
+    Mode ans;
+    ans.loc = std::max(left.loc, right.loc);
+    ans.uniq = std::max(left.uniq, right.uniq);
+    ans.lin = std::max(left.lin, right.lin);
+    return ans;
+  }
+
+  // most precise mode: local, unique, once
+  static Mode bottom() {
+    return Mode(Loc::LOCAL).with(Uniq::UNIQUE).with(Lin::ONCE);
+  }
 };
 using ModePtr = shared_ptr<Mode>;
 
 struct Storage;
 struct Type;
+
+// 4-byte handle, resolved against explicit storage (Storage::get) or against
+// storage set for current thread by StorageScope (TypeID::get)
 struct TypeID {
-  TypeID(size_t id, Storage *storage) : id(id), storage(storage) {}
+  static constexpr uint32_t INVALID_ID = numeric_limits<uint32_t>::max();
 
-  const Type &get() const;
-  Type &get();
+  TypeID() = default;
+  explicit TypeID(size_t id) : id(static_cast<uint32_t>(id)) {}
 
-  TypeID with_mode(Mode new_mode) const;
+  bool is_valid() const { return id != INVALID_ID; }
+
+  // copy of the type, throws utils::Error if there is no current storage
+  Type get() const;
+
+  size_t get_id() const { return id; }
+
+  bool operator==(const TypeID &other) const = default;
 
 private:
-  size_t id;
-  Storage *storage = nullptr;
+  uint32_t id = INVALID_ID;
 };
+static_assert(sizeof(TypeID) == 4);
 using TypeIDV = vector<TypeID>;
 
+// alternatives of Type::type, in the same order
+enum class TypeKind : uint8_t { Arrow = 0, Bool = 1, Int = 2, Generic = 3 };
+
 struct ArrowType {
   vector<TypeID> types;
 };
@@ -125,119 +189,520 @@ enum class UnifyModePolicy {
   CheckLeftIsSubmode, // only check is performed
 };
 
+// Types are stored as structure of arrays: kind, mode and payload (arrow
+// parts range in the shared parts pool or generic id) per type id.
+//
+// Storage can be layered on top of a frozen base storage (prelude): type ids
+// and pool offsets below base sizes resolve to the base, writes to base types
+// are kept in local overrides, so base is shared between checks without
+// copying
 struct Storage {
   Storage() {}
 
+  explicit Storage(shared_ptr<const Storage> base)
+      : first_unused_generic_id(base->first_unused_generic_id),
+        base_size_(base->size()), base_pool_size_(base->pool_size()),
+        base_first_generic_id_(base->first_unused_generic_id),
+        base_(std::move(base)) {}
+
+  size_t size() const { return base_size_ + kinds_.size(); }
+
+  size_t pool_size() const { return base_pool_size_ + pool_.size(); }
+
+  // current thread storage, see StorageScope
+  static const Storage &current();
+
   TypeID get_int_type(Mode mode = {}) {
-    auto it = int_types.find(mode);
-    if (it != int_types.end()) {
-      return it->second;
+    if (auto type = find_int_type(mode); type.has_value()) {
+      return type.value();
     }
     return int_types.insert({mode, add(make_moded_type<IntType>(mode))})
         .first->second;
   }
 
   TypeID get_bool_type(Mode mode = {}) {
-    auto it = bool_types.find(mode);
-    if (it != bool_types.end()) {
-      return it->second;
+    if (auto type = find_bool_type(mode); type.has_value()) {
+      return type.value();
     }
     return bool_types.insert({mode, add(make_moded_type<BoolType>(mode))})
         .first->second;
   }
 
-  Type &get_type(size_t id) { return types[id]; }
+  optional<TypeID> find_int_type(Mode mode) const {
+    if (auto it = int_types.find(mode); it != int_types.end()) {
+      return it->second;
+    }
+    return base_ ? base_->find_int_type(mode) : std::nullopt;
+  }
+
+  optional<TypeID> find_bool_type(Mode mode) const {
+    if (auto it = bool_types.find(mode); it != bool_types.end()) {
+      return it->second;
+    }
+    return base_ ? base_->find_bool_type(mode) : std::nullopt;
+  }
+
+  TypeKind kind(TypeID id) const { return record(id.get_id()).kind; }
+
+  Mode mode(TypeID id) const { return record(id.get_id()).mode; }
+
+  bool is_arrow(TypeID id) const { return kind(id) == TypeKind::Arrow; }
+
+  bool is_generic(TypeID id) const { return kind(id) == TypeKind::Generic; }
+
+  // arrow parts (args, then result), empty for other kinds,
+  // invalidated by adding arrow types
+  span<const TypeID> parts(TypeID id) const {
+    Record type = record(id.get_id());
+    if (type.kind != TypeKind::Arrow) {
+      return {};
+    }
+    return {pool_at(type.payload.offset), type.payload.count};
+  }
+
+  size_t generic_id(TypeID id) const {
+    return record(id.get_id()).payload.offset;
+  }
+
+  const string &generic_name(TypeID id) const {
+    return generic_name_by_id(generic_id(id));
+  }
+
+  // copy of the type, prefer kind/mode/parts for reading
+  Type get(TypeID id) const {
+    Record type = record(id.get_id());
+    switch (type.kind) {
+    case TypeKind::Arrow: {
+      auto type_parts = parts(id);
+      return Type(ArrowType{TypeIDV(type_parts.begin(), type_parts.end())},
+                  type.mode);
+    }
+    case TypeKind::Bool:
+      return Type(BoolType{}, type.mode);
+    case TypeKind::Int:
+      return Type(IntType{}, type.mode);
+    case TypeKind::Generic:
+      return Type(GenericType{type.payload.offset,
+                              generic_name_by_id(type.payload.offset)},
+                  type.mode);
+    }
+    utils::unreachable();
+  }
 
-  const Type &get_type(size_t id) const { return types[id]; }
+  void set_mode(TypeID id, Mode mode) {
+    Record type = record(id.get_id());
+    if (type.mode != mode) {
+      type.mode = mode;
+      set_record(id.get_id(), type);
+    }
+  }
 
   TypeID introduce_new_generic(std::string name, Mode mode = {}) {
     return add(make_moded_type<GenericType>(mode, first_unused_generic_id++,
                                             std::move(name)));
   }
 
-  TypeID add(Type type) {
-    types.push_back(std::move(type));
-    return TypeID(types.size() - 1, this);
+  // copy of the type with fresh generics of the same names and modes, for
+  // generic declarations (prelude.hpp), types without generics are returned
+  // as is
+  TypeID instantiate(TypeID id) {
+    unordered_map<size_t, size_t> generics;
+    vector<uint32_t> arrows;
+    return instantiate(id, generics, arrows);
   }
 
-  bool unify(TypeID left_id, TypeID right_id, UnifyModePolicy policy) {
-    Type &left = left_id.get();
-    Type &right = right_id.get();
+  // parts are appended to the shared pool, no allocation per arrow
+  TypeID add_arrow(span<const TypeID> type_parts, Mode mode = {}) {
+    Payload payload{static_cast<uint32_t>(pool_size()),
+                    static_cast<uint32_t>(type_parts.size())};
+    pool_.insert(pool_.end(), type_parts.begin(), type_parts.end());
+    return add_record({TypeKind::Arrow, mode, payload});
+  }
+
+  TypeID add(const Type &type) {
+    switch (type.type.index()) {
+    case 0: // ArrowType
+      return add_arrow(std::get<0>(type.type).types, type.mode);
+    case 1: // BoolType
+      return add_record({TypeKind::Bool, type.mode, {}});
+    case 2: // IntType
+      return add_record({TypeKind::Int, type.mode, {}});
+    case 3: { // GenericType
+      const auto &generic = std::get<3>(type.type);
+      // generic names are stored once, on first add
+      if (generic.id >= base_first_generic_id_ + generic_names_.size()) {
+        generic_names_.resize(generic.id - base_first_generic_id_ + 1);
+        generic_names_.back() = generic.name;
+      }
+      return add_record({TypeKind::Generic, type.mode,
+                         {static_cast<uint32_t>(generic.id), 0}});
+    }
+    default:
+      utils::unreachable();
+    }
+  }
 
+  bool unify(TypeID left_id, TypeID right_id, UnifyModePolicy policy) {
     switch (policy) {
     case UnifyModePolicy::Ignore:
       break;
-    case UnifyModePolicy::ApplyStrongest:
-      left.mode = Mode::choose_min(left.mode, right.mode);
-      right.mode = left.mode;
+    case UnifyModePolicy::ApplyStrongest: {
+      Mode strongest = Mode::choose_min(mode(left_id), mode(right_id));
+      set_mode(left_id, strongest);
+      set_mode(right_id, strongest);
       break;
+    }
     case UnifyModePolicy::CheckLeftIsSubmode:
-      if (not left.mode.is_submode(right.mode)) {
+      if (not mode(left_id).is_submode(mode(right_id))) {
         return false;
       }
       break;
     }
 
-    if (const auto *left_generic = get_if<GenericType>(&left.type);
-        left_generic != nullptr) {
+    Record left = record(left_id.get_id());
+    Record right = record(right_id.get_id());
+
+    if (left.kind == TypeKind::Generic) {
       // TODO: check if other type contains generic
-      std::clog << "left is resolved with policy <" << static_cast<size_t>(policy) << ">\n";
-      resolve(*left_generic, right, left.mode);
+      resolve(left.payload.offset, right, left.mode);
       return true;
     }
 
-    if (const auto *right_generic = get_if<GenericType>(&right.type);
-        right_generic != nullptr) {
+    if (right.kind == TypeKind::Generic) {
       // TODO: check if other type contains generic
-      std::clog << "right is resolved with policy <" << static_cast<size_t>(policy) << ">\n";
-      resolve(*right_generic, left, right.mode);
+      resolve(right.payload.offset, left, right.mode);
       return true;
     }
 
-    if (left.type.index() != right.type.index()) {
+    if (left.kind != right.kind) {
       return false;
     }
 
-    if (holds_alternative<ArrowType>(left.type)) {
-      const auto &left_types = std::get<ArrowType>(left.type).types;
-      const auto &right_types = std::get<ArrowType>(right.type).types;
-
-      if (left_types.size() != right_types.size()) {
+    if (left.kind == TypeKind::Arrow) {
+      if (left.payload.count != right.payload.count) {
         return false;
       }
 
+      // recursive types are cyclic, pair that is already being unified is
+      // assumed to be unified
+      const std::pair arrows{left.payload.offset, right.payload.offset};
+      if (std::find(unifying_arrows_.begin(), unifying_arrows_.end(),
+                    arrows) != unifying_arrows_.end()) {
+        return true;
+      }
+      unifying_arrows_.push_back(arrows);
+
+      // unify does not add types, so pool is not changed
+      const TypeID *left_parts = pool_at(left.payload.offset);
+      const TypeID *right_parts = pool_at(right.payload.offset);
+
       bool all_unify_passed = true;
-      for (size_t i = 0; i < left_types.size(); ++i) {
-        if (not unify(left_types[i], right_types[i], policy)) {
+      for (size_t i = 0; i < left.payload.count; ++i) {
+        if (not unify(left_parts[i], right_parts[i], policy)) {
           all_unify_passed = false;
         }
       }
 
+      unifying_arrows_.pop_back();
       return all_unify_passed;
     }
 
     return true;
   }
 
-  void resolve(GenericType generic, const Type &replacement, Mode mode = {}) {
-    std::clog << "generic type " << generic.name << " is resolved with mode==UNIQUE: <"
-              << (replacement.mode.uniq == Mode::Uniq::UNIQUE) << ">\n";
-    for (auto &type : types) {
-      if (const auto *generic_type = get_if<GenericType>(&type.type);
-          generic_type != nullptr and generic_type->id == generic.id) {
-        type = replacement;
-        type.mode = mode;
+  void resolve(GenericType generic, TypeID replacement, Mode mode = {}) {
+    resolve(generic.id, record(replacement.get_id()), mode);
+  }
+
+  // ids of types that were holding given generic at some point, or nullptr
+  const vector<size_t> *find_generic_slots(size_t generic_id) const {
+    if (auto it = generic_slots_.find(generic_id); it != generic_slots_.end()) {
+      return &it->second;
+    }
+    return base_ ? base_->find_generic_slots(generic_id) : nullptr;
+  }
+
+  // keeps only local types reachable from roots, builtin types and changed
+  // base types, so size depends on live types only; roots are remapped in
+  // place, other ids become invalid, generics are renumbered
+  void compact(span<TypeID> roots) {
+    Storage compacted = base_ ? Storage(base_) : Storage();
+    Compactor compactor{*this, compacted};
+
+    for (auto &root : roots) {
+      root = compactor.type(root);
+    }
+    for (const auto &[mode, id] : int_types) {
+      compacted.int_types.emplace(mode, compactor.type(id));
+    }
+    for (const auto &[mode, id] : bool_types) {
+      compacted.bool_types.emplace(mode, compactor.type(id));
+    }
+    for (const auto &[id, type] : overrides_) {
+      Record imported = compactor.record(type);
+      compacted.overrides_.emplace(id, imported);
+      if (imported.kind == TypeKind::Generic) {
+        compacted.generic_slots_[imported.payload.offset].push_back(id);
       }
     }
+
+    compacted.first_unused_generic_id =
+        compacted.base_first_generic_id_ + compacted.generic_names_.size();
+    *this = std::move(compacted);
   }
 
 // private: // TODO: temporary, to beautify type checker output
   size_t first_unused_generic_id = 0;
 
-  vector<Type> types;
-
   map<Mode, TypeID> int_types;
   map<Mode, TypeID> bool_types;
+
+private:
+  struct Payload {
+    uint32_t offset = 0; // arrow - parts pool offset, generic - generic id
+    uint32_t count = 0;  // arrow - parts count
+  };
+
+  struct Record {
+    TypeKind kind;
+    Mode mode;
+    Payload payload;
+  };
+
+  Record record(size_t id) const {
+    if (id >= base_size_) {
+      size_t local_id = id - base_size_;
+      return {kinds_[local_id], modes_[local_id], payloads_[local_id]};
+    }
+    if (not overrides_.empty()) {
+      if (auto it = overrides_.find(id); it != overrides_.end()) {
+        return it->second;
+      }
+    }
+    return base_->record(id);
+  }
+
+  // base is frozen, base types are changed in overrides
+  void set_record(size_t id, const Record &type) {
+    if (id < base_size_) {
+      overrides_.insert_or_assign(id, type);
+      return;
+    }
+    size_t local_id = id - base_size_;
+    kinds_[local_id] = type.kind;
+    modes_[local_id] = type.mode;
+    payloads_[local_id] = type.payload;
+  }
+
+  TypeID add_record(const Record &type) {
+    if (size() >= TypeID::INVALID_ID) {
+      utils::throw_error("TOO_MANY_TYPES");
+    }
+    if (type.kind == TypeKind::Generic) {
+      generic_slots_[type.payload.offset].push_back(size());
+    }
+    kinds_.push_back(type.kind);
+    modes_.push_back(type.mode);
+    payloads_.push_back(type.payload);
+    return TypeID(size() - 1);
+  }
+
+  // copies local types into other storage with the same base
+  struct Compactor {
+    const Storage &from;
+    Storage &to;
+    unordered_map<size_t, TypeID> types = {};
+    unordered_map<size_t, uint32_t> pools = {};
+    unordered_map<size_t, size_t> generics = {};
+
+    TypeID type(TypeID id) {
+      if (id.get_id() < from.base_size_) {
+        return id;
+      }
+      if (auto it = types.find(id.get_id()); it != types.end()) {
+        return it->second;
+      }
+
+      Record type = from.record(id.get_id());
+      if (type.kind != TypeKind::Arrow) {
+        return types.emplace(id.get_id(), to.add_record(record(type)))
+            .first->second;
+      }
+
+      // added before parts, so parts of cyclic types can refer to it
+      TypeID copy = to.add_record({TypeKind::Arrow, type.mode, {}});
+      types.emplace(id.get_id(), copy);
+      to.set_record(copy.get_id(), record(type));
+      return copy;
+    }
+
+    Record record(const Record &type) {
+      switch (type.kind) {
+      case TypeKind::Arrow:
+        return {type.kind, type.mode,
+                {pool(type.payload.offset, type.payload.count),
+                 type.payload.count}};
+      case TypeKind::Generic:
+        return {type.kind, type.mode,
+                {static_cast<uint32_t>(generic(type.payload.offset)), 0}};
+      default:
+        return type;
+      }
+    }
+
+    // arrows that share parts keep sharing them
+    uint32_t pool(size_t offset, size_t count) {
+      if (offset < from.base_pool_size_) {
+        return offset;
+      }
+      if (auto it = pools.find(offset); it != pools.end()) {
+        return it->second;
+      }
+
+      const auto copy = static_cast<uint32_t>(to.pool_size());
+      pools.emplace(offset, copy);
+      to.pool_.resize(to.pool_.size() + count);
+      for (size_t i = 0; i < count; ++i) {
+        TypeID part = type(from.pool_at(offset)[i]);
+        to.pool_[copy - to.base_pool_size_ + i] = part;
+      }
+      return copy;
+    }
+
+    size_t generic(size_t id) {
+      if (id < from.base_first_generic_id_) {
+        return id;
+      }
+      if (auto it = generics.find(id); it != generics.end()) {
+        return it->second;
+      }
+      size_t copy = to.base_first_generic_id_ + to.generic_names_.size();
+      to.generic_names_.push_back(from.generic_name_by_id(id));
+      generics.emplace(id, copy);
+      return copy;
+    }
+  };
+
+  const TypeID *pool_at(size_t offset) const {
+    if (offset >= base_pool_size_) {
+      return pool_.data() + (offset - base_pool_size_);
+    }
+    return base_->pool_at(offset);
+  }
+
+  const string &generic_name_by_id(size_t id) const {
+    if (id >= base_first_generic_id_) {
+      return generic_names_[id - base_first_generic_id_];
+    }
+    return base_->generic_name_by_id(id);
+  }
+
+  // generics maps old generic ids to fresh ones, arrows in progress are
+  // not copied, so cyclic types are cut at the cycle
+  TypeID instantiate(TypeID id, unordered_map<size_t, size_t> &generics,
+                     vector<uint32_t> &arrows) {
+    const Record type = record(id.get_id());
+    switch (type.kind) {
+    case TypeKind::Generic: {
+      auto it = generics.find(type.payload.offset);
+      if (it == generics.end()) {
+        it = generics.emplace(type.payload.offset, first_unused_generic_id++)
+                 .first;
+      }
+      return add(make_moded_type<GenericType>(
+          type.mode, it->second, generic_name_by_id(type.payload.offset)));
+    }
+    case TypeKind::Arrow: {
+      if (std::find(arrows.begin(), arrows.end(), type.payload.offset) !=
+          arrows.end()) {
+        return id;
+      }
+      arrows.push_back(type.payload.offset);
+
+      // copied, adding arrows invalidates parts
+      const auto original = parts(id);
+      TypeIDV copy(original.begin(), original.end());
+      bool changed = false;
+      for (auto &part : copy) {
+        const TypeID instance = instantiate(part, generics, arrows);
+        changed |= instance != part;
+        part = instance;
+      }
+
+      arrows.pop_back();
+      return changed ? add_arrow(copy, type.mode) : id;
+    }
+    default:
+      return id;
+    }
+  }
+
+  // arrow replacement shares parts with the original type
+  void resolve(size_t generic_id, Record replacement, Mode mode) {
+    replacement.mode = mode;
+
+    // only slots of this generic are visited, so resolve does not depend on
+    // storage size
+    vector<size_t> slots;
+    if (auto it = generic_slots_.find(generic_id); it != generic_slots_.end()) {
+      slots = std::move(it->second);
+      generic_slots_.erase(it);
+    }
+    if (base_) {
+      if (const auto *base_slots = base_->find_generic_slots(generic_id);
+          base_slots != nullptr) {
+        slots.insert(slots.end(), base_slots->begin(), base_slots->end());
+      }
+    }
+
+    for (size_t id : slots) {
+      // slot can be already resolved by other generic
+      Record type = record(id);
+      if (type.kind != TypeKind::Generic or type.payload.offset != generic_id) {
+        continue;
+      }
+      set_record(id, replacement);
+      if (replacement.kind == TypeKind::Generic) {
+        generic_slots_[replacement.payload.offset].push_back(id);
+      }
+    }
+  }
+
+private:
+  // local types, ids start from base size
+  vector<TypeKind> kinds_;
+  vector<Mode> modes_;
+  vector<Payload> payloads_;
+  vector<TypeID> pool_; // arrow parts, offsets start from base pool size
+
+  vector<string> generic_names_; // by generic id, from base first generic id
+
+  size_t base_size_ = 0;
+  size_t base_pool_size_ = 0;
+  size_t base_first_generic_id_ = 0;
+  shared_ptr<const Storage> base_;
+  unordered_map<size_t, Record> overrides_; // changed base types
+
+  // generic id -> ids of types with this generic (can contain outdated ids)
+  unordered_map<size_t, vector<size_t>> generic_slots_;
+
+  // arrow pools pairs in progress of unify
+  vector<std::pair<uint32_t, uint32_t>> unifying_arrows_;
+};
+
+// sets storage used by TypeID::get in current thread, previous one is
+// restored on destruction
+class StorageScope {
+public:
+  explicit StorageScope(const Storage &storage);
+
+  StorageScope(const StorageScope &) = delete;
+  StorageScope &operator=(const StorageScope &) = delete;
+
+  ~StorageScope();
+
+private:
+  const Storage *previous_;
 };
 
 } // namespace types
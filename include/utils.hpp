@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <source_location>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace utils {
 
@@ -36,4 +39,91 @@ inline void throw_error(string message,
   throw Error{std::move(message), location};
 }
 
+// -----------------
+
+// name -> value map with nested contexts, lookup cost does not depend on
+// context depth, so deep expressions are checked in linear time
+template <typename T> class ScopedMap {
+public:
+  ScopedMap() { contexts_.emplace_back(); }
+
+  T *find(const string &name, bool last_context_only = false) {
+    return const_cast<T *>(
+        static_cast<const ScopedMap *>(this)->find(name, last_context_only));
+  }
+
+  const T *find(const string &name, bool last_context_only = false) const {
+    auto it = bindings_.find(name);
+    if (it == bindings_.end()) {
+      return nullptr;
+    }
+    const Binding &binding = it->second.back();
+    if (last_context_only and binding.depth + 1 != contexts_.size()) {
+      return nullptr;
+    }
+    return &binding.value;
+  }
+
+  // existing variable in last context is not changed
+  T &add(string name, T value) {
+    auto [it, inserted] = bindings_.try_emplace(std::move(name));
+    auto &shadowed = it->second;
+    if (not shadowed.empty() and shadowed.back().depth + 1 == contexts_.size()) {
+      return shadowed.back().value;
+    }
+    shadowed.push_back(
+        {static_cast<uint32_t>(contexts_.size() - 1), std::move(value)});
+    contexts_.back().push_back(&*it);
+    return shadowed.back().value;
+  }
+
+  // existing variable in last context is replaced
+  T &assign(string name, T value) {
+    T &current = add(std::move(name), value);
+    current = std::move(value);
+    return current;
+  }
+
+  // adds to the outermost context, name should not be visible
+  T &add_outermost(string name, T value) {
+    auto &entry = *bindings_.try_emplace(std::move(name)).first;
+    entry.second.insert(entry.second.begin(), {0, std::move(value)});
+    contexts_.front().push_back(&entry);
+    return entry.second.front().value;
+  }
+
+  void enter_context() { contexts_.emplace_back(); }
+
+  void exit_context() {
+    for (auto *entry : contexts_.back()) {
+      entry->second.pop_back();
+      if (entry->second.empty()) {
+        bindings_.erase(entry->first);
+      }
+    }
+    contexts_.pop_back();
+  }
+
+  // visits all values, including shadowed ones
+  template <typename F> void for_each(F &&visit) {
+    for (auto &[name, shadowed] : bindings_) {
+      for (auto &binding : shadowed) {
+        visit(binding.value);
+      }
+    }
+  }
+
+private:
+  struct Binding {
+    uint32_t depth;
+    T value;
+  };
+
+  using Entry = pair<const string, vector<Binding>>;
+
+  // innermost binding is last, entries are not moved by rehashing
+  unordered_map<string, vector<Binding>> bindings_;
+  vector<vector<Entry *>> contexts_;
+};
+
 } // namespace utils
@@ -0,0 +1,351 @@
+#include "closure.hpp"
+
+#include <unordered_set>
+
+namespace closure {
+
+namespace {
+
+constexpr uint32_t NO_FUNCTION = std::numeric_limits<uint32_t>::max();
+
+struct Binding {
+  uint32_t depth;         // lambdas enclosing binding
+  uint32_t self_function; // function of let-bound lambda for let names
+};
+
+size_t field_size(const types::Storage &storage, types::TypeID type) {
+  if (not type.is_valid()) {
+    return 8;
+  }
+
+  switch (storage.kind(type)) {
+  case types::TypeKind::Int:
+    return 8;
+  case types::TypeKind::Bool:
+    return 1;
+  case types::TypeKind::Arrow:
+    return 16;
+  case types::TypeKind::Generic:
+    return 8;
+  default:
+    utils::unreachable();
+  }
+}
+
+size_t align(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+class Converter {
+public:
+  Converter(const types::Storage &storage, const nodes::TypeTable &node_types)
+      : storage_(storage), node_types_(node_types) {}
+
+  Program run(const nodes::ExprPtr &root) {
+    frames_.emplace_back(root);
+    while (not frames_.empty()) {
+      step();
+    }
+
+    Program program;
+    program.functions = std::move(functions_);
+    program.main = std::move(result_);
+    program.types = std::move(types_);
+    program.stats = stats_;
+    return program;
+  }
+
+private:
+  struct Frame {
+    Frame(const nodes::ExprPtr &expr) : expr(&expr) {}
+
+    const nodes::ExprPtr *expr;
+    size_t stage = 0;
+    uint32_t function = NO_FUNCTION;
+    nodes::ExprPtrV results = {}; // converted children
+  };
+
+  void push(const nodes::ExprPtr &expr) { frames_.emplace_back(expr); }
+
+  // pops frame, result is added to converted children of the parent
+  void finish(nodes::ExprPtr result) {
+    frames_.pop_back();
+    result_ = std::move(result);
+  }
+
+  void step() {
+    Frame &frame = frames_.back();
+    if (result_ != nullptr) {
+      frame.results.push_back(std::move(result_));
+      result_ = nullptr;
+    }
+    const auto &value = (*frame.expr)->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      finish(*frame.expr);
+      break;
+    case 1: // Var
+      use(std::get<1>(value));
+      finish(*frame.expr);
+      break;
+    case 2: // Let
+      step_let(frame, std::get<2>(value));
+      break;
+    case 3: // Lambda
+      step_lambda(frame, std::get<3>(value));
+      break;
+    case 4: { // Call
+      const auto &call = std::get<4>(value);
+      const size_t stage = frame.stage++;
+      if (stage == 0) {
+        push(call.func);
+      } else if (stage <= call.args.size()) {
+        push(call.args[stage - 1]);
+      } else {
+        finish(rebuild(frame));
+      }
+      break;
+    }
+    case 5: { // Condition
+      const auto &condition = std::get<5>(value);
+      switch (frame.stage++) {
+      case 0:
+        push(condition.condition);
+        break;
+      case 1:
+        push(condition.then_case);
+        break;
+      case 2:
+        push(condition.else_case);
+        break;
+      default:
+        finish(rebuild(frame));
+      }
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_let(Frame &frame, const nodes::Let &expr) {
+    switch (frame.stage++) {
+    case 0: {
+      // body lambda becomes next function
+      const bool lambda_body = expr.body->value.index() == 3;
+      scopes_.enter_context();
+      scopes_.add(expr.name.name,
+                  Binding{depth_, lambda_body
+                                      ? static_cast<uint32_t>(functions_.size())
+                                      : NO_FUNCTION});
+      if (lambda_body) {
+        self_name_ = expr.name.name;
+      }
+      push(expr.body);
+      break;
+    }
+    case 1:
+      push(expr.where);
+      break;
+    case 2:
+      scopes_.exit_context();
+      finish(rebuild(frame));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_lambda(Frame &frame, const nodes::Lambda &expr) {
+    switch (frame.stage++) {
+    case 0: {
+      frame.function = static_cast<uint32_t>(functions_.size());
+      std::string self_name = std::exchange(self_name_, {});
+      const std::string prefix = self_name.empty() ? "lambda" : self_name;
+      functions_.push_back(Function{
+          .name = prefix + "#" + std::to_string(frame.function),
+          .self_name = std::move(self_name),
+          .params = expr.args,
+          .body = nullptr,
+      });
+      open_.push_back(OpenFunction{frame.function, depth_, {}});
+
+      ++depth_;
+      scopes_.enter_context();
+      for (const auto &arg : expr.args) {
+        scopes_.add(arg.name, Binding{depth_, NO_FUNCTION});
+      }
+      push(expr.expr);
+      break;
+    }
+    case 1: {
+      scopes_.exit_context();
+      --depth_;
+      open_.pop_back();
+
+      Function &function = functions_[frame.function];
+      function.body = std::move(frame.results.front());
+      const types::TypeID closure_type = node_types_.get(expr.id);
+      layout(function, closure_type);
+      finish(construct(function, closure_type));
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+
+  // node with converted children, copied only if some child is changed
+  nodes::ExprPtr rebuild(Frame &frame) {
+    const nodes::Expr &expr = **frame.expr;
+
+    size_t next = 0;
+    bool changed = false;
+    nodes::for_each_child(expr, [&frame, &next,
+                                 &changed](const nodes::ExprPtr &child) {
+      changed |= child != frame.results[next++];
+    });
+    if (not changed) {
+      return *frame.expr;
+    }
+
+    nodes::Expr copy = nodes::copy_node(expr);
+    types_.set(nodes::id_of(copy), node_types_.get(nodes::id_of(expr)));
+    if (const auto *let = std::get_if<nodes::Let>(&expr.value)) {
+      types_.set(std::get<nodes::Let>(copy.value).name.id,
+                 node_types_.get(let->name.id));
+    }
+
+    next = 0;
+    nodes::for_each_child(copy, [&frame, &next](nodes::ExprPtr &child) {
+      child = std::move(frame.results[next++]);
+    });
+    return nodes::make_expr(std::move(copy));
+  }
+
+  // bindings outside of lambda are captured by it and by enclosing lambdas
+  // up to binding
+  void use(const nodes::Var &var) {
+    const Binding *binding = scopes_.find(var.name);
+    if (binding == nullptr) {
+      return; // prelude name
+    }
+
+    for (auto it = open_.rbegin(); it != open_.rend(); ++it) {
+      if (it->depth < binding->depth or
+          it->function == binding->self_function) {
+        break;
+      }
+      if (it->captured.insert(var.name).second) {
+        const types::TypeID type = node_types_.get(var.id);
+        functions_[it->function].captures.push_back(Capture{
+            .name = var.name,
+            .type = type,
+            .kind = capture_kind(type),
+            .offset = 0,
+            .size = field_size(storage_, type),
+        });
+      }
+    }
+  }
+
+  CaptureKind capture_kind(types::TypeID type) const {
+    if (not type.is_valid()) {
+      return CaptureKind::Copy;
+    }
+    const types::Mode mode = storage_.mode(type);
+    return mode.uniq == types::Mode::Uniq::UNIQUE or
+                   mode.lin == types::Mode::Lin::ONCE
+               ? CaptureKind::Move
+               : CaptureKind::Copy;
+  }
+
+  void layout(Function &function, types::TypeID closure_type) {
+    if (closure_type.is_valid()) {
+      const types::Mode mode = storage_.mode(closure_type);
+      if (mode.loc == types::Mode::Loc::LOCAL) {
+        function.env = EnvKind::Stack;
+      } else if (mode.lin == types::Mode::Lin::ONCE) {
+        function.env = EnvKind::SingleUse;
+      }
+    }
+
+    size_t offset = 0;
+    for (auto &capture : function.captures) {
+      capture.offset = align(offset, std::min<size_t>(capture.size, 8));
+      offset = capture.offset + capture.size;
+      stats_.moved += capture.kind == CaptureKind::Move;
+    }
+    function.env_size = align(offset, 8);
+
+    ++stats_.functions;
+    stats_.captures += function.captures.size();
+    switch (function.env) {
+    case EnvKind::Stack:
+      stats_.stack_bytes += function.env_size;
+      break;
+    case EnvKind::SingleUse:
+      stats_.single_use_bytes += function.env_size;
+      break;
+    case EnvKind::Heap:
+      stats_.heap_bytes += function.env_size;
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  // lambda -> function name applied to captured values
+  nodes::ExprPtr construct(const Function &function,
+                           types::TypeID closure_type) {
+    auto func = typed_var(function.name, closure_type);
+    if (function.captures.empty()) {
+      return func;
+    }
+
+    nodes::ExprPtrV values;
+    values.reserve(function.captures.size());
+    for (const auto &capture : function.captures) {
+      values.push_back(typed_var(capture.name, capture.type));
+    }
+    nodes::Call call(func, std::move(values));
+    types_.set(call.id, closure_type);
+    return nodes::make_expr<nodes::Call>(std::move(call));
+  }
+
+  nodes::ExprPtr typed_var(const std::string &name, types::TypeID type) {
+    nodes::Var var(name);
+    types_.set(var.id, type);
+    return nodes::make_expr<nodes::Var>(std::move(var));
+  }
+
+private:
+  struct OpenFunction {
+    uint32_t function;
+    uint32_t depth; // bindings from this depth are inside of function
+    std::unordered_set<std::string> captured;
+  };
+
+  const types::Storage &storage_;
+  const nodes::TypeTable &node_types_;
+
+  std::vector<Frame> frames_;
+  nodes::ExprPtr result_; // converted last finished expression
+  nodes::TypeTable types_;
+  utils::ScopedMap<Binding> scopes_;
+  std::vector<OpenFunction> open_;
+  std::vector<Function> functions_;
+  std::string self_name_; // let name, taken by lambda pushed as let body
+  uint32_t depth_ = 0;
+  Stats stats_;
+};
+
+} // namespace
+
+Program convert(const nodes::ExprPtr &expr, const types::Storage &storage,
+                const nodes::TypeTable &node_types) {
+  return Converter(storage, node_types).run(expr);
+}
+
+} // namespace closure
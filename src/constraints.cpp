@@ -0,0 +1,474 @@
+#include "constraints.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+namespace constraints {
+
+using types::TypeID;
+using types::UnifyModePolicy;
+
+namespace {
+
+const char *reason_message(Reason reason) {
+  switch (reason) {
+  case Reason::LetBody:
+  case Reason::CallArg:
+    return "DIFFERENT_TYPES_OR_MODES";
+  case Reason::CallFunc:
+    return "FUNC_IS_NOT_ARROW_TYPE";
+  case Reason::ConditionBool:
+  case Reason::ConditionBranches:
+    return "DIFFERENT_TYPES";
+  }
+  utils::unreachable();
+}
+
+void add_unify(ConstraintSet &set, const nodes::Expr &origin, Reason reason,
+               TypeID left, TypeID right, UnifyModePolicy policy) {
+  set.constraints.push_back(Constraint{.kind = ConstraintKind::Unify,
+                                       .reason = reason,
+                                       .policy = policy,
+                                       .left = left,
+                                       .right = right});
+  set.origins.push_back(&origin);
+}
+
+} // namespace
+
+// same traversal as type_check::IterativeChecker, but constraints are
+// recorded instead of unified
+class Generator {
+public:
+  Generator(type_check::State &state, ConstraintSet &set)
+      : state_(state), set_(set) {}
+
+  TypeID run(const nodes::Expr &root) {
+    push(root);
+    try {
+      while (not frames_.empty()) {
+        step();
+      }
+    } catch (...) {
+      for (auto it = frames_.rbegin(); it != frames_.rend(); ++it) {
+        if (it->context_entered) {
+          state_.manager.exit_context();
+        }
+      }
+      throw;
+    }
+    return result_;
+  }
+
+private:
+  struct Frame {
+    Frame(const nodes::Expr &expr) : expr(&expr) {}
+
+    const nodes::Expr *expr;
+    size_t stage = 0;
+    bool context_entered = false;
+    TypeID saved_type; // Let - name, Condition - then case, Call - callee
+    types::TypeIDV types; // Lambda - arrow, Call - args
+  };
+
+  void push(const nodes::Expr &expr) { frames_.emplace_back(expr); }
+
+  void enter_context(Frame &frame) {
+    state_.manager.enter_context();
+    frame.context_entered = true;
+  }
+
+  void finish(TypeID type) {
+    if (frames_.back().context_entered) {
+      state_.manager.exit_context();
+    }
+    frames_.pop_back();
+    result_ = type;
+  }
+
+  void step() {
+    Frame &frame = frames_.back();
+    auto &value = frame.expr->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      finish(state_.annotate(std::get<0>(value),
+                            state_.type_storage.get_int_type()));
+      break;
+    case 1: { // Var
+      const auto &var = std::get<1>(value);
+      finish(state_.annotate(
+          var, state_.manager.use_var_type(var.name, state_.type_storage)));
+      break;
+    }
+    case 2: // Let
+      step_let(frame, std::get<2>(value));
+      break;
+    case 3: // Lambda
+      step_lambda(frame, std::get<3>(value));
+      break;
+    case 4: // Call
+      step_call(frame, std::get<4>(value));
+      break;
+    case 5: // Condition
+      step_condition(frame, std::get<5>(value));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_let(Frame &frame, const nodes::Let &expr) {
+    switch (frame.stage++) {
+    case 0: {
+      enter_context(frame);
+
+      TypeID new_type = state_.type_storage.introduce_new_generic(
+          expr.name.name, expr.name.mode_hint);
+      state_.annotate(expr.name, new_type);
+      state_.manager.add_var(expr.name.name, new_type);
+      frame.saved_type = new_type;
+
+      push(*expr.body);
+      break;
+    }
+    case 1:
+      add_unify(set_, *frame.expr, Reason::LetBody, frame.saved_type, result_,
+                UnifyModePolicy::CheckLeftIsSubmode);
+      push(*expr.where);
+      break;
+    case 2:
+      finish(state_.annotate(expr, result_));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_lambda(Frame &frame, const nodes::Lambda &expr) {
+    switch (frame.stage++) {
+    case 0:
+      enter_context(frame);
+
+      frame.types.reserve(expr.args.size() + 1);
+      for (const auto &arg : expr.args) {
+        TypeID new_type =
+            state_.type_storage.introduce_new_generic(arg.name, arg.mode_hint);
+        state_.annotate(arg, new_type);
+        frame.types.push_back(new_type);
+        state_.manager.add_var(arg.name, new_type);
+      }
+
+      push(*expr.expr);
+      break;
+    case 1:
+      frame.types.push_back(result_);
+      finish(
+          state_.annotate(expr, state_.type_storage.add_arrow(frame.types)));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  // stage 0 - generate func, stage 1 + i - previous part generated
+  void step_call(Frame &frame, const nodes::Call &expr) {
+    size_t stage = frame.stage++;
+
+    if (stage == 0) {
+      push(*expr.func);
+      return;
+    }
+
+    const auto args_count = static_cast<uint32_t>(expr.args.size());
+
+    if (stage == 1) {
+      frame.saved_type = result_;
+    } else {
+      // emitted right after arg, as in type_check
+      set_.constraints.push_back(
+          Constraint{.kind = ConstraintKind::ApplyArg,
+                     .reason = Reason::CallArg,
+                     .left = frame.saved_type,
+                     .right = result_,
+                     .arg_index = static_cast<uint32_t>(stage - 2),
+                     .args_count = args_count});
+      set_.origins.push_back(frame.expr);
+    }
+
+    size_t next_arg_id = stage - 1;
+    if (next_arg_id < expr.args.size()) {
+      push(*expr.args[next_arg_id]);
+      return;
+    }
+
+    // result is known only after callee type is solved
+    TypeID result_type = state_.type_storage.introduce_new_generic("ret");
+
+    set_.constraints.push_back(
+        Constraint{.kind = ConstraintKind::ApplyResult,
+                   .reason = Reason::CallFunc,
+                   .left = frame.saved_type,
+                   .right = result_type,
+                   .args_count = args_count});
+    set_.origins.push_back(frame.expr);
+
+    finish(state_.annotate(expr, result_type));
+  }
+
+  void step_condition(Frame &frame, const nodes::Condition &expr) {
+    switch (frame.stage++) {
+    case 0:
+      push(*expr.condition);
+      break;
+    case 1:
+      add_unify(set_, *frame.expr, Reason::ConditionBool, result_,
+                state_.type_storage.get_bool_type(), UnifyModePolicy::Ignore);
+      push(*expr.then_case);
+      break;
+    case 2:
+      frame.saved_type = result_;
+      push(*expr.else_case);
+      break;
+    case 3:
+      add_unify(set_, *frame.expr, Reason::ConditionBranches,
+                frame.saved_type, result_, UnifyModePolicy::ApplyStrongest);
+      finish(state_.annotate(expr, frame.saved_type));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+private:
+  type_check::State &state_;
+  ConstraintSet &set_;
+  std::vector<Frame> frames_;
+  TypeID result_; // type of last finished expression
+};
+
+// ---------------
+
+namespace {
+
+class Solver {
+public:
+  Solver(ConstraintSet &set, types::Storage &storage)
+      : set_(set), storage_(storage) {}
+
+  Solution run() {
+    solution_.stats.generated = set_.constraints.size();
+    failed_.assign(set_.constraints.size(), false);
+
+    mark_duplicates();
+    solve_types();
+
+    // expanded constraints can be equal to other ones
+    mark_duplicates();
+    apply_modes(UnifyModePolicy::ApplyStrongest);
+    apply_modes(UnifyModePolicy::CheckLeftIsSubmode);
+
+    std::stable_sort(diagnostics_.begin(), diagnostics_.end(),
+                     [](const auto &left, const auto &right) {
+                       return left.first < right.first;
+                     });
+    for (auto &[index, diagnostic] : diagnostics_) {
+      solution_.diagnostics.push_back(std::move(diagnostic));
+    }
+    return std::move(solution_);
+  }
+
+private:
+  // equal unify constraints have equal effect within one stage, so only
+  // first of them is solved, call constraints are not expanded yet
+  void mark_duplicates() {
+    auto &constraints = set_.constraints;
+
+    std::vector<uint32_t> order(constraints.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    auto key = [&constraints](uint32_t i) {
+      const auto &constraint = constraints[i];
+      return std::make_tuple(constraint.kind, constraint.policy,
+                             constraint.left.get_id(),
+                             constraint.right.get_id(), i);
+    };
+    std::sort(order.begin(), order.end(),
+              [&key](uint32_t left, uint32_t right) {
+                return key(left) < key(right);
+              });
+
+    for (size_t i = 1; i < order.size(); ++i) {
+      auto &previous = constraints[order[i - 1]];
+      auto &current = constraints[order[i]];
+      if (current.duplicate or current.kind != ConstraintKind::Unify or
+          previous.kind != ConstraintKind::Unify or
+          previous.policy != current.policy or
+          previous.left != current.left or previous.right != current.right) {
+        continue;
+      }
+      current.duplicate = true;
+      ++solution_.stats.duplicates;
+    }
+  }
+
+  void report(size_t index) {
+    report(index, reason_message(set_.constraints[index].reason));
+  }
+
+  void report(size_t index, std::string message) {
+    failed_[index] = true;
+    diagnostics_.emplace_back(
+        index, Diagnostic{std::move(message), set_.origins[index]});
+  }
+
+  // callee type can be solved by later constraints, so calls are deferred
+  // until no progress is possible
+  void solve_types() {
+    std::vector<size_t> pending;
+
+    for (size_t i = 0; i < set_.constraints.size(); ++i) {
+      const Constraint &constraint = set_.constraints[i];
+      if (constraint.duplicate) {
+        continue;
+      }
+
+      switch (constraint.kind) {
+      case ConstraintKind::Unify:
+        if (not storage_.unify(constraint.left, constraint.right,
+                               UnifyModePolicy::Ignore)) {
+          report(i);
+        }
+        break;
+      case ConstraintKind::ApplyArg:
+      case ConstraintKind::ApplyResult:
+        if (not expand(i)) {
+          pending.push_back(i);
+        }
+        break;
+      default:
+        utils::unreachable();
+      }
+    }
+
+    for (bool progress = true; progress and not pending.empty();) {
+      progress = false;
+      std::vector<size_t> still_pending;
+      for (size_t index : pending) {
+        if (expand(index)) {
+          progress = true;
+        } else {
+          still_pending.push_back(index);
+        }
+      }
+      pending = std::move(still_pending);
+    }
+
+    for (size_t index : pending) {
+      if (set_.constraints[index].kind == ConstraintKind::ApplyResult) {
+        report(index);
+      } else {
+        failed_[index] = true;
+      }
+    }
+  }
+
+  // with arrow callee ApplyArg becomes unify of param with arg, and
+  // ApplyResult binds result to callee result type, call errors are reported
+  // once by ApplyResult, returns false when callee is not solved yet
+  bool expand(size_t index) {
+    Constraint &constraint = set_.constraints[index];
+    const bool is_result = constraint.kind == ConstraintKind::ApplyResult;
+
+    if (storage_.is_generic(constraint.left)) {
+      return false;
+    }
+
+    const auto func_parts = storage_.parts(constraint.left);
+    const size_t parts_count = func_parts.size();
+
+    if (not storage_.is_arrow(constraint.left) or
+        parts_count != constraint.args_count + 1) {
+      if (is_result) {
+        report(index, storage_.is_arrow(constraint.left)
+                          ? "ARG_COUNT_MISMATCH"
+                          : reason_message(constraint.reason));
+      } else {
+        failed_[index] = true;
+      }
+      return true;
+    }
+
+    ++solution_.stats.expanded;
+
+    if (not is_result) {
+      constraint.kind = ConstraintKind::Unify;
+      constraint.policy = UnifyModePolicy::CheckLeftIsSubmode;
+      constraint.left = func_parts[constraint.arg_index];
+
+      if (not storage_.unify(constraint.left, constraint.right,
+                             UnifyModePolicy::Ignore)) {
+        report(index);
+      }
+      return true;
+    }
+
+    const TypeID func_result = func_parts.back();
+    if (storage_.is_generic(constraint.right)) {
+      storage_.resolve(
+          types::GenericType{storage_.generic_id(constraint.right), ""},
+          func_result, storage_.mode(func_result));
+    } else if (not storage_.unify(constraint.right, func_result,
+                                  UnifyModePolicy::Ignore)) {
+      // result was already solved by other constraint
+      report(index, "DIFFERENT_TYPES");
+    }
+    return true;
+  }
+
+  void apply_modes(UnifyModePolicy policy) {
+    for (size_t i = 0; i < set_.constraints.size(); ++i) {
+      const Constraint &constraint = set_.constraints[i];
+      if (constraint.kind != ConstraintKind::Unify or constraint.duplicate or
+          constraint.policy != policy or failed_[i]) {
+        continue;
+      }
+
+      if (not storage_.unify(constraint.left, constraint.right, policy)) {
+        report(i);
+      }
+    }
+  }
+
+private:
+  ConstraintSet &set_;
+  types::Storage &storage_;
+  Solution solution_;
+  std::vector<bool> failed_; // constraint already has diagnostic
+  std::vector<std::pair<size_t, Diagnostic>> diagnostics_;
+};
+
+} // namespace
+
+TypeID generate(const nodes::ExprPtr &expr, type_check::State &state,
+                ConstraintSet &set) {
+  return Generator(state, set).run(*expr);
+}
+
+Solution solve(ConstraintSet &set, types::Storage &storage) {
+  return Solver(set, storage).run();
+}
+
+TypeID check_expr_batch(const nodes::ExprPtr &expr, type_check::State &state) {
+  ConstraintSet set;
+  TypeID type = generate(expr, state, set);
+
+  Solution solution = solve(set, state.type_storage);
+  if (not solution.diagnostics.empty()) {
+    utils::throw_error(solution.diagnostics.front().message);
+  }
+  return type;
+}
+
+} // namespace constraints
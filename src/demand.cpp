@@ -0,0 +1,315 @@
+#include "demand.hpp"
+
+#include <unordered_map>
+
+namespace demand {
+
+namespace {
+
+constexpr uint32_t NO_LET = std::numeric_limits<uint32_t>::max();
+
+// name binding: let name or lambda arg
+struct BindingRef {
+  uint32_t let_id; // NO_LET for lambda args
+  uint32_t level;  // bodies on stack from this level are in scope of it
+};
+
+// bodies of let and of its enclosing lets down to stop level are checked
+struct Chain {
+  uint32_t let_id;
+  uint32_t stop;
+
+  bool operator==(const Chain &other) const = default;
+};
+
+struct LetInfo {
+  const nodes::Let *expr;
+  uint32_t level;  // level of own body on stack
+  uint32_t parent; // let with enclosing body, NO_LET at top level
+  bool checked = false;
+  std::vector<uint32_t> uses = {};    // lets used by own code
+  std::vector<Chain> dependents = {}; // bodies using this let
+  // lowest enclosing let with all bodies between checked, NO_LET if not
+  // marked by chain
+  uint32_t chain_end = NO_LET;
+};
+
+class Planner {
+public:
+  explicit Planner(const prelude::Prelude &prelude) : prelude_(prelude) {}
+
+  Plan run(const nodes::Expr &root) {
+    frames_.emplace_back(root);
+    while (not frames_.empty()) {
+      step();
+    }
+
+    propagate();
+
+    Plan plan;
+    plan.lets = lets_.size();
+    for (const auto &let : lets_) {
+      if (not let.checked) {
+        plan.skipped.insert(let.expr);
+      }
+    }
+    return plan;
+  }
+
+private:
+  struct Frame {
+    Frame(const nodes::Expr &expr) : expr(&expr) {}
+
+    const nodes::Expr *expr;
+    size_t stage = 0;
+    uint32_t let_id = NO_LET;
+  };
+
+  void push(const nodes::Expr &expr) { frames_.emplace_back(expr); }
+
+  void step() {
+    Frame &frame = frames_.back();
+    const auto &value = frame.expr->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      frames_.pop_back();
+      break;
+    case 1: // Var
+      use(std::get<1>(value).name);
+      frames_.pop_back();
+      break;
+    case 2: // Let
+      step_let(frame, std::get<2>(value));
+      break;
+    case 3: // Lambda
+      step_lambda(frame, std::get<3>(value));
+      break;
+    case 4: { // Call
+      const auto &call = std::get<4>(value);
+      const size_t stage = frame.stage++;
+      if (stage == 0) {
+        push(*call.func);
+      } else if (stage <= call.args.size()) {
+        push(*call.args[stage - 1]);
+      } else {
+        frames_.pop_back();
+      }
+      break;
+    }
+    case 5: { // Condition
+      const auto &condition = std::get<5>(value);
+      switch (frame.stage++) {
+      case 0:
+        // modes of shared types can be changed by branch join
+        mark_bodies(0);
+        push(*condition.condition);
+        break;
+      case 1:
+        push(*condition.then_case);
+        break;
+      case 2:
+        push(*condition.else_case);
+        break;
+      default:
+        frames_.pop_back();
+      }
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_let(Frame &frame, const nodes::Let &expr) {
+    switch (frame.stage++) {
+    case 0:
+      frame.let_id = static_cast<uint32_t>(lets_.size());
+      lets_.push_back(LetInfo{
+          .expr = &expr,
+          .level = static_cast<uint32_t>(bodies_.size()),
+          .parent = bodies_.empty() ? NO_LET : bodies_.back()});
+
+      scopes_.enter_context();
+      // name is visible in body
+      scopes_.add(expr.name.name,
+                  BindingRef{frame.let_id,
+                             static_cast<uint32_t>(bodies_.size())});
+      bodies_.push_back(frame.let_id);
+      push(*expr.body);
+      break;
+    case 1:
+      bodies_.pop_back();
+      push(*expr.where);
+      break;
+    case 2:
+      scopes_.exit_context();
+      frames_.pop_back();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_lambda(Frame &frame, const nodes::Lambda &expr) {
+    switch (frame.stage++) {
+    case 0:
+      scopes_.enter_context();
+      for (const auto &arg : expr.args) {
+        scopes_.add(arg.name,
+                    BindingRef{NO_LET, static_cast<uint32_t>(bodies_.size())});
+      }
+      push(*expr.expr);
+      break;
+    case 1:
+      scopes_.exit_context();
+      frames_.pop_back();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void use(const std::string &name) {
+    const BindingRef *binding = scopes_.find(name);
+
+    if (binding == nullptr) {
+      if (not is_constant(name)) {
+        mark_bodies(0);
+      }
+      return;
+    }
+
+    if (binding->let_id == NO_LET) {
+      // arg type can be resolved by body
+      mark_bodies(binding->level);
+      return;
+    }
+
+    LetInfo &let = lets_[binding->let_id];
+    if (bodies_.empty()) {
+      add_chain(roots_, Chain{binding->let_id, let.level});
+      return;
+    }
+    lets_[bodies_.back()].uses.push_back(binding->let_id);
+
+    // bodies inside scope of the let should be checked with it, chain is
+    // walked only if the let is checked
+    if (bodies_.size() > binding->level) {
+      add_chain(let.dependents, Chain{bodies_.back(), binding->level});
+    }
+  }
+
+  // bodies of lets with given stack level and above are checked, stack is
+  // not walked here, so repeated marks cost O(1)
+  void mark_bodies(size_t level) {
+    if (bodies_.size() > level) {
+      add_chain(roots_, Chain{bodies_.back(), static_cast<uint32_t>(level)});
+    }
+  }
+
+  // repeated uses from the same body add one chain
+  static void add_chain(std::vector<Chain> &chains, Chain chain) {
+    if (chains.empty() or chains.back() != chain) {
+      chains.push_back(chain);
+    }
+  }
+
+  // prelude name with type without generics and with non-unique mode
+  bool is_constant(const std::string &name) {
+    if (auto it = constants_.find(name); it != constants_.end()) {
+      return it->second;
+    }
+
+    bool constant = false;
+    const auto type = prelude_.types->find_var_type(name);
+    const auto *state = prelude_.modes->find_var_state(name);
+    if (type.has_value() and state != nullptr and
+        state->mode.uniq != types::Mode::Uniq::UNIQUE) {
+      constant = not has_generics(type.value());
+    }
+    return constants_.emplace(name, constant).first->second;
+  }
+
+  bool has_generics(types::TypeID type) const {
+    if (prelude_.storage->is_generic(type)) {
+      return true;
+    }
+    for (auto part : prelude_.storage->parts(type)) {
+      if (has_generics(part)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // lets used by checked code and lets depending on checked lets are checked
+  void propagate() {
+    for (const Chain &chain : roots_) {
+      mark_chain(chain);
+    }
+
+    while (not worklist_.empty()) {
+      const uint32_t id = worklist_.back();
+      worklist_.pop_back();
+
+      for (uint32_t used : lets_[id].uses) {
+        mark(used);
+      }
+      for (const Chain &dependent : lets_[id].dependents) {
+        mark_chain(dependent);
+      }
+    }
+  }
+
+  void mark(uint32_t id) {
+    if (not lets_[id].checked) {
+      lets_[id].checked = true;
+      worklist_.push_back(id);
+    }
+  }
+
+  // already marked parts of chain are skipped by chain_end, which is moved
+  // down for all visited lets, so each let is marked by chains once
+  void mark_chain(Chain chain) {
+    path_.clear();
+    uint32_t id = chain.let_id;
+    while (id != NO_LET and lets_[id].level >= chain.stop) {
+      LetInfo &let = lets_[id];
+      if (let.chain_end == NO_LET) {
+        mark(id);
+        let.chain_end = id;
+      }
+      path_.push_back(id);
+      id = lets_[let.chain_end].parent;
+    }
+
+    if (not path_.empty()) {
+      const uint32_t end = lets_[path_.back()].chain_end;
+      for (uint32_t visited : path_) {
+        lets_[visited].chain_end = end;
+      }
+    }
+  }
+
+private:
+  const prelude::Prelude &prelude_;
+  std::vector<Frame> frames_;
+
+  utils::ScopedMap<BindingRef> scopes_;
+  std::vector<uint32_t> bodies_; // lets with bodies that are visited
+
+  std::vector<LetInfo> lets_;
+  std::vector<Chain> roots_; // checked by checked code
+  std::vector<uint32_t> worklist_;
+  std::vector<uint32_t> path_; // lets visited by mark_chain
+  std::unordered_map<std::string, bool> constants_;
+};
+
+} // namespace
+
+Plan plan(const nodes::Expr &root, const prelude::Prelude &prelude) {
+  return Planner(prelude).run(root);
+}
+
+} // namespace demand
@@ -0,0 +1,587 @@
+#include "eval.hpp"
+#include "task_pool.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+
+namespace eval {
+
+namespace {
+
+// --- planning
+
+// parts of call (function, args) or condition (condition, branches)
+// evaluated as tasks
+using Plan = std::unordered_map<const nodes::Expr *, std::vector<bool>>;
+
+struct Summary {
+  size_t size = 1;
+  std::vector<const nodes::Arg *> exclusive = {}; // sorted
+  bool only_builtin_calls = true;
+};
+
+std::optional<Builtin> builtin(std::string_view name) {
+  if (name == "+") {
+    return Builtin::Add;
+  }
+  if (name == "-") {
+    return Builtin::Sub;
+  }
+  if (name == "*") {
+    return Builtin::Mul;
+  }
+  if (name == "<") {
+    return Builtin::Less;
+  }
+  if (name == "==") {
+    return Builtin::Equal;
+  }
+  return std::nullopt;
+}
+
+class Planner {
+public:
+  Planner(const types::Storage &storage, const nodes::TypeTable &node_types,
+          const Options &options)
+      : storage_(storage), node_types_(node_types), options_(options) {}
+
+  Plan run(const nodes::Expr &root) {
+    frames_.push_back(Frame{&root});
+    while (not frames_.empty()) {
+      step();
+    }
+    return std::move(plan_);
+  }
+
+private:
+  struct Frame {
+    const nodes::Expr *expr;
+    size_t stage = 0;
+  };
+
+  void push(const nodes::Expr &expr) { frames_.push_back(Frame{&expr}); }
+
+  void step() {
+    Frame &frame = frames_.back();
+    const auto &value = frame.expr->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      summaries_.emplace_back();
+      frames_.pop_back();
+      break;
+    case 1: // Var
+      step_var(std::get<1>(value));
+      frames_.pop_back();
+      break;
+    case 2: { // Let
+      const auto &let = std::get<2>(value);
+      switch (frame.stage++) {
+      case 0:
+        scopes_.enter_context();
+        scopes_.add(let.name.name, &let.name);
+        push(*let.body);
+        break;
+      case 1:
+        push(*let.where);
+        break;
+      default:
+        scopes_.exit_context();
+        summaries_.push_back(merge(2));
+        frames_.pop_back();
+      }
+      break;
+    }
+    case 3: { // Lambda
+      const auto &lambda = std::get<3>(value);
+      if (frame.stage++ == 0) {
+        scopes_.enter_context();
+        for (const auto &arg : lambda.args) {
+          scopes_.add(arg.name, &arg);
+        }
+        push(*lambda.expr);
+        break;
+      }
+      scopes_.exit_context();
+      // body is not evaluated by closure creation, captures are used
+      summaries_.back().size = 1;
+      summaries_.back().only_builtin_calls = true;
+      frames_.pop_back();
+      break;
+    }
+    case 4: { // Call
+      const auto &call = std::get<4>(value);
+      const size_t stage = frame.stage++;
+      if (stage == 0) {
+        push(*call.func);
+      } else if (stage <= call.args.size()) {
+        push(*call.args[stage - 1]);
+      } else {
+        finish_call(*frame.expr, call);
+        frames_.pop_back();
+      }
+      break;
+    }
+    case 5: { // Condition
+      const auto &condition = std::get<5>(value);
+      switch (frame.stage++) {
+      case 0:
+        push(*condition.condition);
+        break;
+      case 1:
+        push(*condition.then_case);
+        break;
+      case 2:
+        push(*condition.else_case);
+        break;
+      default:
+        finish_condition(*frame.expr);
+        frames_.pop_back();
+      }
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_var(const nodes::Var &var) {
+    Summary summary;
+    const nodes::Arg *const *binding = scopes_.find(var.name);
+    const types::TypeID type = node_types_.get(var.id);
+    if (binding != nullptr and type.is_valid() and
+        storage_.mode(type).uniq != types::Mode::Uniq::SHARED) {
+      summary.exclusive.push_back(*binding);
+    }
+    summaries_.push_back(std::move(summary));
+  }
+
+  void finish_call(const nodes::Expr &expr, const nodes::Call &call) {
+    const size_t parts = call.args.size() + 1;
+    std::vector<bool> spawned = select(parts, [](size_t) { return true; });
+
+    // every heavy part can not be spawned, one of them is evaluated in place
+    const size_t first = summaries_.size() - parts;
+    size_t last_spawned = parts;
+    bool heavy_in_place = false;
+    for (size_t i = 0; i < parts; ++i) {
+      if (spawned[i]) {
+        last_spawned = i;
+      } else {
+        heavy_in_place |= is_heavy(summaries_[first + i]);
+      }
+    }
+    if (last_spawned != parts and not heavy_in_place) {
+      spawned[last_spawned] = false;
+    }
+    add_plan(expr, std::move(spawned));
+
+    const auto *func = std::get_if<nodes::Var>(&call.func->value);
+    const bool builtin_call = func != nullptr and
+                              scopes_.find(func->name) == nullptr and
+                              builtin(func->name).has_value();
+    Summary summary = merge(parts);
+    summary.only_builtin_calls &= builtin_call;
+    summaries_.push_back(std::move(summary));
+  }
+
+  // branches are speculated while heavy condition is evaluated
+  void finish_condition(const nodes::Expr &expr) {
+    const size_t first = summaries_.size() - 3;
+    if (is_heavy(summaries_[first])) {
+      add_plan(expr, select(3, [this, first](size_t i) {
+                 return i != 0 and summaries_[first + i].only_builtin_calls;
+               }));
+    }
+    summaries_.push_back(merge(3));
+  }
+
+  // heavy parts allowed by filter, sharing no exclusive bindings with other
+  // parts
+  template <typename F>
+  std::vector<bool> select(size_t parts, const F &allowed) const {
+    const size_t first = summaries_.size() - parts;
+
+    std::unordered_map<const nodes::Arg *, size_t> uses;
+    for (size_t i = first; i < summaries_.size(); ++i) {
+      for (const auto *binding : summaries_[i].exclusive) {
+        ++uses[binding];
+      }
+    }
+
+    std::vector<bool> spawned(parts, false);
+    for (size_t i = 0; i < parts; ++i) {
+      const Summary &summary = summaries_[first + i];
+      spawned[i] = is_heavy(summary) and allowed(i) and
+                   std::all_of(summary.exclusive.begin(),
+                               summary.exclusive.end(),
+                               [&uses](const nodes::Arg *binding) {
+                                 return uses[binding] == 1;
+                               });
+    }
+    return spawned;
+  }
+
+  bool is_heavy(const Summary &summary) const {
+    return summary.size >= options_.min_parallel_size;
+  }
+
+  void add_plan(const nodes::Expr &expr, std::vector<bool> spawned) {
+    if (std::find(spawned.begin(), spawned.end(), true) != spawned.end()) {
+      plan_.emplace(&expr, std::move(spawned));
+    }
+  }
+
+  // pops summaries of parts, node itself is counted too
+  Summary merge(size_t parts) {
+    Summary result;
+    for (size_t i = summaries_.size() - parts; i < summaries_.size(); ++i) {
+      Summary &part = summaries_[i];
+      result.size += part.size;
+      result.only_builtin_calls &= part.only_builtin_calls;
+      if (result.exclusive.empty()) {
+        result.exclusive = std::move(part.exclusive);
+      } else if (not part.exclusive.empty()) {
+        std::vector<const nodes::Arg *> merged;
+        std::set_union(result.exclusive.begin(), result.exclusive.end(),
+                       part.exclusive.begin(), part.exclusive.end(),
+                       std::back_inserter(merged));
+        result.exclusive = std::move(merged);
+      }
+    }
+    summaries_.resize(summaries_.size() - parts);
+    return result;
+  }
+
+private:
+  const types::Storage &storage_;
+  const nodes::TypeTable &node_types_;
+  const Options &options_;
+
+  std::vector<Frame> frames_;
+  std::vector<Summary> summaries_;
+  utils::ScopedMap<const nodes::Arg *> scopes_;
+  Plan plan_;
+};
+
+// --- evaluation
+
+struct Context {
+  const Plan &plan;
+  task_pool::Pool *pool; // nullptr for sequential evaluation
+  Stats *stats;
+};
+
+// result of part evaluated as task, owned by task too, so result of dropped
+// speculative branch can be written after parent is finished
+struct Spawned {
+  task_pool::Group group;
+  Value value = 0;
+};
+
+int as_int(const Value &value) {
+  if (not std::holds_alternative<int>(value)) {
+    utils::throw_error("NOT_AN_INT");
+  }
+  return std::get<int>(value);
+}
+
+// wraps around instead of overflow
+int wrap(int64_t value) {
+  return static_cast<int>(static_cast<uint32_t>(value));
+}
+
+Value apply_builtin(Builtin builtin, std::span<const Value> args) {
+  if (args.size() != 2) {
+    utils::throw_error("WRONG_ARG_COUNT for builtin");
+  }
+  const int64_t left = as_int(args[0]);
+  const int64_t right = as_int(args[1]);
+
+  switch (builtin) {
+  case Builtin::Add:
+    return wrap(left + right);
+  case Builtin::Sub:
+    return wrap(left - right);
+  case Builtin::Mul:
+    return wrap(left * right);
+  case Builtin::Less:
+    return left < right;
+  case Builtin::Equal:
+    return left == right;
+  default:
+    utils::unreachable();
+  }
+}
+
+class Evaluator {
+public:
+  explicit Evaluator(const Context &context) : context_(context) {}
+
+  Value run(const nodes::Expr &expr, EnvPtr env) {
+    frames_.push_back(Frame{&expr, std::move(env), 0, values_.size()});
+    while (not frames_.empty()) {
+      step();
+    }
+
+    Value result = std::move(values_.back());
+    values_.pop_back();
+    return result;
+  }
+
+private:
+  struct Frame {
+    const nodes::Expr *expr;
+    EnvPtr env;
+    size_t stage;
+    size_t base; // values of parts start here
+    std::vector<std::shared_ptr<Spawned>> spawned = {};
+  };
+
+  void push(const nodes::Expr &expr, EnvPtr env) {
+    frames_.push_back(Frame{&expr, std::move(env), 0, values_.size()});
+  }
+
+  // result of frame is result of expr in env
+  static void replace(Frame &frame, const nodes::Expr &expr, EnvPtr env) {
+    frame.expr = &expr;
+    frame.env = std::move(env);
+    frame.stage = 0;
+    frame.spawned.clear();
+  }
+
+  void step() {
+    Frame &frame = frames_.back();
+    const auto &value = frame.expr->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      values_.emplace_back(std::get<0>(value).value);
+      frames_.pop_back();
+      break;
+    case 1: // Var
+      values_.push_back(lookup(frame.env, std::get<1>(value).name));
+      frames_.pop_back();
+      break;
+    case 2: // Let
+      step_let(frame, std::get<2>(value));
+      break;
+    case 3: // Lambda
+      values_.emplace_back(std::make_shared<const Closure>(
+          Closure{&std::get<3>(value), frame.env, {}}));
+      frames_.pop_back();
+      break;
+    case 4: // Call
+      step_call(frame, std::get<4>(value));
+      break;
+    case 5: // Condition
+      step_condition(frame, std::get<5>(value));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_let(Frame &frame, const nodes::Let &expr) {
+    if (frame.stage == 0) {
+      if (const auto *lambda = std::get_if<nodes::Lambda>(&expr.body->value)) {
+        // let name is visible in lambda body
+        bind(frame, expr, std::make_shared<const Closure>(
+                              Closure{lambda, frame.env, expr.name.name}));
+        return;
+      }
+      frame.stage = 1;
+      push(*expr.body, frame.env);
+      return;
+    }
+
+    Value body = std::move(values_.back());
+    values_.pop_back();
+    bind(frame, expr, std::move(body));
+  }
+
+  void bind(Frame &frame, const nodes::Let &expr, Value value) {
+    auto env = std::make_shared<const Env>(
+        Env{expr.name.name, std::move(value), frame.env});
+    replace(frame, *expr.where, std::move(env));
+  }
+
+  void step_call(Frame &frame, const nodes::Call &expr) {
+    const size_t parts = expr.args.size() + 1;
+    auto part = [&expr](size_t i) -> const nodes::Expr & {
+      return i == 0 ? *expr.func : *expr.args[i - 1];
+    };
+
+    if (frame.stage == 0) {
+      spawn(frame, part);
+    }
+
+    while (frame.stage < parts) {
+      const size_t i = frame.stage++;
+      if (not frame.spawned.empty() and frame.spawned[i] != nullptr) {
+        values_.emplace_back(0); // filled after join
+        continue;
+      }
+      push(part(i), frame.env);
+      return;
+    }
+
+    for (size_t i = 0; i < frame.spawned.size(); ++i) {
+      if (frame.spawned[i] != nullptr) {
+        context_.pool->wait(frame.spawned[i]->group);
+        values_[frame.base + i] = std::move(frame.spawned[i]->value);
+      }
+    }
+    apply(frame);
+  }
+
+  void apply(Frame &frame) {
+    const Value func = values_[frame.base];
+    const std::span<const Value> args(values_.data() + frame.base + 1,
+                                      values_.size() - frame.base - 1);
+
+    if (const auto *builtin = std::get_if<Builtin>(&func)) {
+      Value result = apply_builtin(*builtin, args);
+      values_.resize(frame.base);
+      values_.push_back(std::move(result));
+      frames_.pop_back();
+      return;
+    }
+
+    const auto *closure = std::get_if<std::shared_ptr<const Closure>>(&func);
+    if (closure == nullptr) {
+      utils::throw_error("NOT_A_FUNCTION");
+    }
+
+    const nodes::Lambda &lambda = *(*closure)->lambda;
+    if (args.size() != lambda.args.size()) {
+      utils::throw_error("WRONG_ARG_COUNT");
+    }
+
+    EnvPtr env = (*closure)->env;
+    if (not(*closure)->self_name.empty()) {
+      env = std::make_shared<const Env>(Env{(*closure)->self_name, func, env});
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+      env = std::make_shared<const Env>(
+          Env{lambda.args[i].name, args[i], env});
+    }
+    values_.resize(frame.base);
+    replace(frame, *lambda.expr, std::move(env));
+  }
+
+  void step_condition(Frame &frame, const nodes::Condition &expr) {
+    auto part = [&expr](size_t i) -> const nodes::Expr & {
+      return i == 0 ? *expr.condition
+                    : (i == 1 ? *expr.then_case : *expr.else_case);
+    };
+
+    if (frame.stage == 0) {
+      spawn(frame, part);
+      frame.stage = 1;
+      push(*expr.condition, frame.env);
+      return;
+    }
+
+    const Value condition = std::move(values_.back());
+    values_.pop_back();
+    if (not std::holds_alternative<bool>(condition)) {
+      utils::throw_error("NOT_A_BOOL");
+    }
+
+    const size_t branch = std::get<bool>(condition) ? 1 : 2;
+    if (not frame.spawned.empty() and frame.spawned[branch] != nullptr) {
+      // other branch is dropped, its task owns its result
+      auto spawned = frame.spawned[branch];
+      context_.pool->wait(spawned->group);
+      values_.push_back(std::move(spawned->value));
+      frames_.pop_back();
+      return;
+    }
+    replace(frame, part(branch), frame.env);
+  }
+
+  template <typename F> void spawn(Frame &frame, const F &part) {
+    if (context_.pool == nullptr or context_.plan.empty()) {
+      return;
+    }
+    auto it = context_.plan.find(frame.expr);
+    if (it == context_.plan.end()) {
+      return;
+    }
+
+    const bool condition = frame.expr->value.index() == 5;
+    const auto &parallel = it->second;
+    frame.spawned.resize(parallel.size());
+    for (size_t i = 0; i < parallel.size(); ++i) {
+      if (not parallel[i]) {
+        continue;
+      }
+
+      auto spawned = std::make_shared<Spawned>();
+      frame.spawned[i] = spawned;
+      const Context &context = context_;
+      context.pool->spawn(spawned->group, [&context, &expr = part(i),
+                                           env = frame.env, spawned] {
+        spawned->value = Evaluator(context).run(expr, env);
+      });
+      if (context_.stats != nullptr) {
+        ++(condition ? context_.stats->speculative : context_.stats->tasks);
+      }
+    }
+  }
+
+  static Value lookup(const EnvPtr &env, std::string_view name) {
+    for (const Env *it = env.get(); it != nullptr; it = it->next.get()) {
+      if (it->name == name) {
+        return it->value;
+      }
+    }
+    auto result = builtin(name);
+    if (not result.has_value()) {
+      utils::throw_error("UNKNOWN_NAME " + std::string(name));
+    }
+    return *result;
+  }
+
+private:
+  const Context &context_;
+  std::vector<Frame> frames_;
+  std::vector<Value> values_;
+};
+
+} // namespace
+
+Value evaluate(const nodes::Expr &expr, const types::Storage &storage,
+               const nodes::TypeTable &node_types, const Options &options,
+               Stats *stats) {
+  const Plan plan = Planner(storage, node_types, options).run(expr);
+
+  // tasks refer to context, pool drains them first on destruction
+  Context context{plan, nullptr, stats};
+  std::optional<task_pool::Pool> pool;
+  if (options.threads != 1 and not plan.empty()) {
+    pool.emplace(options.threads);
+    context.pool = &*pool;
+  }
+
+  return Evaluator(context).run(expr, nullptr);
+}
+
+std::string to_string(const Value &value) {
+  switch (value.index()) {
+  case 0: // int
+    return std::to_string(std::get<0>(value));
+  case 1: // bool
+    return std::get<1>(value) ? "true" : "false";
+  case 2: // closure
+    return "<closure>";
+  case 3: // builtin
+    return "<builtin>";
+  default:
+    utils::unreachable();
+  }
+}
+
+} // namespace eval
@@ -0,0 +1,352 @@
+#include "fold.hpp"
+
+#include <optional>
+#include <string_view>
+
+namespace fold {
+
+namespace {
+
+using types::Mode;
+
+// nodes visited by alias check, longer where bodies keep the alias, so
+// chains of aliases are simplified in linear time
+constexpr size_t ALIAS_SCAN_LIMIT = size_t(1) << 16;
+
+enum class Builtin { Add, Sub, Mul, Less, Equal };
+
+std::optional<Builtin> builtin(std::string_view name) {
+  if (name == "+") {
+    return Builtin::Add;
+  }
+  if (name == "-") {
+    return Builtin::Sub;
+  }
+  if (name == "*") {
+    return Builtin::Mul;
+  }
+  if (name == "<") {
+    return Builtin::Less;
+  }
+  if (name == "==") {
+    return Builtin::Equal;
+  }
+  return std::nullopt;
+}
+
+bool is_comparison(Builtin builtin) {
+  return builtin == Builtin::Less or builtin == Builtin::Equal;
+}
+
+// wraps around instead of overflow, as in evaluator
+int wrap(int64_t value) {
+  return static_cast<int>(static_cast<uint32_t>(value));
+}
+
+int64_t apply(Builtin builtin, int64_t left, int64_t right) {
+  switch (builtin) {
+  case Builtin::Add:
+    return wrap(left + right);
+  case Builtin::Sub:
+    return wrap(left - right);
+  case Builtin::Mul:
+    return wrap(left * right);
+  case Builtin::Less:
+    return left < right;
+  case Builtin::Equal:
+    return left == right;
+  default:
+    utils::unreachable();
+  }
+}
+
+const nodes::Const *as_const(const nodes::ExprPtr &expr) {
+  return std::get_if<nodes::Const>(&expr->value);
+}
+
+class Folder {
+public:
+  Folder(const types::Storage &storage, const nodes::TypeTable &node_types)
+      : storage_(storage), node_types_(node_types) {}
+
+  Stats run(nodes::ExprPtr &root) {
+    std::vector<Frame> frames;
+    push(frames, root);
+
+    nodes::ExprPtr result;
+    while (not frames.empty()) {
+      Frame &frame = frames.back();
+      if (result != nullptr) {
+        frame.results.push_back(std::move(result));
+        visited(frame);
+      }
+
+      if (frame.results.size() < frame.children.size()) {
+        push(frames, *frame.children[frame.results.size()]);
+        continue;
+      }
+
+      result = rebuild(frame);
+      frames.pop_back();
+    }
+
+    root = std::move(result);
+    return stats_;
+  }
+
+private:
+  // replacement is set for inlined aliases
+  struct Binding {
+    nodes::ExprPtr replacement = nullptr;
+  };
+
+  struct Frame {
+    const nodes::ExprPtr *expr;
+    std::vector<const nodes::ExprPtr *> children = {};
+    nodes::ExprPtrV results = {};
+    bool pruned = false; // condition replaced by the only child
+  };
+
+  void push(std::vector<Frame> &frames, const nodes::ExprPtr &expr) {
+    Frame frame{&expr};
+    nodes::for_each_child(*expr, [&frame](const nodes::ExprPtr &child) {
+      frame.children.push_back(&child);
+    });
+
+    // let name is visible in body too
+    switch (expr->value.index()) {
+    case 2: // Let
+      bindings_.enter_context();
+      bindings_.assign(std::get<2>(expr->value).name.name, Binding{});
+      break;
+    case 3: // Lambda
+      bindings_.enter_context();
+      for (const auto &arg : std::get<3>(expr->value).args) {
+        bindings_.assign(arg.name, Binding{});
+      }
+      break;
+    default:
+      break;
+    }
+
+    frames.push_back(std::move(frame));
+  }
+
+  // called after each child result
+  void visited(Frame &frame) {
+    if (frame.results.size() != 1) {
+      return;
+    }
+
+    const auto &value = (*frame.expr)->value;
+    switch (value.index()) {
+    case 2: { // Let
+      const auto &let = std::get<2>(value);
+      if (is_alias(let, frame.results[0])) {
+        bindings_.assign(let.name.name, Binding{frame.results[0]});
+      }
+      break;
+    }
+    case 5: // Condition
+      if (not frame.pruned and decided_.has_value()) {
+        const auto &condition = std::get<5>(value);
+        frame.children = {*decided_ ? &condition.then_case
+                                    : &condition.else_case};
+        frame.results.clear();
+        frame.pruned = true;
+        ++stats_.branches;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  nodes::ExprPtr rebuild(Frame &frame) {
+    decided_.reset();
+
+    const nodes::ExprPtr &expr = *frame.expr;
+    const auto &value = expr->value;
+    switch (value.index()) {
+    case 1: { // Var
+      const Binding *binding = bindings_.find(std::get<1>(value).name);
+      if (binding != nullptr and binding->replacement != nullptr) {
+        return nodes::make_expr(nodes::copy_node(*binding->replacement));
+      }
+      return expr;
+    }
+    case 2: { // Let
+      const Binding *binding =
+          bindings_.find(std::get<2>(value).name.name, true);
+      const bool inlined = binding->replacement != nullptr;
+      bindings_.exit_context();
+      if (inlined) {
+        ++stats_.lets;
+        return std::move(frame.results[1]);
+      }
+      break;
+    }
+    case 3: // Lambda
+      bindings_.exit_context();
+      break;
+    case 4: // Call
+      if (auto folded = fold_call(std::get<4>(value), frame.results)) {
+        return folded;
+      }
+      break;
+    case 5: // Condition
+      if (frame.pruned) {
+        return std::move(frame.results[0]);
+      }
+      break;
+    default:
+      break;
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < frame.children.size(); ++i) {
+      changed |= frame.results[i] != *frame.children[i];
+    }
+    if (not changed) {
+      return expr;
+    }
+
+    nodes::Expr copy = nodes::copy_node(*expr);
+    size_t next = 0;
+    nodes::for_each_child(copy, [&frame, &next](nodes::ExprPtr &child) {
+      child = std::move(frame.results[next++]);
+    });
+    return nodes::make_expr(std::move(copy));
+  }
+
+  // constant for arithmetic, decided_ is set for comparison (there are no
+  // bool constants), null if call is not folded
+  nodes::ExprPtr fold_call(const nodes::Call &call,
+                           const nodes::ExprPtrV &results) {
+    const auto *func = std::get_if<nodes::Var>(&results[0]->value);
+    if (func == nullptr or results.size() != 3 or
+        bindings_.find(func->name) != nullptr) {
+      return nullptr;
+    }
+
+    const auto op = builtin(func->name);
+    const auto *left = as_const(results[1]);
+    const auto *right = as_const(results[2]);
+    if (not op.has_value() or left == nullptr or right == nullptr) {
+      return nullptr;
+    }
+
+    const types::TypeID type = node_types_.get(call.id);
+    const auto expected =
+        is_comparison(*op) ? types::TypeKind::Bool : types::TypeKind::Int;
+    if (not type.is_valid() or storage_.kind(type) != expected) {
+      return nullptr;
+    }
+
+    const int64_t result = apply(*op, left->value, right->value);
+    if (is_comparison(*op)) {
+      decided_ = result != 0;
+      return nullptr;
+    }
+    ++stats_.calls;
+    return nodes::make_expr<nodes::Const>(static_cast<int>(result));
+  }
+
+  // let with constant body or body with other name, that refers to the same
+  // binding at all uses of let name, unique or once value is not duplicated
+  bool is_alias(const nodes::Let &let, const nodes::ExprPtr &body) const {
+    if (as_const(body) != nullptr) {
+      return true;
+    }
+
+    const auto *target = std::get_if<nodes::Var>(&body->value);
+    if (target == nullptr or target->name == let.name.name) {
+      return false;
+    }
+
+    const bool linear = is_linear(let.name.mode_hint) or
+                        is_linear(let.name.id) or
+                        is_linear(nodes::id_of(*let.body));
+    return alias_uses(*let.where, let.name.name, target->name,
+                      linear ? 1 : ALIAS_SCAN_LIMIT);
+  }
+
+  // uses of name in where are counted up to max_uses, target should not be
+  // shadowed at them
+  static bool alias_uses(const nodes::Expr &where, const std::string &name,
+                         const std::string &target, size_t max_uses) {
+    std::vector<std::pair<const nodes::Expr *, bool>> stack{{&where, false}};
+    size_t uses = 0;
+    for (size_t visited = 0; not stack.empty(); ++visited) {
+      if (visited == ALIAS_SCAN_LIMIT) {
+        return false;
+      }
+
+      auto [expr, shadowed] = stack.back();
+      stack.pop_back();
+
+      const auto &value = expr->value;
+      switch (value.index()) {
+      case 1: // Var
+        if (std::get<1>(value).name == name and
+            (shadowed or ++uses > max_uses)) {
+          return false;
+        }
+        continue;
+      case 2: { // Let
+        const auto &let_name = std::get<2>(value).name.name;
+        if (let_name == name) {
+          continue;
+        }
+        shadowed |= let_name == target;
+        break;
+      }
+      case 3: { // Lambda
+        bool hides = false;
+        for (const auto &arg : std::get<3>(value).args) {
+          hides |= arg.name == name;
+          shadowed |= arg.name == target;
+        }
+        if (hides) {
+          continue;
+        }
+        break;
+      }
+      default:
+        break;
+      }
+
+      nodes::for_each_child(
+          *expr, [&stack, shadowed](const nodes::ExprPtr &child) {
+            stack.emplace_back(child.get(), shadowed);
+          });
+    }
+    return true;
+  }
+
+  static bool is_linear(Mode mode) {
+    return mode.uniq != Mode::Uniq::SHARED or mode.lin != Mode::Lin::MANY;
+  }
+
+  // not checked node is treated as linear
+  bool is_linear(nodes::NodeId id) const {
+    const types::TypeID type = node_types_.get(id);
+    return not type.is_valid() or is_linear(storage_.mode(type));
+  }
+
+private:
+  const types::Storage &storage_;
+  const nodes::TypeTable &node_types_;
+  utils::ScopedMap<Binding> bindings_;
+  std::optional<bool> decided_; // value of last rebuilt comparison
+  Stats stats_;
+};
+
+} // namespace
+
+Stats simplify(nodes::ExprPtr &expr, const types::Storage &storage,
+               const nodes::TypeTable &node_types) {
+  return Folder(storage, node_types).run(expr);
+}
+
+} // namespace fold
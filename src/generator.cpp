@@ -0,0 +1,268 @@
+#include "generator.hpp"
+
+namespace gen {
+
+namespace {
+
+constexpr size_t LEAF_TRIES = 4; // sampled bindings before falling to const
+
+} // namespace
+
+Generator::Generator(Options options)
+    : options_(options), random_(options.seed) {}
+
+Declaration Generator::declaration() {
+  forget_old();
+  return make_declaration(random_.chance(options_.error_rate));
+}
+
+nodes::ExprPtr Generator::program(bool *error) {
+  // previous declarations are hidden
+  auto values = std::exchange(values_, {});
+  auto functions = std::exchange(functions_, {});
+  const size_t unique_floor = std::exchange(unique_floor_, 0);
+
+  std::vector<Declaration> chain;
+  const size_t count = random_.below(options_.width + 1);
+  bool has_error = false;
+  for (size_t i = 0; i < count; ++i) {
+    chain.push_back(make_declaration(random_.chance(options_.error_rate)));
+    has_error |= chain.back().error;
+  }
+
+  nodes::ExprPtr result =
+      expr(options_.depth, options_.condition_nesting, false);
+  for (size_t i = chain.size(); i-- > 0;) {
+    result = nodes::make_expr<nodes::Let>(std::move(chain[i].name),
+                                          std::move(chain[i].body), result);
+  }
+
+  values_ = std::move(values);
+  functions_ = std::move(functions);
+  unique_floor_ = unique_floor;
+  if (error != nullptr) {
+    *error = has_error;
+  }
+  return result;
+}
+
+Generator::Mark Generator::mark() const {
+  return Mark{values_.size(), functions_.size(), unique_floor_};
+}
+
+void Generator::restore(const Mark &mark) {
+  values_.resize(mark.values, Binding{{}, false});
+  functions_.resize(mark.functions);
+  unique_floor_ = mark.unique_floor;
+}
+
+// only between declarations, when there are no local bindings
+void Generator::forget_old() {
+  while (values_.size() > options_.visible_declarations) {
+    values_.pop_front();
+  }
+  while (functions_.size() > options_.visible_declarations) {
+    functions_.pop_front();
+  }
+}
+
+// error is injected only to value declarations
+Declaration Generator::make_declaration(bool error) {
+  if (not error and random_.below(3) == 0) {
+    std::vector<bool> unique_params;
+    auto body =
+        lambda(options_.depth, options_.condition_nesting, unique_params);
+    auto name = new_arg("f", false);
+    functions_.push_back(Function{name.name, std::move(unique_params)});
+    return Declaration{std::move(name), std::move(body)};
+  }
+
+  // body of injected unique let is unique position too
+  const bool unique = random_.chance(options_.unique_density);
+  auto body =
+      expr(options_.depth, options_.condition_nesting, unique or error);
+  if (error) {
+    body = inject_error(std::move(body));
+  }
+  auto name = new_arg(unique ? "u" : "v", unique);
+  values_.push_back(Binding{name.name, unique});
+  return Declaration{std::move(name), std::move(body), error};
+}
+
+nodes::ExprPtr Generator::expr(size_t depth, size_t conditions,
+                               bool unique_position) {
+  if (depth == 0) {
+    return leaf(unique_position);
+  }
+
+  // type of unique position is unified with the expression type, so the
+  // expression should have own int type, otherwise mode of unresolved
+  // generic (param, result of function) could become unique
+  if (unique_position) {
+    if (random_.below(4) == 0) {
+      return leaf(unique_position);
+    }
+    return operator_call(depth, conditions);
+  }
+
+  switch (random_.below(8)) {
+  case 0:
+  case 1:
+    return leaf(unique_position);
+  case 2:
+    return let_chain(depth, conditions);
+  case 3:
+  case 4:
+    if (not functions_.empty()) {
+      return call(depth, conditions);
+    }
+    break;
+  case 5:
+    if (conditions != 0) {
+      return condition(depth, conditions);
+    }
+    break;
+  default:
+    break;
+  }
+  return operator_call(depth, conditions);
+}
+
+nodes::ExprPtr Generator::operator_call(size_t depth, size_t conditions) {
+  const char *operators[] = {"+", "-", "*"};
+  const size_t op = random_.below(3);
+  // only + can take unique args, and only with sum_uniq prelude
+  const bool unique_args = op == 0 and options_.sum_uniq;
+  auto left = expr(depth - 1, conditions, unique_args);
+  auto right = expr(depth - 1, conditions, unique_args);
+  return nodes::operator_call(operators[op], std::move(left),
+                              std::move(right));
+}
+
+nodes::ExprPtr Generator::leaf(bool unique_position) {
+  // unused unique binding, not captured by lambda
+  if (unique_position and values_.size() > unique_floor_) {
+    for (size_t i = 0; i < LEAF_TRIES; ++i) {
+      Binding &binding = pick(values_, unique_floor_);
+      if (binding.unique and not binding.used) {
+        binding.used = true;
+        return nodes::make_expr<nodes::Var>(binding.name);
+      }
+    }
+  }
+
+  // shared binding can have unresolved generic type, see expr
+  if (not unique_position and not values_.empty() and
+      random_.below(2) == 0) {
+    for (size_t i = 0; i < LEAF_TRIES; ++i) {
+      const Binding &binding = pick(values_);
+      if (not binding.unique) {
+        return nodes::make_expr<nodes::Var>(binding.name);
+      }
+    }
+  }
+
+  return nodes::make_expr<nodes::Const>(static_cast<int>(random_.below(100)));
+}
+
+// let a = .. in let f = \.. -> .. in .. <result>
+nodes::ExprPtr Generator::let_chain(size_t depth, size_t conditions) {
+  const Mark scope = mark();
+
+  std::vector<Declaration> chain;
+  const size_t count = 1 + random_.below(options_.width);
+  for (size_t i = 0; i < count; ++i) {
+    if (random_.below(3) == 0) {
+      std::vector<bool> unique_params;
+      auto body = lambda(depth - 1, conditions, unique_params);
+      auto name = new_arg("f", false);
+      functions_.push_back(Function{name.name, std::move(unique_params)});
+      chain.push_back(Declaration{std::move(name), std::move(body)});
+      continue;
+    }
+
+    const bool unique = random_.chance(options_.unique_density);
+    auto body = expr(depth - 1, conditions, unique);
+    auto name = new_arg(unique ? "u" : "v", unique);
+    values_.push_back(Binding{name.name, unique});
+    chain.push_back(Declaration{std::move(name), std::move(body)});
+  }
+
+  nodes::ExprPtr result = expr(depth - 1, conditions, false);
+  restore(scope);
+
+  for (size_t i = chain.size(); i-- > 0;) {
+    result = nodes::make_expr<nodes::Let>(std::move(chain[i].name),
+                                          std::move(chain[i].body), result);
+  }
+  return result;
+}
+
+nodes::ExprPtr Generator::lambda(size_t depth, size_t conditions,
+                                 std::vector<bool> &unique_params) {
+  const Mark scope = mark();
+  unique_floor_ = values_.size();
+
+  std::vector<nodes::Arg> params;
+  const size_t count = 1 + random_.below(options_.arity);
+  for (size_t i = 0; i < count; ++i) {
+    const bool unique = random_.chance(options_.unique_density);
+    params.push_back(new_arg("a", unique));
+    values_.push_back(Binding{params.back().name, unique});
+    unique_params.push_back(unique);
+  }
+
+  auto body = expr(depth, conditions, false);
+  restore(scope);
+  return nodes::make_expr<nodes::Lambda>(std::move(params), std::move(body));
+}
+
+// args of unique params are unique positions
+nodes::ExprPtr Generator::call(size_t depth, size_t conditions) {
+  const Function function = pick(functions_);
+
+  nodes::ExprPtrV args;
+  args.reserve(function.unique_params.size());
+  for (const bool unique : function.unique_params) {
+    args.push_back(expr(depth - 1, conditions, unique));
+  }
+  return nodes::make_expr<nodes::Call>(
+      nodes::make_expr<nodes::Var>(function.name), std::move(args));
+}
+
+nodes::ExprPtr Generator::condition(size_t depth, size_t conditions) {
+  auto left = expr(depth - 1, conditions - 1, false);
+  auto right = expr(depth - 1, conditions - 1, false);
+  auto then_case = expr(depth - 1, conditions - 1, false);
+  auto else_case = expr(depth - 1, conditions - 1, false);
+  return nodes::make_expr<nodes::Condition>(
+      nodes::operator_call(random_.below(2) == 0 ? "<" : "==",
+                           std::move(left), std::move(right)),
+      std::move(then_case), std::move(else_case));
+}
+
+nodes::ExprPtr Generator::inject_error(nodes::ExprPtr body) {
+  auto name = new_arg("e", true);
+  auto func = new_arg("k", false);
+  auto use = [&name] { return nodes::make_expr<nodes::Var>(name.name); };
+
+  auto consume = nodes::make_expr<nodes::Lambda>(
+      std::vector<nodes::Arg>{new_arg("a", true), new_arg("a", true)},
+      nodes::make_expr<nodes::Const>(0));
+  auto twice = nodes::make_expr<nodes::Call>(
+      nodes::make_expr<nodes::Var>(func.name), nodes::ExprPtrV{use(), use()});
+  return nodes::make_expr<nodes::Let>(
+      name, std::move(body),
+      nodes::make_expr<nodes::Let>(std::move(func), std::move(consume),
+                                   std::move(twice)));
+}
+
+nodes::Arg Generator::new_arg(const char *prefix, bool unique) {
+  return nodes::Arg(prefix + std::to_string(next_name_++), hint(unique));
+}
+
+types::Mode Generator::hint(bool unique) const {
+  return unique ? types::Mode(types::Mode::Uniq::UNIQUE) : types::Mode();
+}
+
+} // namespace gen
@@ -0,0 +1,434 @@
+#include "json.hpp"
+#include "utils.hpp"
+
+#include <charconv>
+#include <cmath>
+
+namespace json {
+
+bool Value::as_bool() const {
+  if (not is_bool()) {
+    utils::throw_error("JSON_NOT_BOOL");
+  }
+  return std::get<bool>(value);
+}
+
+double Value::as_number() const {
+  if (not is_number()) {
+    utils::throw_error("JSON_NOT_NUMBER");
+  }
+  return std::get<double>(value);
+}
+
+int64_t Value::as_integer(int64_t min, int64_t max) const {
+  const double number = as_number();
+  // NaN fails both comparisons
+  if (not(number >= static_cast<double>(min) and
+          number <= static_cast<double>(max)) or
+      std::trunc(number) != number) {
+    utils::throw_error("JSON_NOT_INTEGER");
+  }
+  return static_cast<int64_t>(number);
+}
+
+const std::string &Value::as_string() const {
+  if (not is_string()) {
+    utils::throw_error("JSON_NOT_STRING");
+  }
+  return std::get<std::string>(value);
+}
+
+const Array &Value::as_array() const {
+  if (not is_array()) {
+    utils::throw_error("JSON_NOT_ARRAY");
+  }
+  return std::get<Array>(value);
+}
+
+const Object &Value::as_object() const {
+  if (not is_object()) {
+    utils::throw_error("JSON_NOT_OBJECT");
+  }
+  return std::get<Object>(value);
+}
+
+// children are detached into a list before destruction, so deep values
+// don't overflow stack
+Value::~Value() {
+  std::vector<Value> pending;
+  auto detach = [&pending](Value &value) {
+    auto keep = [&pending](Value &child) {
+      if ((child.is_array() and not std::get<Array>(child.value).empty()) or
+          (child.is_object() and not std::get<Object>(child.value).empty())) {
+        pending.push_back(std::move(child));
+      }
+    };
+    if (auto *array = std::get_if<Array>(&value.value)) {
+      for (auto &child : *array) {
+        keep(child);
+      }
+    } else if (auto *object = std::get_if<Object>(&value.value)) {
+      for (auto &[key, child] : *object) {
+        keep(child);
+      }
+    }
+  };
+
+  detach(*this);
+  while (not pending.empty()) {
+    Value value = std::move(pending.back());
+    pending.pop_back();
+    detach(value);
+  }
+}
+
+const Value *Value::find(const std::string &key) const {
+  if (not is_object()) {
+    return nullptr;
+  }
+  const auto &object = std::get<Object>(value);
+  auto it = object.find(key);
+  return it == object.end() ? nullptr : &it->second;
+}
+
+// ---------------
+
+namespace {
+
+struct Parser {
+  std::string_view text;
+  size_t pos = 0;
+
+  [[noreturn]] void fail(const std::string &message) {
+    utils::throw_error(message + " at " + std::to_string(pos));
+    utils::unreachable();
+  }
+
+  void skip_spaces() {
+    while (pos < text.size() and (text[pos] == ' ' or text[pos] == '\t' or
+                                  text[pos] == '\n' or text[pos] == '\r')) {
+      ++pos;
+    }
+  }
+
+  char peek() {
+    skip_spaces();
+    if (pos >= text.size()) {
+      fail("JSON_UNEXPECTED_END");
+    }
+    return text[pos];
+  }
+
+  void expect(char c) {
+    if (peek() != c) {
+      fail(std::string("JSON_EXPECTED_") + c);
+    }
+    ++pos;
+  }
+
+  void expect_word(std::string_view word) {
+    if (text.substr(pos, word.size()) != word) {
+      fail("JSON_UNEXPECTED_TOKEN");
+    }
+    pos += word.size();
+  }
+
+  void append_utf8(std::string &out, unsigned code) {
+    if (code < 0x80) {
+      out += static_cast<char>(code);
+    } else if (code < 0x800) {
+      out += static_cast<char>(0xC0 | (code >> 6));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      out += static_cast<char>(0xE0 | (code >> 12));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+  }
+
+  std::string parse_string() {
+    expect('"');
+    std::string result;
+    while (true) {
+      if (pos >= text.size()) {
+        fail("JSON_UNTERMINATED_STRING");
+      }
+      char c = text[pos++];
+      if (c == '"') {
+        return result;
+      }
+      if (c != '\\') {
+        result += c;
+        continue;
+      }
+      if (pos >= text.size()) {
+        fail("JSON_UNTERMINATED_STRING");
+      }
+      switch (char escaped = text[pos++]) {
+      case '"':
+      case '\\':
+      case '/':
+        result += escaped;
+        break;
+      case 'b':
+        result += '\b';
+        break;
+      case 'f':
+        result += '\f';
+        break;
+      case 'n':
+        result += '\n';
+        break;
+      case 'r':
+        result += '\r';
+        break;
+      case 't':
+        result += '\t';
+        break;
+      case 'u': {
+        unsigned code = 0;
+        if (pos + 4 > text.size() or
+            std::from_chars(text.data() + pos, text.data() + pos + 4, code, 16)
+                    .ptr != text.data() + pos + 4) {
+          fail("JSON_WRONG_ESCAPE");
+        }
+        pos += 4;
+        append_utf8(result, code);
+        break;
+      }
+      default:
+        fail("JSON_WRONG_ESCAPE");
+      }
+    }
+  }
+
+  double parse_number() {
+    size_t begin = pos;
+    while (pos < text.size() and
+           (isdigit(static_cast<unsigned char>(text[pos])) or
+            text[pos] == '-' or text[pos] == '+' or text[pos] == '.' or
+            text[pos] == 'e' or text[pos] == 'E')) {
+      ++pos;
+    }
+    double result = 0;
+    const auto [end, error] =
+        std::from_chars(text.data() + begin, text.data() + pos, result);
+    if (end != text.data() + pos or error != std::errc()) {
+      fail("JSON_WRONG_NUMBER");
+    }
+    return result;
+  }
+
+  std::string parse_key() {
+    std::string key = parse_string();
+    expect(':');
+    return key;
+  }
+
+  // containers in progress are kept on explicit stack, so nesting depth is
+  // limited by memory only
+  Value parse_value() {
+    struct Frame {
+      Value value; // array or object
+      std::string key = {};
+    };
+    std::vector<Frame> stack;
+
+    while (true) {
+      Value item;
+      switch (peek()) {
+      case '{':
+        ++pos;
+        if (peek() != '}') {
+          stack.push_back(Frame{Object{}, parse_key()});
+          continue;
+        }
+        ++pos;
+        item = Object{};
+        break;
+      case '[':
+        ++pos;
+        if (peek() != ']') {
+          stack.push_back(Frame{Array{}});
+          continue;
+        }
+        ++pos;
+        item = Array{};
+        break;
+      case '"':
+        item = parse_string();
+        break;
+      case 't':
+        expect_word("true");
+        item = true;
+        break;
+      case 'f':
+        expect_word("false");
+        item = false;
+        break;
+      case 'n':
+        expect_word("null");
+        item = nullptr;
+        break;
+      default:
+        item = parse_number();
+        break;
+      }
+
+      // item is added to enclosing containers, finished ones are closed
+      while (true) {
+        if (stack.empty()) {
+          return item;
+        }
+
+        Frame &frame = stack.back();
+        const bool is_object = frame.value.is_object();
+        if (is_object) {
+          std::get<Object>(frame.value.value)
+              .insert_or_assign(std::move(frame.key), std::move(item));
+        } else {
+          std::get<Array>(frame.value.value).push_back(std::move(item));
+        }
+
+        if (peek() == ',') {
+          ++pos;
+          if (is_object) {
+            frame.key = parse_key();
+          }
+          break;
+        }
+        expect(is_object ? '}' : ']');
+        item = std::move(frame.value);
+        stack.pop_back();
+      }
+    }
+  }
+};
+
+void write_string(std::string &out, const std::string &str) {
+  out += '"';
+  for (char c : str) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        static const char *digits = "0123456789abcdef";
+        out += "\\u00";
+        out += digits[(c >> 4) & 0xF];
+        out += digits[c & 0xF];
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+}
+
+} // namespace
+
+Value parse(std::string_view text) {
+  Parser parser{text};
+  Value result = parser.parse_value();
+  parser.skip_spaces();
+  if (parser.pos != text.size()) {
+    parser.fail("JSON_TRAILING_DATA");
+  }
+  return result;
+}
+
+// values are written from explicit work stack of values, keys and
+// punctuation, so nesting depth is limited by memory only
+void write(std::string &out, const Value &value) {
+  struct Item {
+    const Value *value = nullptr;
+    const std::string *key = nullptr; // written with ':'
+    char text = 0;
+  };
+  std::vector<Item> stack{Item{&value}};
+
+  while (not stack.empty()) {
+    const Item item = stack.back();
+    stack.pop_back();
+
+    if (item.text != 0) {
+      out += item.text;
+      continue;
+    }
+    if (item.key != nullptr) {
+      write_string(out, *item.key);
+      out += ':';
+      continue;
+    }
+
+    const auto &current = item.value->value;
+    switch (current.index()) {
+    case 0: // null
+      out += "null";
+      break;
+    case 1: // bool
+      out += std::get<1>(current) ? "true" : "false";
+      break;
+    case 2: { // number
+      double number = std::get<2>(current);
+      if (std::trunc(number) == number and std::abs(number) < 1e15) {
+        out += std::to_string(static_cast<long long>(number));
+      } else {
+        out += std::to_string(number);
+      }
+      break;
+    }
+    case 3: // string
+      write_string(out, std::get<3>(current));
+      break;
+    case 4: { // array
+      const auto &array = std::get<4>(current);
+      out += '[';
+      stack.push_back(Item{.text = ']'});
+      for (size_t i = array.size(); i-- > 0;) {
+        stack.push_back(Item{&array[i]});
+        if (i != 0) {
+          stack.push_back(Item{.text = ','});
+        }
+      }
+      break;
+    }
+    case 5: { // object
+      const auto &object = std::get<5>(current);
+      out += '{';
+      stack.push_back(Item{.text = '}'});
+      for (auto it = object.rbegin(); it != object.rend(); ++it) {
+        stack.push_back(Item{&it->second});
+        stack.push_back(Item{.key = &it->first});
+        if (std::next(it) != object.rend()) {
+          stack.push_back(Item{.text = ','});
+        }
+      }
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+}
+
+std::string dump(const Value &value) {
+  std::string out;
+  write(out, value);
+  return out;
+}
+
+} // namespace json
@@ -1,9 +1,13 @@
 #include "mode_check.hpp"
 #include "parsing_tree.hpp"
+#include "prelude.hpp"
 #include "printers.hpp"
+#include "server.hpp"
 #include "type_check.hpp"
 
 #include <iostream>
+#include <stdexcept>
+#include <string_view>
 
 auto make_program_1(bool uniq) {
   using namespace nodes;
@@ -32,20 +36,6 @@ auto make_program_3() {
                         make_expr<Var>("f"));
 }
 
-void add_builtin_functions_types(type_check::State &state, bool uniq) {
-  auto sum_type = state.type_storage.add(types::make_operator(
-      state.type_storage.get_int_type(
-          uniq ? types::Mode(types::Mode::Uniq::UNIQUE) : types::Mode()),
-      state.type_storage.get_int_type(
-          uniq ? types::Mode(types::Mode::Uniq::UNIQUE) : types::Mode()),
-      state.type_storage.get_int_type()));
-  state.manager.add_var("+", sum_type);
-}
-
-void add_builtin_functions_modes(mode_check::State &state) {
-  state.add_var("+");
-}
-
 void print_error(const std::string &general_message,
                  const utils::Error &error) {
   std::cerr << general_message << " "
@@ -58,21 +48,20 @@ void print_error(const std::string &general_message,
 void run_example(const auto &make_program, bool arg_uniq, bool sum_uniq) {
   const auto program = make_program(arg_uniq);
 
+  const auto prelude = prelude::core(sum_uniq);
+
   std::cout << "\x1b[1;34mPROGRAM:\x1b[0m \x1b[1;90m" << *program
             << "\x1b[0m\n";
-  if (sum_uniq) {
-    std::cout << "+: int<unique> -> int<unique> -> int\n";
-  } else {
-    std::cout << "+: int -> int -> int\n";
-  }
-  std::cout << "\n";
+  std::cout << "+: "
+            << pretty::to_string(*prelude->storage,
+                                 prelude->types->find_var_type("+").value())
+            << "\n\n";
 
-  try {
-    type_check::State state;
-
-    add_builtin_functions_types(state, sum_uniq);
+  // node types point into type storage, so it should outlive mode check
+  type_check::State type_state(prelude->storage, prelude->types);
 
-    type_check::check_expr(program, state);
+  try {
+    type_check::check_expr(program, type_state);
 
   } catch (utils::Error error) {
     print_error("\x1b[1;31mTYPE CHECK ERROR:\x1b[0m", error);
@@ -80,9 +69,8 @@ void run_example(const auto &make_program, bool arg_uniq, bool sum_uniq) {
   }
 
   try {
-    mode_check::State state;
-
-    add_builtin_functions_modes(state);
+    mode_check::State state(prelude->modes, type_state.type_storage,
+                            type_state.node_types);
 
     mode_check::check_expr(program, state);
   } catch (utils::Error error) {
@@ -103,20 +91,21 @@ void run_example_2() {
   try {
     type_check::State state;
 
-    std::cout << "expression type is " << type_check::check_expr(program, state).get().type.index()
+    auto type = type_check::check_expr(program, state);
+    std::cout << "expression type is "
+              << pretty::to_string(state.type_storage, type) << "\n";
+
+    pretty::Options options;
+    options.types = &state.type_storage;
+    options.node_types = &state.node_types;
+    std::cout << "checked program is " << pretty::to_string(*program, options)
               << "\n";
 
-    for (auto &type : state.type_storage.types) {
-      std::cout << type.type.index();
-      if (auto *arrow_type = get_if<types::ArrowType>(&type.type);
-          arrow_type != nullptr) {
-        std::cout << "[-";
-        for (const auto &arg : arrow_type->types) {
-          std::cout << arg.get().type.index() << "-";
-        }
-        std::cout << "]";
-      }
-      std::cout << ' ';
+    for (size_t id = 0; id < state.type_storage.size(); ++id) {
+      std::cout << id << ": "
+                << pretty::to_string(state.type_storage,
+                                     types::TypeID(id))
+                << "\n";
     }
   } catch (utils::Error error) {
     print_error("\x1b[1;31mTYPE CHECK ERROR:\x1b[0m", error);
@@ -126,7 +115,68 @@ void run_example_2() {
   std::cout << "\n\n\x1b[1;34m--- END ---\x1b[0m\n";
 }
 
-int main() {
+int usage(const char *name) {
+  std::cerr << "usage: " << name
+            << " [--serve [--threads N] [--batch] [--infer-modes] [--demand]"
+               " [--monomorphize] [--fold] [--closures] | --stream]"
+               " [--sum-uniq] [--prelude FILE]\n";
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  server::Options serve_options;
+  bool serve = false;
+  bool stream = false;
+  // --threads is parsed by std::stoul, which throws on malformed values
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string_view arg = argv[i];
+      if (arg == "--serve") {
+        serve = true;
+      } else if (arg == "--threads" and i + 1 < argc) {
+        serve_options.threads = std::stoul(argv[++i]);
+      } else if (arg == "--sum-uniq") {
+        serve_options.sum_uniq = true;
+      } else if (arg == "--prelude" and i + 1 < argc) {
+        serve_options.prelude_path = argv[++i];
+      } else if (arg == "--batch") {
+        serve_options.batch_types = true;
+      } else if (arg == "--stream") {
+        stream = true;
+      } else if (arg == "--demand") {
+        serve_options.demand = true;
+      } else if (arg == "--infer-modes") {
+        serve_options.infer_modes = true;
+      } else if (arg == "--monomorphize") {
+        serve_options.monomorphize = true;
+      } else if (arg == "--fold") {
+        serve_options.fold = true;
+      } else if (arg == "--closures") {
+        serve_options.closures = true;
+      } else {
+        return usage(argv[0]);
+      }
+    }
+  } catch (const std::invalid_argument &) {
+    return usage(argv[0]);
+  } catch (const std::out_of_range &) {
+    return usage(argv[0]);
+  }
+
+  if (serve or stream) {
+    try {
+      if (stream) {
+        server::stream(std::cin, std::cout, serve_options);
+      } else {
+        server::serve(std::cin, std::cout, serve_options);
+      }
+    } catch (utils::Error error) {
+      print_error("\x1b[1;31mSERVER ERROR:\x1b[0m", error);
+      return 1;
+    }
+    return 0;
+  }
+
   for (size_t n = 0; n < 8; ++n) {
     std::cout << "\n\x1b[1;34m--- TEST ---\x1b[0m\n";
     run_example(n / 4 == 0 ? &make_program_1 : &make_program_2, n % 2 == 1,
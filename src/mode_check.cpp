@@ -5,11 +5,12 @@ namespace mode_check {
 void check_const(const nodes::Const &, State &) {}
 
 void check_var(const nodes::Var &expr, State &state) {
-  if (not expr.type.has_value()) {
+  const TypeID type = state.type_of(expr);
+  if (not type.is_valid()) {
     utils::throw_error("NO_TYPE for " + expr.name);
     return;
   }
-  auto mode = expr.type.value().get().mode;
+  auto mode = state.get_mode(type);
 
   if (auto maybe_var_state = state.get_var_state(expr.name);
       maybe_var_state.has_value()) {
@@ -29,12 +30,15 @@ void check_var(const nodes::Var &expr, State &state) {
 void check_let(const nodes::Let &expr, State &state) {
   Context context(state);
 
-  check_expr(expr.body, state);
+  if (not state.skips(expr)) {
+    check_expr(expr.body, state);
+  }
 
-  if (not expr.name.type.has_value()) {
+  const TypeID name_type = state.type_of(expr.name);
+  if (not name_type.is_valid()) {
     utils::throw_error("NO_VAR_TYPE for " + expr.name.name);
   }
-  state.add_var(expr.name.name, expr.name.type.value().get().mode);
+  state.add_var(expr.name.name, state.get_mode(name_type));
 
   check_expr(expr.where, state);
 }
@@ -43,22 +47,23 @@ void check_lambda(const nodes::Lambda &expr, State &state) {
   Context context(state);
 
   for (const auto &arg : expr.args) {
-    if (not arg.type.has_value()) {
+    const TypeID arg_type = state.type_of(arg);
+    if (not arg_type.is_valid()) {
       utils::throw_error("NO_VAR_TYPE for " + arg.name);
       continue;
     }
-    state.add_var(arg.name, arg.type.value().get().mode);
+    state.add_var(arg.name, state.get_mode(arg_type));
   }
 
   check_expr(expr.expr, state);
 }
 
 void check_call(const nodes::Call &expr, State &state) {
-  // if (not expr.type.has_value()) {
+  // if (not expr.type.is_valid()) {
   //   utils::throw_error("NO_TYPE");
   //   return;
   // }
-  // auto type = expr.type.value();
+  // auto type = expr.type;
 
   // if (not holds_alternative<types::ArrowType>(type.type)) {
   //   utils::throw_error("WRONG_TYPE");
@@ -112,4 +117,164 @@ void check_expr(nodes::ExprPtr expr, State &state) {
   }
 }
 
+// ---------------
+
+class IterativeChecker {
+public:
+  IterativeChecker(State &state) : state_(state) { state_.visits_.clear(); }
+
+  void run(const nodes::Expr &root) {
+    push(root);
+    try {
+      while (not frames_.empty()) {
+        step();
+      }
+    } catch (...) {
+      // same as context destructors during unwinding in check_expr
+      for (auto it = frames_.rbegin(); it != frames_.rend(); ++it) {
+        if (it->context_entered) {
+          state_.exit_context();
+        }
+      }
+      throw;
+    }
+  }
+
+private:
+  struct Frame {
+    Frame(const nodes::Expr &expr) : expr(&expr) {}
+
+    const nodes::Expr *expr;
+    size_t stage = 0;
+    bool context_entered = false;
+  };
+
+  void push(const nodes::Expr &expr) { frames_.emplace_back(expr); }
+
+  void enter_context(Frame &frame) {
+    state_.enter_context();
+    frame.context_entered = true;
+  }
+
+  void finish() {
+    if (frames_.back().context_entered) {
+      state_.exit_context();
+    }
+    frames_.pop_back();
+  }
+
+  // frame reference is invalidated by push, so it is taken again every step
+  void step() {
+    Frame &frame = frames_.back();
+    const auto &value = frame.expr->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      check_const(std::get<0>(value), state_);
+      finish();
+      break;
+    case 1: // Var
+      check_var(std::get<1>(value), state_);
+      finish();
+      break;
+    case 2: // Let
+      step_let(frame, std::get<2>(value));
+      break;
+    case 3: // Lambda
+      step_lambda(frame, std::get<3>(value));
+      break;
+    case 4: { // Call
+      const auto &call = std::get<4>(value);
+      finish();
+      // checked in order: func, then args
+      for (auto it = call.args.rbegin(); it != call.args.rend(); ++it) {
+        push(**it);
+      }
+      push(*call.func);
+      break;
+    }
+    case 5: { // Condition
+      const auto &condition = std::get<5>(value);
+      finish();
+      push(*condition.else_case);
+      push(*condition.then_case);
+      push(*condition.condition);
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_let(Frame &frame, const nodes::Let &expr) {
+    switch (frame.stage++) {
+    case 0:
+      enter_context(frame);
+      if (not state_.skips(expr)) {
+        push(*expr.body);
+        break;
+      }
+      ++frame.stage;
+      [[fallthrough]];
+    case 1: {
+      const TypeID name_type = state_.type_of(expr.name);
+      if (not name_type.is_valid()) {
+        utils::throw_error("NO_VAR_TYPE for " + expr.name.name);
+      }
+      state_.add_var(expr.name.name, state_.get_mode(name_type));
+      push(*expr.where);
+      break;
+    }
+    case 2:
+      finish();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_lambda(Frame &frame, const nodes::Lambda &expr) {
+    switch (frame.stage++) {
+    case 0:
+      enter_context(frame);
+      for (const auto &arg : expr.args) {
+        const TypeID arg_type = state_.type_of(arg);
+        if (not arg_type.is_valid()) {
+          utils::throw_error("NO_VAR_TYPE for " + arg.name);
+          continue;
+        }
+        state_.add_var(arg.name, state_.get_mode(arg_type));
+      }
+      push(*expr.expr);
+      break;
+    case 1:
+      finish();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+private:
+  State &state_;
+  vector<Frame> frames_;
+};
+
+void check_expr_iterative(nodes::ExprPtr expr, State &state) {
+  IterativeChecker(state).run(*expr);
+}
+
+// ---------------
+
+void check_decl(const nodes::Arg &name, nodes::ExprPtr body, State &state) {
+  // as in check_let, name is not visible in body
+  check_expr_iterative(body, state);
+
+  const TypeID name_type = state.type_of(name);
+  if (not name_type.is_valid()) {
+    utils::throw_error("NO_VAR_TYPE for " + name.name);
+  }
+  state.set_var(name.name, state.get_mode(name_type));
+}
+
 } // namespace mode_check
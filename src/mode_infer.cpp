@@ -0,0 +1,375 @@
+#include "mode_infer.hpp"
+
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace mode_infer {
+
+using types::Mode;
+using types::TypeID;
+
+namespace {
+
+// where value of expression goes, bound for vars used as this expression
+struct Demand {
+  enum class Kind : uint8_t {
+    None,    // condition
+    Callee,  // called, params of let-bound lambda are not leaked
+    Escape,  // unknown use, default mode
+    Binding, // let body, mode of let name
+    Param,   // call arg, mode of callee param
+  };
+
+  Kind kind = Kind::Escape;
+  uint32_t binding = 0; // Binding
+  TypeID param = {};    // Param
+};
+
+struct Binding {
+  TypeID type;
+  bool inferred;
+  uint32_t lambda_depth;
+  size_t uses = 0;
+  std::vector<uint32_t> params = {}; // args of let-bound lambda
+  std::optional<uint32_t> shadowed = {};
+  bool in_body = false; // let body is visited
+};
+
+class Inferrer {
+public:
+  Inferrer(types::Storage &storage, const nodes::TypeTable &node_types,
+           const std::unordered_set<const nodes::Let *> *skipped_lets)
+      : storage_(storage), node_types_(node_types),
+        skipped_lets_(skipped_lets) {}
+
+  Stats run(const nodes::Expr &root) {
+    push(root, Demand{});
+    try {
+      while (not frames_.empty()) {
+        step();
+      }
+    } catch (...) {
+      for (auto it = frames_.rbegin(); it != frames_.rend(); ++it) {
+        if (it->context_entered) {
+          scopes_.exit_context();
+        }
+      }
+      throw;
+    }
+
+    solve();
+    return write();
+  }
+
+private:
+  struct Frame {
+    Frame(const nodes::Expr &expr, Demand demand)
+        : expr(&expr), demand(demand) {}
+
+    const nodes::Expr *expr;
+    Demand demand;
+    size_t stage = 0;
+    bool context_entered = false;
+  };
+
+  void push(const nodes::Expr &expr, Demand demand) {
+    frames_.emplace_back(expr, demand);
+  }
+
+  void enter_context(Frame &frame) {
+    scopes_.enter_context();
+    frame.context_entered = true;
+  }
+
+  void finish() {
+    if (frames_.back().context_entered) {
+      scopes_.exit_context();
+    }
+    frames_.pop_back();
+  }
+
+  uint32_t add_binding(const nodes::Arg &arg) {
+    const TypeID type = node_types_.get(arg.id);
+    if (not type.is_valid()) {
+      utils::throw_error("NO_VAR_TYPE for " + arg.name);
+    }
+
+    const auto id = static_cast<uint32_t>(bindings_.size());
+    const bool inferred = arg.mode_hint == Mode();
+    std::optional<uint32_t> shadowed;
+    if (const uint32_t *found = scopes_.find(arg.name); found != nullptr) {
+      shadowed = *found;
+    }
+    bindings_.push_back(Binding{.type = type,
+                                .inferred = inferred,
+                                .lambda_depth = lambda_depth_,
+                                .shadowed = shadowed});
+    modes_.push_back(inferred ? Mode::bottom() : storage_.mode(type));
+    dependents_.emplace_back();
+
+    binding_by_type_.emplace(type.get_id(), id);
+    scopes_.add(arg.name, id);
+    return id;
+  }
+
+  void step() {
+    Frame &frame = frames_.back();
+    const auto &value = frame.expr->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      finish();
+      break;
+    case 1: // Var
+      use(std::get<1>(value), frame.demand);
+      finish();
+      break;
+    case 2: // Let
+      step_let(frame, std::get<2>(value));
+      break;
+    case 3: // Lambda
+      step_lambda(frame, std::get<3>(value));
+      break;
+    case 4: // Call
+      step_call(frame, std::get<4>(value));
+      break;
+    case 5: // Condition
+      step_condition(frame, std::get<5>(value));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void use(const nodes::Var &expr, Demand demand) {
+    const uint32_t *found = scopes_.find(expr.name);
+    if (found == nullptr) {
+      return; // prelude, not inferred
+    }
+    const uint32_t id = *found;
+    Binding &binding = bindings_[id];
+
+    if (++binding.uses > 1) {
+      raise(id, Mode(Mode::Uniq::SHARED).with(Mode::Lin::MANY).with(
+                    Mode::Loc::LOCAL));
+    }
+
+    if (binding.lambda_depth < lambda_depth_) {
+      raise(id, Mode());
+    }
+
+    if (binding.in_body) {
+      // let body is checked with name in type check, but without it in mode
+      // check, so use is counted for shadowed bindings
+      for (std::optional<uint32_t> current = id; current.has_value();
+           current = bindings_[*current].shadowed) {
+        raise(*current, Mode());
+      }
+    }
+
+    switch (demand.kind) {
+    case Demand::Kind::None:
+    case Demand::Kind::Callee:
+      break;
+    case Demand::Kind::Escape:
+      raise(id, Mode());
+      break;
+    case Demand::Kind::Binding:
+      bounds_.emplace_back(id, demand.binding);
+      break;
+    case Demand::Kind::Param:
+      // param binding can be not visited yet, resolved after walk
+      param_bounds_.emplace_back(id, demand.param);
+      break;
+    }
+
+    if (demand.kind != Demand::Kind::Callee) {
+      // lambda can be called by unknown code
+      for (uint32_t param : binding.params) {
+        raise(param, Mode());
+      }
+    }
+  }
+
+  void step_let(Frame &frame, const nodes::Let &expr) {
+    switch (frame.stage++) {
+    case 0: {
+      enter_context(frame);
+      const uint32_t id = add_binding(expr.name);
+      if (skipped_lets_ == nullptr or not skipped_lets_->contains(&expr)) {
+        bindings_[id].in_body = true;
+        push(*expr.body, Demand{.kind = Demand::Kind::Binding, .binding = id});
+        break;
+      }
+      ++frame.stage;
+      [[fallthrough]];
+    }
+    case 1:
+      bindings_[*scopes_.find(expr.name.name)].in_body = false;
+      // value of let is value of where
+      push(*expr.where, frame.demand);
+      break;
+    case 2:
+      finish();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_lambda(Frame &frame, const nodes::Lambda &expr) {
+    switch (frame.stage++) {
+    case 0:
+      enter_context(frame);
+      ++lambda_depth_;
+
+      for (const auto &arg : expr.args) {
+        const uint32_t id = add_binding(arg);
+        if (frame.demand.kind == Demand::Kind::Binding) {
+          bindings_[frame.demand.binding].params.push_back(id);
+        } else {
+          raise(id, Mode());
+        }
+      }
+
+      push(*expr.expr, Demand{});
+      break;
+    case 1:
+      --lambda_depth_;
+      finish();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_call(Frame &frame, const nodes::Call &expr) {
+    const size_t stage = frame.stage++;
+
+    if (stage == 0) {
+      push(*expr.func, Demand{.kind = Demand::Kind::Callee});
+      return;
+    }
+
+    const size_t arg_id = stage - 1;
+    if (arg_id >= expr.args.size()) {
+      finish();
+      return;
+    }
+
+    const TypeID func_type = node_types_.get(nodes::id_of(*expr.func));
+
+    Demand demand;
+    if (func_type.is_valid() and storage_.is_arrow(func_type) and
+        arg_id + 1 < storage_.parts(func_type).size()) {
+      demand = Demand{.kind = Demand::Kind::Param,
+                      .param = storage_.parts(func_type)[arg_id]};
+    }
+    push(*expr.args[arg_id], demand);
+  }
+
+  void step_condition(Frame &frame, const nodes::Condition &expr) {
+    switch (frame.stage++) {
+    case 0:
+      push(*expr.condition, Demand{.kind = Demand::Kind::None});
+      break;
+    case 1:
+      // branch modes are joined by type check
+      push(*expr.then_case, Demand{});
+      break;
+    case 2:
+      push(*expr.else_case, Demand{});
+      break;
+    case 3:
+      finish();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  // ---------------
+
+  void raise(uint32_t id, Mode mode) {
+    if (not bindings_[id].inferred) {
+      return;
+    }
+
+    const Mode joined = Mode::choose_max(modes_[id], mode);
+    if (joined != modes_[id]) {
+      modes_[id] = joined;
+      ++stats_.updates;
+      worklist_.push_back(id);
+    }
+  }
+
+  // least fixpoint of "mode of binding >= mode of other binding" bounds
+  void solve() {
+    for (auto [id, param] : param_bounds_) {
+      if (auto it = binding_by_type_.find(param.get_id());
+          it != binding_by_type_.end()) {
+        bounds_.emplace_back(id, it->second);
+      } else {
+        raise(id, storage_.mode(param));
+      }
+    }
+
+    for (auto [id, bound] : bounds_) {
+      dependents_[bound].push_back(id);
+      raise(id, modes_[bound]);
+    }
+
+    while (not worklist_.empty()) {
+      const uint32_t bound = worklist_.back();
+      worklist_.pop_back();
+
+      for (uint32_t id : dependents_[bound]) {
+        raise(id, modes_[bound]);
+      }
+    }
+  }
+
+  Stats write() {
+    for (size_t id = 0; id < bindings_.size(); ++id) {
+      if (not bindings_[id].inferred) {
+        continue;
+      }
+      ++stats_.bindings;
+      if (modes_[id] != Mode()) {
+        ++stats_.refined;
+      }
+      storage_.set_mode(bindings_[id].type, modes_[id]);
+    }
+    return stats_;
+  }
+
+private:
+  types::Storage &storage_;
+  const nodes::TypeTable &node_types_;
+  const std::unordered_set<const nodes::Let *> *skipped_lets_;
+  std::vector<Frame> frames_;
+  utils::ScopedMap<uint32_t> scopes_;
+  uint32_t lambda_depth_ = 0;
+
+  std::vector<Binding> bindings_;
+  std::vector<Mode> modes_;                       // by binding
+  std::vector<std::vector<uint32_t>> dependents_; // by bound binding
+  std::unordered_map<uint32_t, uint32_t> binding_by_type_;
+
+  std::vector<std::pair<uint32_t, uint32_t>> bounds_; // binding >= binding
+  std::vector<std::pair<uint32_t, TypeID>> param_bounds_;
+  std::vector<uint32_t> worklist_;
+
+  Stats stats_;
+};
+
+} // namespace
+
+Stats infer(const nodes::ExprPtr &expr, types::Storage &storage,
+            const nodes::TypeTable &node_types,
+            const std::unordered_set<const nodes::Let *> *skipped_lets) {
+  return Inferrer(storage, node_types, skipped_lets).run(*expr);
+}
+
+} // namespace mode_infer
@@ -0,0 +1,685 @@
+#include "monomorphize.hpp"
+
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace mono {
+
+namespace {
+
+using types::Mode;
+using Hints = std::vector<Mode>;
+
+constexpr uint32_t NO_LAMBDA = std::numeric_limits<uint32_t>::max();
+
+struct Binding {
+  uint32_t lambda_id; // NO_LAMBDA for bindings other than let-bound lambdas
+  uint32_t depth;     // lambdas enclosing binding
+};
+
+struct Site {
+  const nodes::Call *call;
+  Hints hints;
+};
+
+struct LambdaInfo {
+  const nodes::Expr *let_expr;
+  uint32_t depth;
+  uint32_t where_end = 0; // lambdas bound in body and where precede it
+  uint32_t min_free_depth = NO_LAMBDA; // min depth of bindings used in lambda
+  uint32_t min_linear_depth = NO_LAMBDA; // the same for unique or once uses
+  bool open = false;                   // lambda body is visited
+  bool escapes = false;                // name is used not as callee
+  bool recursive = false;
+  std::vector<Site> sites = {};
+
+  const nodes::Let &let() const { return std::get<2>(let_expr->value); }
+  const nodes::Lambda &lambda() const {
+    return std::get<3>(let().body->value);
+  }
+  bool closed() const { return min_free_depth > depth; }
+  // copy would use captured unique or once binding again
+  bool copyable() const { return min_linear_depth > depth; }
+};
+
+// --- structural hash and equality
+
+size_t mode_code(Mode mode) {
+  return static_cast<size_t>(mode.loc) * 9 +
+         static_cast<size_t>(mode.uniq) * 3 + static_cast<size_t>(mode.lin);
+}
+
+void combine(size_t &seed, size_t value) {
+  seed ^= value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2);
+}
+
+void push_children(const nodes::Expr &expr,
+                   std::vector<const nodes::Expr *> &stack) {
+  switch (expr.value.index()) {
+  case 0: // Const
+  case 1: // Var
+    break;
+  case 2: { // Let
+    const auto &let = std::get<2>(expr.value);
+    stack.push_back(let.where.get());
+    stack.push_back(let.body.get());
+    break;
+  }
+  case 3: // Lambda
+    stack.push_back(std::get<3>(expr.value).expr.get());
+    break;
+  case 4: { // Call
+    const auto &call = std::get<4>(expr.value);
+    for (auto it = call.args.rbegin(); it != call.args.rend(); ++it) {
+      stack.push_back(it->get());
+    }
+    stack.push_back(call.func.get());
+    break;
+  }
+  case 5: { // Condition
+    const auto &condition = std::get<5>(expr.value);
+    stack.push_back(condition.else_case.get());
+    stack.push_back(condition.then_case.get());
+    stack.push_back(condition.condition.get());
+    break;
+  }
+  default:
+    utils::unreachable();
+  }
+}
+
+void combine_arg(size_t &seed, const nodes::Arg &arg) {
+  combine(seed, std::hash<std::string>{}(arg.name));
+  combine(seed, mode_code(arg.mode_hint));
+}
+
+// node kinds, names, constants and hints in pre-order, call arity fixes shape
+size_t structural_hash(const nodes::Expr &root) {
+  size_t seed = 0;
+  std::vector<const nodes::Expr *> stack{&root};
+  while (not stack.empty()) {
+    const nodes::Expr &expr = *stack.back();
+    stack.pop_back();
+
+    combine(seed, expr.value.index());
+    switch (expr.value.index()) {
+    case 0: // Const
+      combine(seed, std::hash<int>{}(std::get<0>(expr.value).value));
+      break;
+    case 1: // Var
+      combine(seed, std::hash<std::string>{}(std::get<1>(expr.value).name));
+      break;
+    case 2: // Let
+      combine_arg(seed, std::get<2>(expr.value).name);
+      break;
+    case 3: // Lambda
+      for (const auto &arg : std::get<3>(expr.value).args) {
+        combine_arg(seed, arg);
+      }
+      break;
+    case 4: // Call
+      combine(seed, std::get<4>(expr.value).args.size());
+      break;
+    case 5: // Condition
+      break;
+    default:
+      utils::unreachable();
+    }
+    push_children(expr, stack);
+  }
+  return seed;
+}
+
+bool same_arg(const nodes::Arg &left, const nodes::Arg &right) {
+  return left.name == right.name and left.mode_hint == right.mode_hint;
+}
+
+bool same_node(const nodes::Expr &left, const nodes::Expr &right) {
+  if (left.value.index() != right.value.index()) {
+    return false;
+  }
+
+  switch (left.value.index()) {
+  case 0: // Const
+    return std::get<0>(left.value).value == std::get<0>(right.value).value;
+  case 1: // Var
+    return std::get<1>(left.value).name == std::get<1>(right.value).name;
+  case 2: // Let
+    return same_arg(std::get<2>(left.value).name,
+                    std::get<2>(right.value).name);
+  case 3: { // Lambda
+    const auto &left_args = std::get<3>(left.value).args;
+    const auto &right_args = std::get<3>(right.value).args;
+    return std::equal(left_args.begin(), left_args.end(), right_args.begin(),
+                      right_args.end(), same_arg);
+  }
+  case 4: // Call
+    return std::get<4>(left.value).args.size() ==
+           std::get<4>(right.value).args.size();
+  case 5: // Condition
+    return true;
+  default:
+    utils::unreachable();
+  }
+}
+
+bool structural_equal(const nodes::Expr &left, const nodes::Expr &right) {
+  std::vector<const nodes::Expr *> left_stack{&left};
+  std::vector<const nodes::Expr *> right_stack{&right};
+  while (not left_stack.empty()) {
+    const nodes::Expr &left_expr = *left_stack.back();
+    const nodes::Expr &right_expr = *right_stack.back();
+    left_stack.pop_back();
+    right_stack.pop_back();
+
+    if (not same_node(left_expr, right_expr)) {
+      return false;
+    }
+    // same node implies same number of children
+    push_children(left_expr, left_stack);
+    push_children(right_expr, right_stack);
+  }
+  return true;
+}
+
+// --- call site collection
+
+class Collector {
+public:
+  Collector(const types::Storage &storage, const nodes::TypeTable &node_types,
+            std::vector<LambdaInfo> &lambdas,
+            std::unordered_set<std::string> &marked_names)
+      : storage_(storage), node_types_(node_types), lambdas_(lambdas),
+        marked_names_(marked_names) {}
+
+  void run(const nodes::Expr &root) {
+    frames_.emplace_back(root);
+    while (not frames_.empty()) {
+      step();
+    }
+  }
+
+private:
+  struct Frame {
+    Frame(const nodes::Expr &expr, const nodes::Call *callee_of = nullptr)
+        : expr(&expr), callee_of(callee_of) {}
+
+    const nodes::Expr *expr;
+    const nodes::Call *callee_of; // call with this expr as callee
+    size_t stage = 0;
+    uint32_t lambda_id = NO_LAMBDA;
+  };
+
+  void push(const nodes::Expr &expr, const nodes::Call *callee_of = nullptr) {
+    frames_.emplace_back(expr, callee_of);
+  }
+
+  void step() {
+    Frame &frame = frames_.back();
+    const auto &value = frame.expr->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      frames_.pop_back();
+      break;
+    case 1: { // Var
+      const nodes::Call *callee_of = frame.callee_of;
+      frames_.pop_back();
+      use(std::get<1>(value), callee_of);
+      break;
+    }
+    case 2: // Let
+      step_let(frame, std::get<2>(value));
+      break;
+    case 3: // Lambda
+      step_lambda(frame, std::get<3>(value));
+      break;
+    case 4: { // Call
+      const auto &call = std::get<4>(value);
+      const size_t stage = frame.stage++;
+      if (stage == 0) {
+        push(*call.func, &call);
+      } else if (stage <= call.args.size()) {
+        push(*call.args[stage - 1]);
+      } else {
+        frames_.pop_back();
+      }
+      break;
+    }
+    case 5: { // Condition
+      const auto &condition = std::get<5>(value);
+      switch (frame.stage++) {
+      case 0:
+        push(*condition.condition);
+        break;
+      case 1:
+        push(*condition.then_case);
+        break;
+      case 2:
+        push(*condition.else_case);
+        break;
+      default:
+        frames_.pop_back();
+      }
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_let(Frame &frame, const nodes::Let &expr) {
+    switch (frame.stage++) {
+    case 0: {
+      mark(expr.name.name);
+      if (expr.body->value.index() == 3) { // Lambda
+        frame.lambda_id = static_cast<uint32_t>(lambdas_.size());
+        lambdas_.push_back(LambdaInfo{.let_expr = frame.expr, .depth = depth_});
+        lambdas_.back().open = true;
+        open_.push_back(frame.lambda_id);
+      }
+
+      scopes_.enter_context();
+      // name is visible in body
+      scopes_.add(expr.name.name, Binding{frame.lambda_id, depth_});
+      push(*expr.body);
+      break;
+    }
+    case 1:
+      if (frame.lambda_id != NO_LAMBDA) {
+        close(frame.lambda_id);
+      }
+      push(*expr.where);
+      break;
+    case 2:
+      if (frame.lambda_id != NO_LAMBDA) {
+        lambdas_[frame.lambda_id].where_end =
+            static_cast<uint32_t>(lambdas_.size());
+      }
+      scopes_.exit_context();
+      frames_.pop_back();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_lambda(Frame &frame, const nodes::Lambda &expr) {
+    switch (frame.stage++) {
+    case 0:
+      ++depth_;
+      scopes_.enter_context();
+      for (const auto &arg : expr.args) {
+        mark(arg.name);
+        scopes_.add(arg.name, Binding{NO_LAMBDA, depth_});
+      }
+      push(*expr.expr);
+      break;
+    case 1:
+      scopes_.exit_context();
+      --depth_;
+      frames_.pop_back();
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void close(uint32_t lambda_id) {
+    LambdaInfo &info = lambdas_[lambda_id];
+    info.open = false;
+    open_.pop_back();
+    if (not open_.empty()) {
+      auto &parent = lambdas_[open_.back()];
+      parent.min_free_depth =
+          std::min(parent.min_free_depth, info.min_free_depth);
+      parent.min_linear_depth =
+          std::min(parent.min_linear_depth, info.min_linear_depth);
+    }
+  }
+
+  void use(const nodes::Var &var, const nodes::Call *callee_of) {
+    const Binding *binding = scopes_.find(var.name);
+    if (binding == nullptr) {
+      mark(var.name);
+      return; // prelude name
+    }
+
+    if (not open_.empty()) {
+      auto &innermost = lambdas_[open_.back()];
+      innermost.min_free_depth =
+          std::min(innermost.min_free_depth, binding->depth);
+      if (is_linear(var)) {
+        innermost.min_linear_depth =
+            std::min(innermost.min_linear_depth, binding->depth);
+      }
+    }
+
+    if (binding->lambda_id == NO_LAMBDA) {
+      return;
+    }
+
+    LambdaInfo &info = lambdas_[binding->lambda_id];
+    if (info.open) {
+      info.recursive = true;
+      return;
+    }
+
+    auto hints = callee_of ? site_hints(info, *callee_of) : std::nullopt;
+    if (hints.has_value()) {
+      info.sites.push_back(Site{callee_of, std::move(hints).value()});
+    } else {
+      info.escapes = true;
+    }
+  }
+
+  bool is_linear(const nodes::Var &var) const {
+    const types::TypeID type = node_types_.get(var.id);
+    if (not type.is_valid()) {
+      return true;
+    }
+    const Mode mode = storage_.mode(type);
+    return mode.uniq != Mode::Uniq::SHARED or mode.lin != Mode::Lin::MANY;
+  }
+
+  // param hints raised to modes of args
+  std::optional<Hints> site_hints(const LambdaInfo &info,
+                                  const nodes::Call &call) const {
+    const auto &params = info.lambda().args;
+    if (call.args.size() != params.size()) {
+      return std::nullopt;
+    }
+
+    Hints hints;
+    hints.reserve(params.size());
+    for (size_t i = 0; i < params.size(); ++i) {
+      const types::TypeID arg_type =
+          node_types_.get(nodes::id_of(*call.args[i]));
+      if (not arg_type.is_valid()) {
+        return std::nullopt;
+      }
+      hints.push_back(
+          Mode::choose_max(params[i].mode_hint, storage_.mode(arg_type)));
+    }
+    return hints;
+  }
+
+  // names with '#' can clash with names of copies
+  void mark(const std::string &name) {
+    if (name.find('#') != std::string::npos) {
+      marked_names_.insert(name);
+    }
+  }
+
+private:
+  const types::Storage &storage_;
+  const nodes::TypeTable &node_types_;
+  std::vector<LambdaInfo> &lambdas_;
+  std::unordered_set<std::string> &marked_names_;
+
+  std::vector<Frame> frames_;
+  utils::ScopedMap<Binding> scopes_;
+  std::vector<uint32_t> open_; // let-bound lambdas with body on stack
+  uint32_t depth_ = 0;
+};
+
+// --- rewriting
+
+class Specializer {
+public:
+  Specializer(const types::Storage &storage,
+              const nodes::TypeTable &node_types)
+      : storage_(storage), node_types_(node_types) {}
+
+  Stats run(nodes::ExprPtr &root) {
+    Collector(storage_, node_types_, lambdas_, marked_names_).run(*root);
+
+    // outer lambdas first, so renamed sites are copied with lambda bodies
+    for (uint32_t id = 0; id < lambdas_.size(); ++id) {
+      const LambdaInfo &info = lambdas_[id];
+      if (not info.sites.empty() and not info.recursive) {
+        ++stats_.lambdas;
+        specialize(id);
+      }
+    }
+
+    if (stats_.changed()) {
+      root = rewrite(root, false);
+    }
+    return stats_;
+  }
+
+private:
+  struct Copy {
+    std::string name;
+    nodes::ExprPtr lambda;
+    uint32_t lambda_id; // copy is bound before let of this lambda
+  };
+
+  using Added = std::vector<std::pair<std::string, nodes::ExprPtr>>;
+
+  void specialize(uint32_t lambda_id) {
+    LambdaInfo &info = lambdas_[lambda_id];
+
+    std::map<Hints, std::vector<const nodes::Call *>> instantiations;
+    Hints first = info.sites.front().hints;
+    for (auto &site : info.sites) {
+      instantiations[std::move(site.hints)].push_back(site.call);
+    }
+
+    // in place only if all sites agree, including sites in lambdas that are
+    // not called, otherwise sites with other hints would be checked against
+    // body of other instantiation
+    const bool in_place = not info.escapes and instantiations.size() == 1;
+    if (not in_place and not info.copyable()) {
+      return;
+    }
+
+    const auto &params = info.lambda().args;
+    Hints base;
+    for (const auto &param : params) {
+      base.push_back(param.mode_hint);
+    }
+    if (in_place and base != first) {
+      base = first;
+      hints_.emplace(&info.lambda(), base);
+      ++stats_.in_place;
+    }
+
+    Added added;
+    for (const auto &[hints, calls] : instantiations) {
+      if (hints == base) {
+        continue;
+      }
+
+      const std::string name = copy_name(lambda_id, hints, added);
+      for (const auto *call : calls) {
+        renames_.emplace(call, name);
+      }
+      stats_.sites += calls.size();
+    }
+
+    if (not added.empty()) {
+      added_.emplace(&info.let(), std::move(added));
+    }
+  }
+
+  // name of existing equal copy or new copy, added to bindings
+  std::string copy_name(uint32_t lambda_id, const Hints &hints, Added &added) {
+    const LambdaInfo &info = lambdas_[lambda_id];
+
+    // only renames of lambdas specialized before are applied to copy
+    nodes::ExprPtr lambda = rewrite(info.let().body, true, &hints);
+
+    size_t hash = 0;
+    if (info.closed()) {
+      hash = structural_hash(*lambda);
+      auto [begin, end] = copies_.equal_range(hash);
+      for (auto it = begin; it != end; ++it) {
+        const Copy &copy = it->second;
+        if (visible_at(copy, lambda_id) and
+            structural_equal(*copy.lambda, *lambda)) {
+          ++stats_.reused;
+          return copy.name;
+        }
+      }
+    }
+
+    std::string name = fresh_name(info.let().name.name);
+    if (info.closed()) {
+      copies_.emplace(hash, Copy{name, lambda, lambda_id});
+    }
+    added.emplace_back(name, std::move(lambda));
+    ++stats_.variants;
+    return name;
+  }
+
+  // copies are bound right before original let, so they are visible in its
+  // body and where
+  bool visible_at(const Copy &copy, uint32_t lambda_id) const {
+    return copy.lambda_id <= lambda_id and
+           lambda_id < lambdas_[copy.lambda_id].where_end;
+  }
+
+  std::string fresh_name(const std::string &name) {
+    std::string result;
+    do {
+      result = name + "#" + std::to_string(next_copy_id_++);
+    } while (marked_names_.contains(result));
+    return result;
+  }
+
+  // tree with renames, hints and bindings of copies applied, changed nodes
+  // are copied with fresh ids, other subtrees are shared unless copy_all is
+  // set, root_hints replace param hints of root lambda
+  nodes::ExprPtr rewrite(const nodes::ExprPtr &root, bool copy_all,
+                         const Hints *root_hints = nullptr) const {
+    struct Frame {
+      const nodes::ExprPtr *expr;
+      std::vector<const nodes::ExprPtr *> children = {};
+      nodes::ExprPtrV results = {};
+    };
+
+    auto make_frame = [](const nodes::ExprPtr &expr) {
+      Frame frame{&expr};
+      nodes::for_each_child(*expr, [&frame](const nodes::ExprPtr &child) {
+        frame.children.push_back(&child);
+      });
+      return frame;
+    };
+
+    std::vector<Frame> frames{make_frame(root)};
+    nodes::ExprPtr result;
+    while (not frames.empty()) {
+      Frame &frame = frames.back();
+      if (result != nullptr) {
+        frame.results.push_back(std::move(result));
+      }
+
+      if (frame.results.size() < frame.children.size()) {
+        const nodes::ExprPtr &child = *frame.children[frame.results.size()];
+        frames.push_back(make_frame(child));
+        continue;
+      }
+
+      result = rebuild(frame.expr, frame.children, std::move(frame.results),
+                       copy_all, frames.size() == 1 ? root_hints : nullptr);
+      frames.pop_back();
+    }
+    return result;
+  }
+
+  nodes::ExprPtr rebuild(const nodes::ExprPtr *expr,
+                         const std::vector<const nodes::ExprPtr *> &children,
+                         nodes::ExprPtrV results, bool copy_all,
+                         const Hints *hints) const {
+    const auto &value = (*expr)->value;
+
+    const std::string *rename = nullptr;
+    const Added *added = nullptr;
+    switch (value.index()) {
+    case 2: // Let
+      if (auto it = added_.find(&std::get<2>(value)); it != added_.end()) {
+        added = &it->second;
+      }
+      break;
+    case 3: // Lambda
+      if (auto it = hints_.find(&std::get<3>(value));
+          hints == nullptr and it != hints_.end()) {
+        hints = &it->second;
+      }
+      break;
+    case 4: // Call
+      if (auto it = renames_.find(&std::get<4>(value)); it != renames_.end()) {
+        rename = &it->second;
+      }
+      break;
+    default:
+      break;
+    }
+
+    bool changed = copy_all or rename != nullptr or hints != nullptr or
+                   added != nullptr;
+    for (size_t i = 0; i < children.size(); ++i) {
+      changed |= results[i] != *children[i];
+    }
+    if (not changed) {
+      return *expr;
+    }
+
+    nodes::Expr copy = nodes::copy_node(**expr);
+    size_t next = 0;
+    nodes::for_each_child(copy, [&results, &next](nodes::ExprPtr &child) {
+      child = std::move(results[next++]);
+    });
+    if (rename != nullptr) {
+      std::get<4>(copy.value).func = nodes::make_expr<nodes::Var>(*rename);
+    }
+    if (hints != nullptr) {
+      auto &params = std::get<3>(copy.value).args;
+      for (size_t i = 0; i < params.size(); ++i) {
+        params[i].mode_hint = (*hints)[i];
+      }
+    }
+
+    nodes::ExprPtr result = nodes::make_expr(std::move(copy));
+    if (added != nullptr) {
+      result = bind(std::get<2>(value).name.mode_hint, *added, result);
+    }
+    return result;
+  }
+
+  // let f = .. in where -> let f#0 = .. in .. let f = .. in where
+  static nodes::ExprPtr bind(types::Mode name_hint, const Added &added,
+                             nodes::ExprPtr let) {
+    for (size_t i = added.size(); i-- > 0;) {
+      let = nodes::make_expr<nodes::Let>(nodes::Arg(added[i].first, name_hint),
+                                         added[i].second, let);
+    }
+    return let;
+  }
+
+private:
+  const types::Storage &storage_;
+  const nodes::TypeTable &node_types_;
+  std::vector<LambdaInfo> lambdas_;
+  std::unordered_set<std::string> marked_names_;
+  std::unordered_multimap<size_t, Copy> copies_;
+  size_t next_copy_id_ = 0;
+  Stats stats_;
+
+  // decisions, applied by rewrite
+  std::unordered_map<const nodes::Call *, std::string> renames_;
+  std::unordered_map<const nodes::Lambda *, Hints> hints_; // in place
+  std::unordered_map<const nodes::Let *, Added> added_;
+};
+
+} // namespace
+
+Stats specialize(nodes::ExprPtr &expr, const types::Storage &storage,
+                 const nodes::TypeTable &node_types) {
+  return Specializer(storage, node_types).run(expr);
+}
+
+} // namespace mono
@@ -1 +1,75 @@
 #include "parsing_tree.hpp"
+
+#include <atomic>
+
+namespace nodes {
+
+namespace {
+
+void detach_children(Expr &expr, ExprPtrV &detached) {
+  for_each_child(expr, [&detached](ExprPtr &child) {
+    if (child != nullptr) {
+      detached.push_back(std::move(child));
+    }
+  });
+}
+
+} // namespace
+
+NodeId next_node_id() {
+  static std::atomic<NodeId> last = 0;
+  return last.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+Expr::~Expr() {
+  ExprPtrV detached;
+  detach_children(*this, detached);
+
+  while (not detached.empty()) {
+    ExprPtr child = std::move(detached.back());
+    detached.pop_back();
+
+    // shared children are left to their other owners, nodes are created
+    // non-const by make_expr
+    if (child.use_count() == 1) {
+      detach_children(const_cast<Expr &>(*child), detached);
+    }
+  }
+}
+
+Expr copy_node(const Expr &expr) {
+  Expr result = expr;
+  std::visit([](auto &node) { node.id = next_node_id(); }, result.value);
+  if (auto *let = std::get_if<Let>(&result.value)) {
+    let->name.id = next_node_id();
+  } else if (auto *lambda = std::get_if<Lambda>(&result.value)) {
+    for (auto &arg : lambda->args) {
+      arg.id = next_node_id();
+    }
+  }
+  return result;
+}
+
+ExprPtr clone(const Expr &expr) {
+  // copies point to original children until their slots are visited
+  std::vector<ExprPtr *> slots;
+  auto copy = [&slots](const Expr &original) {
+    auto result = std::make_shared<Expr>(copy_node(original));
+    for_each_child(*result, [&slots](ExprPtr &child) {
+      if (child != nullptr) {
+        slots.push_back(&child);
+      }
+    });
+    return result;
+  };
+
+  ExprPtr root = copy(expr);
+  while (not slots.empty()) {
+    ExprPtr *slot = slots.back();
+    slots.pop_back();
+    *slot = copy(**slot);
+  }
+  return root;
+}
+
+} // namespace nodes
@@ -0,0 +1,243 @@
+#include "prelude.hpp"
+
+#include <fstream>
+#include <sstream>
+
+namespace prelude {
+
+namespace {
+
+constexpr std::string_view core_declarations = R"(
+- : int -> int -> int
+* : int -> int -> int
+< : int -> int -> bool
+== : int -> int -> bool
+)";
+
+bool is_name_char(char c) {
+  return isalnum(static_cast<unsigned char>(c)) or c == '_';
+}
+
+struct TypeParser {
+  std::string_view text;
+  types::Storage &storage;
+  std::map<std::string, types::TypeID> &generics;
+  size_t pos = 0;
+
+  [[noreturn]] void fail(const std::string &message) {
+    utils::throw_error(message + " at " + std::to_string(pos) + " in `" +
+                       std::string(text) + "`");
+    utils::unreachable();
+  }
+
+  void skip_spaces() {
+    while (pos < text.size() and isspace(static_cast<unsigned char>(text[pos]))) {
+      ++pos;
+    }
+  }
+
+  bool try_consume(std::string_view token) {
+    skip_spaces();
+    if (text.substr(pos, token.size()) == token) {
+      pos += token.size();
+      return true;
+    }
+    return false;
+  }
+
+  std::string parse_name() {
+    skip_spaces();
+    size_t begin = pos;
+    while (pos < text.size() and is_name_char(text[pos])) {
+      ++pos;
+    }
+    if (begin == pos) {
+      fail("EXPECTED_NAME");
+    }
+    return std::string(text.substr(begin, pos - begin));
+  }
+
+  types::Mode parse_mode() {
+    types::Mode mode;
+    if (not try_consume("<")) {
+      return mode;
+    }
+    do {
+      std::string name = parse_name();
+      if (not mode.set_by_name(name)) {
+        fail("UNKNOWN_MODE " + name);
+      }
+    } while (try_consume(","));
+    if (not try_consume(">")) {
+      fail("EXPECTED_>");
+    }
+    return mode;
+  }
+
+  types::TypeID parse_atom() {
+    if (try_consume("(")) {
+      types::TypeID type = parse_type();
+      if (not try_consume(")")) {
+        fail("EXPECTED_)");
+      }
+      // mode after parens is a mode of the whole inner type, generic keeps
+      // its slot, so all its uses get the mode
+      if (skip_spaces(), pos < text.size() and text[pos] == '<') {
+        const types::Mode mode = parse_mode();
+        if (storage.is_generic(type)) {
+          storage.set_mode(type, mode);
+        } else {
+          type = storage.add(storage.get(type).with_mode(mode));
+        }
+      }
+      return type;
+    }
+
+    if (try_consume("'")) {
+      std::string name = parse_name();
+      types::Mode mode = parse_mode();
+      auto it = generics.find(name);
+      if (it == generics.end()) {
+        it = generics.insert({name, storage.introduce_new_generic(name, mode)})
+                 .first;
+      }
+      return it->second;
+    }
+
+    std::string name = parse_name();
+    types::Mode mode = parse_mode();
+    if (name == "int") {
+      return storage.get_int_type(mode);
+    }
+    if (name == "bool") {
+      return storage.get_bool_type(mode);
+    }
+    fail("UNKNOWN_TYPE " + name);
+  }
+
+  // a -> b -> c is one arrow type with three parts
+  types::TypeID parse_type() {
+    types::TypeIDV parts{parse_atom()};
+    while (try_consume("->")) {
+      parts.push_back(parse_atom());
+    }
+    if (parts.size() == 1) {
+      return parts.front();
+    }
+    return storage.add(types::make_type<types::ArrowType>(std::move(parts)));
+  }
+};
+
+} // namespace
+
+Builder::Builder()
+    : storage_(std::make_shared<types::Storage>()),
+      types_(std::make_shared<type_check::VarManager>()),
+      modes_(std::make_shared<mode_check::State>()) {}
+
+types::TypeID
+Builder::parse_type(std::string_view text,
+                    std::map<std::string, types::TypeID> &generics) {
+  TypeParser parser{text, *storage_, generics};
+  types::TypeID type = parser.parse_type();
+  parser.skip_spaces();
+  if (parser.pos != text.size()) {
+    parser.fail("TRAILING_DATA");
+  }
+  return type;
+}
+
+void Builder::add(const std::string &name, types::TypeID type) {
+  types_->add_var(name, type);
+  modes_->add_var(name, storage_->mode(type));
+}
+
+void Builder::load(std::string_view declarations) {
+  size_t line_number = 0;
+  while (not declarations.empty()) {
+    ++line_number;
+    size_t line_end = declarations.find('\n');
+    std::string_view line = declarations.substr(0, line_end);
+    declarations.remove_prefix(
+        line_end == std::string_view::npos ? declarations.size() : line_end + 1);
+
+    if (size_t comment = line.find('#'); comment != std::string_view::npos) {
+      line = line.substr(0, comment);
+    }
+    if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+      continue;
+    }
+
+    // name is everything before first " : ", so operators are allowed
+    size_t separator = line.find(" : ");
+    if (separator == std::string_view::npos) {
+      utils::throw_error("NO_DECL_SEPARATOR at line " +
+                         std::to_string(line_number));
+    }
+    std::string_view name = line.substr(0, separator);
+    name.remove_prefix(std::min(name.find_first_not_of(" \t"), name.size()));
+    name = name.substr(0, name.find_last_not_of(" \t") + 1);
+
+    try {
+      std::map<std::string, types::TypeID> generics;
+      add(std::string(name), parse_type(line.substr(separator + 3), generics));
+    } catch (utils::Error error) {
+      error.message += " at line " + std::to_string(line_number);
+      throw error;
+    }
+  }
+}
+
+void Builder::load_file(const std::string &path) {
+  std::ifstream file(path);
+  if (not file) {
+    utils::throw_error("CANT_OPEN " + path);
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+  load(content.str());
+}
+
+std::shared_ptr<const Prelude> Builder::freeze() {
+  return std::make_shared<const Prelude>(
+      Prelude{std::move(storage_), std::move(types_), std::move(modes_)});
+}
+
+// ---------------
+
+namespace {
+
+void load_core(Builder &builder, bool sum_uniq) {
+  std::map<std::string, types::TypeID> generics;
+  builder.add("+", builder.parse_type(sum_uniq
+                                          ? "int<unique> -> int<unique> -> int"
+                                          : "int -> int -> int",
+                                      generics));
+  builder.load(core_declarations);
+}
+
+} // namespace
+
+std::shared_ptr<const Prelude> core(bool sum_uniq) {
+  static const auto shared_sum = [] {
+    Builder builder;
+    load_core(builder, false);
+    return builder.freeze();
+  }();
+  static const auto unique_sum = [] {
+    Builder builder;
+    load_core(builder, true);
+    return builder.freeze();
+  }();
+  return sum_uniq ? unique_sum : shared_sum;
+}
+
+std::shared_ptr<const Prelude> load_file(const std::string &path,
+                                         bool sum_uniq) {
+  Builder builder;
+  load_core(builder, sum_uniq);
+  builder.load_file(path);
+  return builder.freeze();
+}
+
+} // namespace prelude
@@ -0,0 +1,359 @@
+#include "pretty_printer.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <unordered_set>
+#include <unistd.h>
+
+namespace pretty {
+
+Buffer::~Buffer() {
+  try {
+    flush();
+  } catch (utils::Error) {
+    // destructor can't throw, see flush
+  }
+}
+
+void Buffer::append(long long value) {
+  char digits[24];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  append(std::string_view(digits, result.ptr - digits));
+}
+
+void Buffer::flush() {
+  if (fd_ < 0) {
+    return;
+  }
+
+  size_t offset = 0;
+  while (offset < data_.size()) {
+    ssize_t count = ::write(fd_, data_.data() + offset, data_.size() - offset);
+    if (count < 0 and errno == EINTR) {
+      continue;
+    }
+    if (count < 0) {
+      data_.clear();
+      utils::throw_error("WRITE_FAILED");
+    }
+    offset += static_cast<size_t>(count);
+  }
+  data_.clear();
+}
+
+// ---------------
+
+namespace {
+
+struct Item {
+  enum class Kind { Text, Mode, Arg, Type, TypeEnd, Expr } kind;
+
+  std::string_view text = {};
+  types::Mode mode = {};
+  const nodes::Arg *arg = nullptr;
+  size_t type_id = 0;
+  const nodes::Expr *expr = nullptr;
+  size_t depth = 0;
+  bool parens = false;
+
+  static Item make_text(std::string_view text) {
+    return {.kind = Kind::Text, .text = text};
+  }
+
+  static Item make_mode(types::Mode mode) {
+    return {.kind = Kind::Mode, .mode = mode};
+  }
+
+  static Item make_arg(const nodes::Arg &arg, size_t depth) {
+    return {.kind = Kind::Arg, .arg = &arg, .depth = depth};
+  }
+
+  static Item make_type(size_t id, size_t depth, bool parens = false) {
+    return {.kind = Kind::Type, .type_id = id, .depth = depth, .parens = parens};
+  }
+
+  static Item make_type_end(size_t id) {
+    return {.kind = Item::Kind::TypeEnd, .type_id = id};
+  }
+
+  static Item make_expr(const nodes::Expr &expr, size_t depth,
+                        bool parens = false) {
+    return {.kind = Kind::Expr, .expr = &expr, .depth = depth, .parens = parens};
+  }
+};
+
+bool is_atom(const nodes::Expr &expr) {
+  return holds_alternative<nodes::Const>(expr.value) or
+         holds_alternative<nodes::Var>(expr.value);
+}
+
+class Printer {
+public:
+  Printer(Buffer &out, const Options &options)
+      : out_(out), options_(options), start_(out.written()) {}
+
+  void run(Item root) {
+    stack_.push_back(root);
+    while (not stack_.empty()) {
+      if (options_.max_width != 0 and
+          out_.written() - start_ >= options_.max_width) {
+        out_.append("...");
+        stack_.clear();
+        return;
+      }
+
+      Item item = stack_.back();
+      stack_.pop_back();
+
+      if (options_.max_depth != 0 and item.depth > options_.max_depth) {
+        out_.append("...");
+        continue;
+      }
+
+      switch (item.kind) {
+      case Item::Kind::Text:
+        out_.append(item.text);
+        break;
+      case Item::Kind::Mode:
+        print_mode(out_, item.mode);
+        break;
+      case Item::Kind::Arg:
+        expand_arg(*item.arg, item.depth);
+        break;
+      case Item::Kind::Type:
+        expand_type(item);
+        break;
+      case Item::Kind::TypeEnd:
+        open_types_.erase(item.type_id);
+        break;
+      case Item::Kind::Expr:
+        expand_expr(item);
+        break;
+      }
+    }
+  }
+
+private:
+  // items are pushed in reverse order
+  void push(std::initializer_list<Item> items) {
+    stack_.insert(stack_.end(), std::rbegin(items), std::rend(items));
+  }
+
+  void expand_arg(const nodes::Arg &arg, size_t depth) {
+    const types::TypeID type = options_.types != nullptr and
+                                       options_.node_types != nullptr
+                                   ? options_.node_types->get(arg.id)
+                                   : types::TypeID();
+    if (not type.is_valid()) {
+      out_.append(arg.name);
+      print_mode(out_, arg.mode_hint);
+      return;
+    }
+
+    out_.append('(');
+    out_.append(arg.name);
+    out_.append(" : ");
+    push({Item::make_type(type.get_id(), depth + 1),
+          Item::make_text(")")});
+  }
+
+  void expand_type(const Item &item) {
+    const types::Storage &storage = *options_.types;
+    types::TypeID id(item.type_id);
+    types::Mode mode = storage.mode(id);
+
+    switch (storage.kind(id)) {
+    case types::TypeKind::Arrow: {
+      // types are not checked for cycles, recursive part is elided
+      if (not open_types_.insert(item.type_id).second) {
+        out_.append("...");
+        break;
+      }
+      stack_.push_back(Item::make_type_end(item.type_id));
+
+      const auto parts = storage.parts(id);
+      bool parens = item.parens or mode != types::Mode();
+
+      if (parens) {
+        push({Item::make_text(")"), Item::make_mode(mode)});
+      }
+      for (size_t i = parts.size(); i > 0; --i) {
+        // arrow parts are right after arrow, so only nested arrows need parens
+        stack_.push_back(
+            Item::make_type(parts[i - 1].get_id(), item.depth + 1, true));
+        if (i > 1) {
+          stack_.push_back(Item::make_text(" -> "));
+        }
+      }
+      if (parens) {
+        out_.append('(');
+      }
+      break;
+    }
+    case types::TypeKind::Bool:
+      out_.append("bool");
+      print_mode(out_, mode);
+      break;
+    case types::TypeKind::Int:
+      out_.append("int");
+      print_mode(out_, mode);
+      break;
+    case types::TypeKind::Generic:
+      out_.append('\'');
+      out_.append(storage.generic_name(id));
+      print_mode(out_, mode);
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void expand_expr(const Item &item) {
+    const auto &value = item.expr->value;
+    size_t depth = item.depth + 1;
+
+    if (item.parens) {
+      out_.append('(');
+      stack_.push_back(Item::make_text(")"));
+    }
+
+    switch (value.index()) {
+    case 0: // Const
+      out_.append(static_cast<long long>(std::get<0>(value).value));
+      break;
+    case 1: // Var
+      out_.append(std::get<1>(value).name);
+      break;
+    case 2: { // Let
+      const auto &let = std::get<2>(value);
+      out_.append("let ");
+      push({Item::make_arg(let.name, depth), Item::make_text(" = "),
+            Item::make_expr(*let.body, depth), Item::make_text(" in "),
+            Item::make_expr(*let.where, depth)});
+      break;
+    }
+    case 3: { // Lambda
+      const auto &lambda = std::get<3>(value);
+      out_.append('\\');
+      push({Item::make_text("-> "), Item::make_expr(*lambda.expr, depth)});
+      for (size_t i = lambda.args.size(); i > 0; --i) {
+        push({Item::make_arg(lambda.args[i - 1], depth),
+              Item::make_text(" ")});
+      }
+      break;
+    }
+    case 4: { // Call
+      const auto &call = std::get<4>(value);
+      for (size_t i = call.args.size(); i > 0; --i) {
+        const auto &arg = *call.args[i - 1];
+        push({Item::make_text(" "), Item::make_expr(arg, depth, not is_atom(arg))});
+      }
+      stack_.push_back(
+          Item::make_expr(*call.func, depth, not is_atom(*call.func)));
+      break;
+    }
+    case 5: { // Condition
+      const auto &condition = std::get<5>(value);
+      out_.append("if ");
+      push({Item::make_expr(*condition.condition, depth),
+            Item::make_text(" then "),
+            Item::make_expr(*condition.then_case, depth),
+            Item::make_text(" else "),
+            Item::make_expr(*condition.else_case, depth)});
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+
+private:
+  Buffer &out_;
+  const Options &options_;
+  size_t start_;
+  std::vector<Item> stack_;
+  std::unordered_set<size_t> open_types_; // arrow types being printed
+};
+
+} // namespace
+
+void print_mode(Buffer &out, types::Mode mode) {
+  if (mode == types::Mode()) {
+    return;
+  }
+
+  bool first = true;
+  auto add = [&out, &first](std::string_view name) {
+    out.append(first ? '<' : ',');
+    if (not first) {
+      out.append(' ');
+    }
+    out.append(name);
+    first = false;
+  };
+
+  if (mode.loc == types::Mode::Loc::LOCAL) {
+    add("local");
+  }
+
+  switch (mode.uniq) {
+  case types::Mode::Uniq::UNIQUE:
+    add("unique");
+    break;
+  case types::Mode::Uniq::EXCL:
+    add("exclusive");
+    break;
+  case types::Mode::Uniq::SHARED:
+    break;
+  }
+
+  switch (mode.lin) {
+  case types::Mode::Lin::ONCE:
+    add("once");
+    break;
+  case types::Mode::Lin::SEP:
+    add("separated");
+    break;
+  case types::Mode::Lin::MANY:
+    break;
+  }
+
+  out.append('>');
+}
+
+void print_arg(Buffer &out, const nodes::Arg &arg) {
+  Options options;
+  Printer(out, options).run(Item::make_arg(arg, 0));
+}
+
+void print_type(Buffer &out, const types::Storage &storage, types::TypeID type,
+                const Options &options) {
+  Options type_options = options;
+  type_options.types = &storage;
+  Printer(out, type_options).run(Item::make_type(type.get_id(), 0));
+}
+
+void print_expr(Buffer &out, const nodes::Expr &expr, const Options &options) {
+  Printer(out, options).run(Item::make_expr(expr, 0));
+}
+
+std::string to_string(types::Mode mode) {
+  Buffer out;
+  print_mode(out, mode);
+  return out.str();
+}
+
+std::string to_string(const types::Storage &storage, types::TypeID type,
+                      const Options &options) {
+  Buffer out;
+  print_type(out, storage, type, options);
+  return out.str();
+}
+
+std::string to_string(const nodes::Expr &expr, const Options &options) {
+  Buffer out;
+  print_expr(out, expr, options);
+  return out.str();
+}
+
+} // namespace pretty
@@ -0,0 +1,332 @@
+#include "program_io.hpp"
+
+#include <limits>
+
+namespace program_io {
+
+namespace {
+
+void print_string(pretty::Buffer &out, std::string_view text) {
+  constexpr std::string_view hex = "0123456789abcdef";
+
+  out.append('"');
+  for (char c : text) {
+    if (c == '"' or c == '\\') {
+      out.append('\\');
+      out.append(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out.append("\\u00");
+      out.append(hex[c >> 4]);
+      out.append(hex[c & 0xf]);
+    } else {
+      out.append(c);
+    }
+  }
+  out.append('"');
+}
+
+} // namespace
+
+nodes::Arg arg_from_json(const json::Value &value) {
+  if (value.is_string()) {
+    return nodes::Arg(value.as_string());
+  }
+
+  const auto &parts = value.as_array();
+  if (parts.empty()) {
+    utils::throw_error("WRONG_ARG");
+  }
+
+  types::Mode mode;
+  for (size_t i = 1; i < parts.size(); ++i) {
+    if (not mode.set_by_name(parts[i].as_string())) {
+      utils::throw_error("UNKNOWN_MODE for " + parts[i].as_string());
+    }
+  }
+  return nodes::Arg(parts[0].as_string(), mode);
+}
+
+// compound expressions are built from explicit stack of frames, so deep
+// programs don't overflow stack
+nodes::ExprPtr expr_from_json(const json::Value &value) {
+  using namespace nodes;
+
+  enum class Kind { Let, Lambda, Call, Condition };
+
+  struct Frame {
+    Kind kind;
+    const json::Array *parts;
+    size_t first; // part of the first child expression
+    vector<Arg> args = {};
+    ExprPtrV results = {};
+
+    bool done() const { return first + results.size() == parts->size(); }
+  };
+
+  auto open = [](const json::Value &value) {
+    const auto &parts = value.as_array();
+    if (parts.empty()) {
+      utils::throw_error("EMPTY_EXPR");
+    }
+
+    const auto &head = parts[0].as_string();
+    auto check_size = [&parts, &head](size_t size) {
+      if (parts.size() != size) {
+        utils::throw_error("WRONG_PART_COUNT for " + head);
+      }
+    };
+
+    if (head == "let") {
+      check_size(4);
+      return Frame{Kind::Let, &parts, 2, {arg_from_json(parts[1])}};
+    }
+
+    if (head == "lambda") {
+      check_size(3);
+      Frame frame{Kind::Lambda, &parts, 2};
+      for (const auto &arg : parts[1].as_array()) {
+        frame.args.push_back(arg_from_json(arg));
+      }
+      return frame;
+    }
+
+    if (head == "call") {
+      if (parts.size() < 2) {
+        utils::throw_error("WRONG_PART_COUNT for " + head);
+      }
+      return Frame{Kind::Call, &parts, 1};
+    }
+
+    if (head == "if") {
+      check_size(4);
+      return Frame{Kind::Condition, &parts, 1};
+    }
+
+    utils::throw_error("UNKNOWN_EXPR for " + head);
+    utils::unreachable();
+  };
+
+  auto build = [](Frame &frame) -> ExprPtr {
+    auto &results = frame.results;
+    switch (frame.kind) {
+    case Kind::Let:
+      return make_expr<Let>(std::move(frame.args[0]), std::move(results[0]),
+                            std::move(results[1]));
+    case Kind::Lambda:
+      return make_expr<Lambda>(std::move(frame.args), std::move(results[0]));
+    case Kind::Call: {
+      ExprPtr func = std::move(results[0]);
+      results.erase(results.begin());
+      return make_expr<Call>(std::move(func), std::move(results));
+    }
+    case Kind::Condition:
+      return make_expr<Condition>(std::move(results[0]), std::move(results[1]),
+                                  std::move(results[2]));
+    }
+    utils::unreachable();
+  };
+
+  std::vector<Frame> frames;
+  const json::Value *next = &value;
+  while (true) {
+    ExprPtr result;
+    if (next->is_number()) {
+      result = make_expr<Const>(static_cast<int>(next->as_integer(
+          std::numeric_limits<int>::min(), std::numeric_limits<int>::max())));
+    } else if (next->is_string()) {
+      result = make_expr<Var>(next->as_string());
+    } else {
+      frames.push_back(open(*next));
+    }
+
+    // finished frames are built, every frame has at least one child
+    while (result != nullptr) {
+      if (frames.empty()) {
+        return result;
+      }
+      frames.back().results.push_back(std::move(result));
+      if (frames.back().done()) {
+        result = build(frames.back());
+        frames.pop_back();
+      }
+    }
+
+    const Frame &frame = frames.back();
+    next = &(*frame.parts)[frame.first + frame.results.size()];
+  }
+}
+
+void print_arg_json(pretty::Buffer &out, const nodes::Arg &arg) {
+  const types::Mode mode = arg.mode_hint;
+  if (mode == types::Mode()) {
+    print_string(out, arg.name);
+    return;
+  }
+
+  out.append('[');
+  print_string(out, arg.name);
+  if (mode.loc == types::Mode::Loc::LOCAL) {
+    out.append(",\"local\"");
+  }
+  if (mode.uniq == types::Mode::Uniq::UNIQUE) {
+    out.append(",\"unique\"");
+  } else if (mode.uniq == types::Mode::Uniq::EXCL) {
+    out.append(",\"exclusive\"");
+  }
+  if (mode.lin == types::Mode::Lin::ONCE) {
+    out.append(",\"once\"");
+  } else if (mode.lin == types::Mode::Lin::SEP) {
+    out.append(",\"separated\"");
+  }
+  out.append(']');
+}
+
+void print_json(pretty::Buffer &out, const nodes::Expr &expr) {
+  // text items have no expression, items are pushed in reverse order
+  struct Item {
+    const nodes::Expr *expr;
+    std::string_view text = {};
+  };
+
+  std::vector<Item> stack{Item{&expr}};
+  auto push = [&stack](std::initializer_list<Item> items) {
+    stack.insert(stack.end(), std::rbegin(items), std::rend(items));
+  };
+
+  while (not stack.empty()) {
+    const Item item = stack.back();
+    stack.pop_back();
+    if (item.expr == nullptr) {
+      out.append(item.text);
+      continue;
+    }
+
+    const auto &value = item.expr->value;
+    switch (value.index()) {
+    case 0: // Const
+      out.append(static_cast<long long>(std::get<0>(value).value));
+      break;
+    case 1: // Var
+      print_string(out, std::get<1>(value).name);
+      break;
+    case 2: { // Let
+      const auto &let = std::get<2>(value);
+      out.append("[\"let\",");
+      print_arg_json(out, let.name);
+      out.append(',');
+      push({Item{let.body.get()}, Item{nullptr, ","}, Item{let.where.get()},
+            Item{nullptr, "]"}});
+      break;
+    }
+    case 3: { // Lambda
+      const auto &lambda = std::get<3>(value);
+      out.append("[\"lambda\",[");
+      for (size_t i = 0; i < lambda.args.size(); ++i) {
+        if (i != 0) {
+          out.append(',');
+        }
+        print_arg_json(out, lambda.args[i]);
+      }
+      out.append("],");
+      push({Item{lambda.expr.get()}, Item{nullptr, "]"}});
+      break;
+    }
+    case 4: { // Call
+      const auto &call = std::get<4>(value);
+      out.append("[\"call\",");
+      stack.push_back(Item{nullptr, "]"});
+      for (auto it = call.args.rbegin(); it != call.args.rend(); ++it) {
+        stack.push_back(Item{it->get()});
+        stack.push_back(Item{nullptr, ","});
+      }
+      stack.push_back(Item{call.func.get()});
+      break;
+    }
+    case 5: { // Condition
+      const auto &condition = std::get<5>(value);
+      out.append("[\"if\",");
+      push({Item{condition.condition.get()}, Item{nullptr, ","},
+            Item{condition.then_case.get()}, Item{nullptr, ","},
+            Item{condition.else_case.get()}, Item{nullptr, "]"}});
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+}
+
+nodes::ExprPtr &child_at(nodes::Expr &expr, size_t index) {
+  switch (expr.value.index()) {
+  case 2: { // Let
+    auto &let = std::get<2>(expr.value);
+    if (index < 2) {
+      return index == 0 ? let.body : let.where;
+    }
+    break;
+  }
+  case 3: { // Lambda
+    if (index == 0) {
+      return std::get<3>(expr.value).expr;
+    }
+    break;
+  }
+  case 4: { // Call
+    auto &call = std::get<4>(expr.value);
+    if (index == 0) {
+      return call.func;
+    }
+    if (index <= call.args.size()) {
+      return call.args[index - 1];
+    }
+    break;
+  }
+  case 5: { // Condition
+    auto &condition = std::get<5>(expr.value);
+    if (index < 3) {
+      return index == 0   ? condition.condition
+             : index == 1 ? condition.then_case
+                          : condition.else_case;
+    }
+    break;
+  }
+  case 0: // Const
+  case 1: // Var
+    break;
+  default:
+    utils::unreachable();
+  }
+
+  utils::throw_error("NO_CHILD " + std::to_string(index));
+  utils::unreachable();
+}
+
+const nodes::ExprPtr &child_at(const nodes::Expr &expr, size_t index) {
+  // nothing is changed, only returned reference is const
+  return child_at(const_cast<nodes::Expr &>(expr), index);
+}
+
+nodes::ExprPtr replace_at(const nodes::ExprPtr &root,
+                          const std::vector<size_t> &path,
+                          nodes::ExprPtr replacement) {
+  if (path.empty()) {
+    utils::throw_error("EMPTY_PATH");
+  }
+
+  std::vector<const nodes::Expr *> parents{root.get()};
+  for (size_t i = 0; i + 1 < path.size(); ++i) {
+    parents.push_back(child_at(*parents.back(), path[i]).get());
+  }
+  child_at(*parents.back(), path.back()); // checks last index
+
+  // nodes on path are copied, other subtrees are shared with root
+  nodes::ExprPtr result = std::move(replacement);
+  for (size_t i = path.size(); i-- > 0;) {
+    nodes::Expr copy = nodes::copy_node(*parents[i]);
+    child_at(copy, path[i]) = std::move(result);
+    result = nodes::make_expr(std::move(copy));
+  }
+  return result;
+}
+
+} // namespace program_io
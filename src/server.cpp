@@ -0,0 +1,570 @@
+#include "server.hpp"
+#include "closure.hpp"
+#include "constraints.hpp"
+#include "demand.hpp"
+#include "fold.hpp"
+#include "json.hpp"
+#include "mode_infer.hpp"
+#include "monomorphize.hpp"
+#include "prelude.hpp"
+#include "pretty_printer.hpp"
+#include "program_io.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+namespace server {
+
+namespace {
+
+struct Output {
+  Output(std::ostream &out) : out_(out) {}
+
+  void write(const json::Object &response) {
+    std::string line = json::dump(response);
+    line += '\n';
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    out_ << line << std::flush;
+  }
+
+private:
+  std::mutex mutex_;
+  std::ostream &out_;
+};
+
+std::string error_location(const utils::Error &error) {
+  return std::string(error.location.file_name()) + "(" +
+         std::to_string(error.location.line()) + ":" +
+         std::to_string(error.location.column()) + ")";
+}
+
+void add_error(json::Object &response, const std::string &stage,
+               const utils::Error &error) {
+  response["status"] = "error";
+  response["stage"] = stage;
+  response["message"] = error.message;
+  response["location"] = error_location(error);
+}
+
+// ---------------
+
+struct Program {
+  nodes::ExprPtr expr;
+  std::string source; // serialized json of last full submission
+  bool sum_uniq = false;
+  json::Object result; // empty if program was edited after last check
+};
+
+// frozen preludes, shared by all workers
+struct Preludes {
+  std::shared_ptr<const prelude::Prelude> shared_sum;
+  std::shared_ptr<const prelude::Prelude> unique_sum;
+
+  const prelude::Prelude &get(bool sum_uniq) const {
+    return sum_uniq ? *unique_sum : *shared_sum;
+  }
+};
+
+class Worker {
+public:
+  Worker(Output &output, const Options &options, const Preludes &preludes)
+      : output_(output), options_(options), preludes_(preludes),
+        thread_([this] { run(); }) {}
+
+  ~Worker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    ready_.notify_one();
+    thread_.join();
+  }
+
+  void push(json::Value request) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(request));
+    }
+    ready_.notify_one();
+  }
+
+private:
+  void run() {
+    while (true) {
+      json::Value request;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this] { return stopped_ or not queue_.empty(); });
+        if (queue_.empty()) {
+          return;
+        }
+        request = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      output_.write(handle(request));
+    }
+  }
+
+  json::Object handle(const json::Value &request) {
+    auto begin = std::chrono::steady_clock::now();
+
+    json::Object response;
+    if (const auto *id = request.find("id"); id != nullptr) {
+      response["id"] = *id;
+    }
+
+    try {
+      const auto *op = request.find("op");
+      if (op == nullptr) {
+        utils::throw_error("NO_OP");
+      }
+
+      std::string name;
+      if (const auto *name_value = request.find("name");
+          name_value != nullptr) {
+        name = name_value->as_string();
+        response["name"] = name;
+      }
+
+      if (op->as_string() == "check") {
+        handle_check(request, name, response);
+      } else if (op->as_string() == "edit") {
+        handle_edit(request, name, response);
+      } else if (op->as_string() == "check_all") {
+        handle_check_all(name, response);
+      } else if (op->as_string() == "drop") {
+        programs_.erase(name);
+        response["status"] = "ok";
+      } else {
+        utils::throw_error("UNKNOWN_OP for " + op->as_string());
+      }
+    } catch (utils::Error error) {
+      add_error(response, "request", error);
+    }
+
+    response["elapsed_us"] = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - begin)
+            .count());
+    return response;
+  }
+
+  void handle_check(const json::Value &request, const std::string &name,
+                    json::Object &response) {
+    const auto *program_value = request.find("program");
+    if (program_value == nullptr) {
+      utils::throw_error("NO_PROGRAM");
+    }
+
+    bool sum_uniq = options_.sum_uniq;
+    if (const auto *value = request.find("sum_uniq"); value != nullptr) {
+      sum_uniq = value->as_bool();
+    }
+
+    std::string source = json::dump(*program_value);
+
+    // unchanged resubmission, reuse the last result
+    if (auto it = programs_.find(name);
+        not name.empty() and it != programs_.end() and
+        not it->second.result.empty() and it->second.source == source and
+        it->second.sum_uniq == sum_uniq) {
+      merge_result(response, it->second.result);
+      response["cached"] = true;
+      return;
+    }
+
+    Program program{program_io::expr_from_json(*program_value),
+                    std::move(source), sum_uniq, {}};
+    program.result = check(program, options_.demand);
+    merge_result(response, program.result);
+
+    if (not name.empty()) {
+      programs_.insert_or_assign(name, std::move(program));
+    }
+  }
+
+  // full check of stored program, including lets skipped by demand
+  void handle_check_all(const std::string &name, json::Object &response) {
+    auto it = programs_.find(name);
+    if (it == programs_.end()) {
+      utils::throw_error("NO_PROGRAM for " + name);
+    }
+    merge_result(response, check(it->second, false));
+  }
+
+  void handle_edit(const json::Value &request, const std::string &name,
+                   json::Object &response) {
+    auto it = programs_.find(name);
+    if (it == programs_.end()) {
+      utils::throw_error("NO_PROGRAM for " + name);
+    }
+
+    const auto *path_value = request.find("path");
+    const auto *expr_value = request.find("expr");
+    if (path_value == nullptr or expr_value == nullptr) {
+      utils::throw_error("NO_PATH_OR_EXPR");
+    }
+
+    std::vector<size_t> path;
+    for (const auto &index : path_value->as_array()) {
+      path.push_back(static_cast<size_t>(
+          index.as_integer(0, std::numeric_limits<int>::max())));
+    }
+
+    auto &program = it->second;
+    auto replacement = program_io::expr_from_json(*expr_value);
+    if (path.empty()) {
+      program.expr = std::move(replacement);
+    } else {
+      program.expr =
+          program_io::replace_at(program.expr, path, std::move(replacement));
+    }
+    // source no longer describes the program, so no resubmission can match
+    program.source.clear();
+    program.result = check(program, options_.demand);
+    merge_result(response, program.result);
+  }
+
+  static void merge_result(json::Object &response, const json::Object &result) {
+    for (const auto &[key, value] : result) {
+      response[key] = value;
+    }
+  }
+
+  // with demand, bodies of lets not needed for the result are not checked
+  json::Object check(const Program &program, bool demand) const {
+    json::Object result;
+    const auto &prelude = preludes_.get(program.sum_uniq);
+
+    const bool specialize = options_.monomorphize and not demand;
+    const bool fold = options_.fold and not demand;
+    nodes::ExprPtr expr = program.expr;
+
+    demand::Plan plan;
+    if (demand) {
+      plan = demand::plan(*expr, prelude);
+      result["skipped"] = static_cast<double>(plan.skipped.size());
+    }
+
+    // node types point into type storage, so it should outlive mode check
+    type_check::State type_state(prelude.storage, prelude.types);
+    type_state.skipped_lets = &plan.skipped;
+
+    try {
+      auto type =
+          options_.batch_types
+              ? constraints::check_expr_batch(expr, type_state)
+              : type_check::check_expr_iterative(expr, type_state);
+      if (options_.infer_modes) {
+        auto stats = mode_infer::infer(expr, type_state.type_storage,
+                                       type_state.node_types, &plan.skipped);
+        result["inferred"] = static_cast<double>(stats.refined);
+      }
+      result["type"] = pretty::to_string(type_state.type_storage, type);
+    } catch (utils::Error error) {
+      add_error(result, "type", error);
+      return result;
+    }
+
+    try {
+      mode_check::State state(prelude.modes, type_state.type_storage,
+                              type_state.node_types);
+      state.skipped_lets = &plan.skipped;
+      mode_check::check_expr_iterative(expr, state);
+    } catch (utils::Error error) {
+      add_error(result, "mode", error);
+      return result;
+    }
+
+    // following passes use simplified program and its check
+    std::optional<type_check::State> folded_state;
+    const type_check::State *checked = &type_state;
+    if (fold) {
+      try {
+        result["folded"] = simplify(expr, type_state, prelude, folded_state);
+        checked = &*folded_state;
+      } catch (utils::Error error) {
+        add_error(result, "fold", error);
+        return result;
+      }
+    }
+
+    if (options_.closures) {
+      result["closures"] = closure_stats(expr, *checked);
+    }
+
+    if (specialize) {
+      try {
+        result["variants"] =
+            static_cast<double>(monomorphize(expr, *checked, prelude));
+        pretty::Buffer out;
+        program_io::print_json(out, *expr);
+        result["specialized"] = json::parse(out.str());
+      } catch (utils::Error error) {
+        add_error(result, "mono", error);
+        return result;
+      }
+    }
+
+    result["status"] = "ok";
+    return result;
+  }
+
+  static json::Object closure_stats(const nodes::ExprPtr &expr,
+                                    const type_check::State &checked) {
+    const auto stats =
+        closure::convert(expr, checked.type_storage, checked.node_types).stats;
+    return json::Object{
+        {"functions", static_cast<double>(stats.functions)},
+        {"captures", static_cast<double>(stats.captures)},
+        {"moved", static_cast<double>(stats.moved)},
+        {"stack_bytes", static_cast<double>(stats.stack_bytes)},
+        {"single_use_bytes", static_cast<double>(stats.single_use_bytes)},
+        {"heap_bytes", static_cast<double>(stats.heap_bytes)},
+    };
+  }
+
+  // folds checked program, simplified program is checked again into
+  // folded_state, stored program is kept as sent
+  static json::Object simplify(nodes::ExprPtr &expr,
+                               const type_check::State &checked,
+                               const prelude::Prelude &prelude,
+                               std::optional<type_check::State> &folded_state) {
+    const auto stats =
+        fold::simplify(expr, checked.type_storage, checked.node_types);
+
+    folded_state.emplace(prelude.storage, prelude.types);
+    type_check::check_expr_iterative(expr, *folded_state);
+    mode_check::State mode_state(prelude.modes, folded_state->type_storage,
+                                 folded_state->node_types);
+    mode_check::check_expr_iterative(expr, mode_state);
+
+    return json::Object{
+        {"calls", static_cast<double>(stats.calls)},
+        {"branches", static_cast<double>(stats.branches)},
+        {"lets", static_cast<double>(stats.lets)},
+    };
+  }
+
+  // specializes checked program until call sites don't change, checking it
+  // again after each run, expr is replaced by last accepted program, returns
+  // number of added lambda copies, stored program is kept as sent
+  //
+  // specialized program can be rejected (see monomorphize.hpp), then program
+  // of previous run is kept and its copies are counted
+  static size_t monomorphize(nodes::ExprPtr &expr,
+                             const type_check::State &checked,
+                             const prelude::Prelude &prelude) {
+    constexpr size_t MAX_RUNS = 8;
+
+    size_t variants = 0;
+    nodes::ExprPtr specialized = expr;
+    auto stats =
+        mono::specialize(specialized, checked.type_storage, checked.node_types);
+    for (size_t run = 1; stats.changed(); ++run) {
+      type_check::State type_state(prelude.storage, prelude.types);
+      try {
+        type_check::check_expr_iterative(specialized, type_state);
+        mode_check::State mode_state(prelude.modes, type_state.type_storage,
+                                     type_state.node_types);
+        mode_check::check_expr_iterative(specialized, mode_state);
+      } catch (utils::Error) {
+        break;
+      }
+      expr = specialized;
+      variants += stats.variants;
+
+      if (run == MAX_RUNS) {
+        break;
+      }
+      stats = mono::specialize(specialized, type_state.type_storage,
+                               type_state.node_types);
+    }
+    return variants;
+  }
+
+private:
+  Output &output_;
+  const Options &options_;
+  const Preludes &preludes_;
+
+  // owned by worker thread
+  std::unordered_map<std::string, Program> programs_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<json::Value> queue_;
+  bool stopped_ = false;
+
+  std::thread thread_; // last, starts after other members are ready
+};
+
+} // namespace
+
+void serve(std::istream &in, std::ostream &out, Options options) {
+  if (options.threads == 0) {
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  Preludes preludes;
+  if (options.prelude_path.empty()) {
+    preludes = {prelude::core(false), prelude::core(true)};
+  } else {
+    preludes = {prelude::load_file(options.prelude_path, false),
+                prelude::load_file(options.prelude_path, true)};
+  }
+
+  Output output(out);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  workers.reserve(options.threads);
+  for (size_t i = 0; i < options.threads; ++i) {
+    workers.push_back(std::make_unique<Worker>(output, options, preludes));
+  }
+
+  size_t anonymous_count = 0;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+
+    json::Value request;
+    try {
+      request = json::parse(line);
+    } catch (utils::Error error) {
+      json::Object response;
+      add_error(response, "request", error);
+      output.write(response);
+      continue;
+    }
+
+    // same name -> same worker, so requests for one program stay ordered
+    size_t worker_id = anonymous_count++ % workers.size();
+    if (const auto *name = request.find("name");
+        name != nullptr and name->is_string()) {
+      worker_id = std::hash<std::string>{}(name->as_string()) % workers.size();
+    }
+    workers[worker_id]->push(std::move(request));
+  }
+
+  // workers finish their queues on destruction
+}
+
+void stream(std::istream &in, std::ostream &out, Options options) {
+  const auto prelude = options.prelude_path.empty()
+                           ? prelude::core(options.sum_uniq)
+                           : prelude::load_file(options.prelude_path,
+                                                options.sum_uniq);
+
+  // lives for the whole stream, declaration types point into it
+  type_check::State type_state(prelude->storage, prelude->types);
+  mode_check::State mode_state(prelude->modes, type_state.type_storage,
+                               type_state.node_types);
+
+  Output output(out);
+
+  size_t line_id = 0;
+  size_t declarations = 0;
+  size_t errors = 0;
+  size_t compactions = 0;
+  size_t next_compaction =
+      type_state.type_storage.size() + options.compact_types;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    ++line_id;
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    json::Object response;
+    response["line"] = static_cast<double>(line_id);
+
+    std::optional<nodes::Arg> name;
+    nodes::ExprPtr expr;
+    try {
+      const json::Value value = json::parse(line);
+      if (value.is_array() and value.as_array().size() == 3 and
+          value.as_array()[0].is_string() and
+          value.as_array()[0].as_string() == "let") {
+        name = program_io::arg_from_json(value.as_array()[1]);
+        expr = program_io::expr_from_json(value.as_array()[2]);
+        response["name"] = name->name;
+        ++declarations;
+      } else {
+        expr = program_io::expr_from_json(value);
+      }
+    } catch (utils::Error error) {
+      add_error(response, "request", error);
+    }
+
+    if (expr != nullptr) {
+      std::string stage = "type";
+      try {
+        auto type = name.has_value()
+                        ? type_check::check_decl(*name, expr, type_state)
+                        : type_check::check_expr_iterative(expr, type_state);
+        response["type"] = pretty::to_string(type_state.type_storage, type);
+
+        stage = "mode";
+        if (name.has_value()) {
+          mode_check::check_decl(*name, expr, mode_state);
+        } else {
+          mode_check::check_expr_iterative(expr, mode_state);
+        }
+        response["status"] = "ok";
+      } catch (utils::Error error) {
+        add_error(response, stage, error);
+        if (name.has_value() and stage == "mode") {
+          // type is known, so following declarations are checked as usual
+          mode_state.set_var(name->name,
+                             mode_state.get_mode(
+                                 type_state.node_types.get(name->id)));
+        }
+      }
+    }
+
+    if (response["status"].as_string() != "ok") {
+      ++errors;
+    }
+
+    // AST is not needed anymore, so are its node types, types in storage are
+    // dropped by compaction
+    expr = nullptr;
+    type_state.node_types.clear();
+    if (type_state.type_storage.size() >= next_compaction) {
+      type_check::compact(type_state);
+      ++compactions;
+      next_compaction = std::max(2 * type_state.type_storage.size(),
+                                 type_state.type_storage.size() +
+                                     options.compact_types);
+    }
+
+    response["elapsed_us"] = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - begin)
+            .count());
+    output.write(response);
+  }
+
+  json::Object totals;
+  totals["status"] = "done";
+  totals["declarations"] = static_cast<double>(declarations);
+  totals["errors"] = static_cast<double>(errors);
+  totals["compactions"] = static_cast<double>(compactions);
+  totals["types"] = static_cast<double>(type_state.type_storage.size());
+  output.write(totals);
+}
+
+} // namespace server
@@ -0,0 +1,186 @@
+#include "task_pool.hpp"
+
+namespace task_pool {
+
+namespace {
+
+// waits nested deeper than this don't run tasks of other groups
+constexpr size_t MAX_HELP_DEPTH = 8;
+
+// failed attempts to find task before waiting thread blocks
+constexpr size_t SPIN_LIMIT = 64;
+
+// queue of current thread, workers push spawned tasks to own queues
+struct Current {
+  const Pool *pool = nullptr;
+  size_t index = 0;
+  size_t waits = 0; // nested waits in progress
+};
+
+thread_local Current current;
+
+} // namespace
+
+Pool::Pool(size_t threads) {
+  if (threads == 0) {
+    threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  }
+
+  const size_t workers = threads - 1;
+  for (size_t i = 0; i <= workers; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  for (size_t i = 0; i < workers; ++i) {
+    workers_.emplace_back([this, i] { work(i); });
+  }
+}
+
+Pool::~Pool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopped_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void Pool::spawn(Group &group, std::function<void()> task) {
+  group.pending_.fetch_add(1, std::memory_order_relaxed);
+
+  const size_t index =
+      current.pool == this ? current.index : queues_.size() - 1;
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(Task{&group, std::move(task)});
+  }
+  queued_.fetch_add(1, std::memory_order_release);
+
+  // sleeping worker checks queued_ under this mutex, so wakeup is not lost
+  { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+  wake_.notify_one();
+}
+
+void Pool::wait(Group &group) {
+  const size_t own = current.pool == this ? current.index : queues_.size() - 1;
+  const bool help = current.waits < MAX_HELP_DEPTH;
+
+  ++current.waits;
+  size_t idle = 0;
+  while (not group.finished()) {
+    if (help ? try_run(own) : try_run_group(own, group)) {
+      idle = 0;
+      continue;
+    }
+    if (++idle < SPIN_LIMIT) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // remaining tasks of group are run by other threads, blocked_ is
+    // increased before check, so last task of group sees it
+    std::unique_lock<std::mutex> lock(join_mutex_);
+    blocked_.fetch_add(1);
+    joined_.wait(lock, [&group] { return group.pending_.load() == 0; });
+    blocked_.fetch_sub(1);
+  }
+  --current.waits;
+
+  std::lock_guard<std::mutex> lock(group.mutex_);
+  if (group.error_ != nullptr) {
+    std::rethrow_exception(std::exchange(group.error_, nullptr));
+  }
+}
+
+void Pool::work(size_t index) {
+  current = Current{this, index};
+  while (true) {
+    if (try_run(index)) {
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [this] {
+      return stopped_ or queued_.load(std::memory_order_acquire) != 0;
+    });
+    // queued tasks are finished before exit, their groups can be waited
+    if (stopped_ and queued_.load(std::memory_order_acquire) == 0) {
+      return;
+    }
+  }
+}
+
+bool Pool::try_run(size_t own) {
+  std::optional<Task> task;
+  {
+    auto &queue = *queues_[own];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (not queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+  }
+
+  for (size_t i = 1; not task.has_value() and i < queues_.size(); ++i) {
+    auto &queue = *queues_[(own + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (not queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+  }
+
+  if (not task.has_value()) {
+    return false;
+  }
+  run_popped(*task);
+  return true;
+}
+
+bool Pool::try_run_group(size_t own, Group &group) {
+  std::optional<Task> task;
+  {
+    auto &queue = *queues_[own];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    for (auto it = queue.tasks.rbegin(); it != queue.tasks.rend(); ++it) {
+      if (it->group == &group) {
+        task = std::move(*it);
+        queue.tasks.erase(std::next(it).base());
+        break;
+      }
+    }
+  }
+
+  if (not task.has_value()) {
+    return false;
+  }
+  run_popped(*task);
+  return true;
+}
+
+void Pool::run_popped(Task &task) {
+  queued_.fetch_sub(1, std::memory_order_relaxed);
+
+  // group can be released by waiting thread already, only pool is used
+  if (run(task) and blocked_.load() != 0) {
+    { std::lock_guard<std::mutex> lock(join_mutex_); }
+    joined_.notify_all();
+  }
+}
+
+bool Pool::run(Task &task) {
+  Group &group = *task.group;
+  try {
+    task.run();
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(group.mutex_);
+    if (group.error_ == nullptr) {
+      group.error_ = std::current_exception();
+    }
+  }
+  // waiting thread can release group right after last decrement
+  return group.pending_.fetch_sub(1) == 1;
+}
+
+} // namespace task_pool
@@ -2,83 +2,84 @@
 
 namespace type_check {
 
-types::TypeID check_const(nodes::Const &expr, State &state) {
-  return (expr.type = state.type_storage.get_int_type()).value();
+types::TypeID check_const(const nodes::Const &expr, State &state) {
+  return state.annotate(expr, state.type_storage.get_int_type());
 }
 
-types::TypeID check_var(nodes::Var &expr, State &state) {
-  if (auto maybe_var_type = state.manager.get_var_type(expr.name);
-      maybe_var_type.has_value()) {
-    return (expr.type = maybe_var_type).value();
-  }
-  utils::unreachable();
+types::TypeID check_var(const nodes::Var &expr, State &state) {
+  return state.annotate(
+      expr, state.manager.use_var_type(expr.name, state.type_storage));
 }
 
-types::TypeID check_let(nodes::Let &expr, State &state) {
+types::TypeID check_let(const nodes::Let &expr, State &state) {
   Context context(state.manager);
 
   types::TypeID new_type =
       state.type_storage.introduce_new_generic(expr.name.name, expr.name.mode_hint);
-  expr.name.type = new_type;
+  state.annotate(expr.name, new_type);
   state.manager.add_var(expr.name.name, new_type);
 
-  types::TypeID body_type = check_expr(expr.body, state);
+  if (not state.skips(expr)) {
+    types::TypeID body_type = check_expr(expr.body, state);
 
-  if (not state.type_storage.unify(new_type, body_type,
-                                   UnifyModePolicy::CheckLeftIsSubmode)) {
-    utils::throw_error("DIFFERENT_TYPES_OR_MODES");
+    if (not state.type_storage.unify(new_type, body_type,
+                                     UnifyModePolicy::CheckLeftIsSubmode)) {
+      utils::throw_error("DIFFERENT_TYPES_OR_MODES");
+    }
   }
 
   types::TypeID where_type = check_expr(expr.where, state);
-  return (expr.type = where_type).value();
+  return state.annotate(expr, where_type);
 }
 
-types::TypeID check_lambda(nodes::Lambda &expr, State &state) {
+types::TypeID check_lambda(const nodes::Lambda &expr, State &state) {
   Context context(state.manager);
 
-  ArrowType lambda_arrow_type;
+  types::TypeIDV lambda_arrow_types;
 
-    lambda_arrow_type.types.reserve(expr.args.size() + 1);
-  for (auto &arg : expr.args) {
+  lambda_arrow_types.reserve(expr.args.size() + 1);
+  for (const auto &arg : expr.args) {
     types::TypeID new_type = state.type_storage.introduce_new_generic(arg.name, arg.mode_hint);
-    arg.type = new_type;
-    lambda_arrow_type.types.push_back(new_type);
+    state.annotate(arg, new_type);
+    lambda_arrow_types.push_back(new_type);
     state.manager.add_var(arg.name, new_type);
   }
 
   types::TypeID ret_type = check_expr(expr.expr, state);
-  lambda_arrow_type.types.push_back(ret_type);
+  lambda_arrow_types.push_back(ret_type);
 
-  types::TypeID lambda_type = state.type_storage.add(lambda_arrow_type);
-  return (expr.type = lambda_type).value();
+  types::TypeID lambda_type = state.type_storage.add_arrow(lambda_arrow_types);
+  return state.annotate(expr, lambda_type);
 }
 
-types::TypeID check_call(nodes::Call &expr, State &state) {
+types::TypeID check_call(const nodes::Call &expr, State &state) {
   types::TypeID func_type = check_expr(expr.func, state);
 
-  if (auto *arrow_func_type = get_if<types::ArrowType>(&func_type.get().type);
-      arrow_func_type != nullptr) {
+  if (state.type_storage.is_arrow(func_type)) {
+    // copied, checking args adds types to storage
+    const auto func_parts = state.type_storage.parts(func_type);
+    const types::TypeIDV func_types(func_parts.begin(), func_parts.end());
 
-    if (arrow_func_type->types.size() != expr.args.size() + 1) {
+    if (func_types.size() != expr.args.size() + 1) {
       utils::throw_error("ARG_COUNT_MISMATCH");
     }
 
     for (size_t i = 0; i < expr.args.size(); ++i) {
       types::TypeID arg_type = check_expr(expr.args[i], state);
-      if (not state.type_storage.unify(arrow_func_type->types[i], arg_type,
+      if (not state.type_storage.unify(func_types[i], arg_type,
                                        UnifyModePolicy::CheckLeftIsSubmode)) {
         utils::throw_error("DIFFERENT_TYPES_OR_MODES");
       }
     }
 
-    return (expr.type = arrow_func_type->types.back()).value();
+    return state.annotate(expr, func_types.back());
   }
 
   utils::throw_error("FUNC_IS_NOT_ARROW_TYPE");
   utils::unreachable();
 }
 
-types::TypeID check_condition(nodes::Condition &expr, State &state) {
+types::TypeID check_condition(const nodes::Condition &expr, State &state) {
   types::TypeID condition_type = check_expr(expr.condition, state);
 
   if (not state.type_storage.unify(condition_type,
@@ -95,7 +96,7 @@ types::TypeID check_condition(nodes::Condition &expr, State &state) {
     utils::throw_error("DIFFERENT_TYPES");
   }
 
-  return (expr.type = then_type).value();
+  return state.annotate(expr, then_type);
 }
 
 types::TypeID check_expr(nodes::ExprPtr expr, State &state) {
@@ -117,4 +118,261 @@ types::TypeID check_expr(nodes::ExprPtr expr, State &state) {
   }
 }
 
+// ---------------
+
+class IterativeChecker {
+public:
+  IterativeChecker(State &state) : state_(state) {}
+
+  types::TypeID run(const nodes::Expr &root) {
+    push(root);
+    try {
+      while (not frames_.empty()) {
+        step();
+      }
+    } catch (...) {
+      // same as context destructors during unwinding in check_expr
+      for (auto it = frames_.rbegin(); it != frames_.rend(); ++it) {
+        if (it->context_entered) {
+          state_.manager.exit_context();
+        }
+      }
+      throw;
+    }
+    return result_.value();
+  }
+
+private:
+  struct Frame {
+    Frame(const nodes::Expr &expr) : expr(&expr) {}
+
+    const nodes::Expr *expr;
+    size_t stage = 0;
+    bool context_entered = false;
+    types::TypeID saved_type; // Let - name, Condition - then case
+    types::TypeIDV types;               // Lambda - arrow, Call - callee arrow
+  };
+
+  void push(const nodes::Expr &expr) { frames_.emplace_back(expr); }
+
+  void enter_context(Frame &frame) {
+    state_.manager.enter_context();
+    frame.context_entered = true;
+  }
+
+  // pops frame, returned type becomes result of the parent step
+  void finish(types::TypeID type) {
+    if (frames_.back().context_entered) {
+      state_.manager.exit_context();
+    }
+    frames_.pop_back();
+    result_ = type;
+  }
+
+  // frame reference is invalidated by push, so it is taken again every step
+  void step() {
+    Frame &frame = frames_.back();
+    auto &value = frame.expr->value;
+
+    switch (value.index()) {
+    case 0: // Const
+      finish(check_const(std::get<0>(value), state_));
+      break;
+    case 1: // Var
+      finish(check_var(std::get<1>(value), state_));
+      break;
+    case 2: // Let
+      step_let(frame, std::get<2>(value));
+      break;
+    case 3: // Lambda
+      step_lambda(frame, std::get<3>(value));
+      break;
+    case 4: // Call
+      step_call(frame, std::get<4>(value));
+      break;
+    case 5: // Condition
+      step_condition(frame, std::get<5>(value));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_let(Frame &frame, const nodes::Let &expr) {
+    switch (frame.stage++) {
+    case 0: {
+      enter_context(frame);
+
+      types::TypeID new_type = state_.type_storage.introduce_new_generic(
+          expr.name.name, expr.name.mode_hint);
+      state_.annotate(expr.name, new_type);
+      state_.manager.add_var(expr.name.name, new_type);
+      frame.saved_type = new_type;
+
+      if (state_.skips(expr)) {
+        ++frame.stage;
+        push(*expr.where);
+        break;
+      }
+      push(*expr.body);
+      break;
+    }
+    case 1:
+      if (not state_.type_storage.unify(frame.saved_type,
+                                        result_.value(),
+                                        UnifyModePolicy::CheckLeftIsSubmode)) {
+        utils::throw_error("DIFFERENT_TYPES_OR_MODES");
+      }
+      push(*expr.where);
+      break;
+    case 2:
+      finish(state_.annotate(expr, result_.value()));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+  void step_lambda(Frame &frame, const nodes::Lambda &expr) {
+    switch (frame.stage++) {
+    case 0:
+      enter_context(frame);
+
+      frame.types.reserve(expr.args.size() + 1);
+      for (const auto &arg : expr.args) {
+        types::TypeID new_type =
+            state_.type_storage.introduce_new_generic(arg.name, arg.mode_hint);
+        state_.annotate(arg, new_type);
+        frame.types.push_back(new_type);
+        state_.manager.add_var(arg.name, new_type);
+      }
+
+      push(*expr.expr);
+      break;
+    case 1: {
+      frame.types.push_back(result_.value());
+      types::TypeID lambda_type =
+          state_.type_storage.add_arrow(frame.types);
+      finish(state_.annotate(expr, lambda_type));
+      break;
+    }
+    default:
+      utils::unreachable();
+    }
+  }
+
+  // stage 0 - check func, stage 1 - func checked, stage 2 + i - arg i checked
+  void step_call(Frame &frame, const nodes::Call &expr) {
+    size_t stage = frame.stage++;
+
+    if (stage == 0) {
+      push(*expr.func);
+      return;
+    }
+
+    if (stage == 1) {
+      if (not state_.type_storage.is_arrow(result_.value())) {
+        utils::throw_error("FUNC_IS_NOT_ARROW_TYPE");
+      }
+      // copied, checking args adds types to storage
+      const auto func_parts = state_.type_storage.parts(result_.value());
+      frame.types.assign(func_parts.begin(), func_parts.end());
+
+      if (frame.types.size() != expr.args.size() + 1) {
+        utils::throw_error("ARG_COUNT_MISMATCH");
+      }
+    } else {
+      size_t arg_id = stage - 2;
+      if (not state_.type_storage.unify(frame.types[arg_id], result_.value(),
+                                        UnifyModePolicy::CheckLeftIsSubmode)) {
+        utils::throw_error("DIFFERENT_TYPES_OR_MODES");
+      }
+    }
+
+    size_t next_arg_id = stage - 1;
+    if (next_arg_id < expr.args.size()) {
+      push(*expr.args[next_arg_id]);
+      return;
+    }
+
+    finish(state_.annotate(expr, frame.types.back()));
+  }
+
+  void step_condition(Frame &frame, const nodes::Condition &expr) {
+    switch (frame.stage++) {
+    case 0:
+      push(*expr.condition);
+      break;
+    case 1:
+      if (not state_.type_storage.unify(result_.value(),
+                                        state_.type_storage.get_bool_type(),
+                                        UnifyModePolicy::Ignore)) {
+        utils::throw_error("DIFFERENT_TYPES");
+      }
+      push(*expr.then_case);
+      break;
+    case 2:
+      frame.saved_type = result_.value();
+      push(*expr.else_case);
+      break;
+    case 3:
+      if (not state_.type_storage.unify(frame.saved_type,
+                                        result_.value(),
+                                        UnifyModePolicy::ApplyStrongest)) {
+        utils::throw_error("DIFFERENT_TYPES");
+      }
+      finish(state_.annotate(expr, frame.saved_type));
+      break;
+    default:
+      utils::unreachable();
+    }
+  }
+
+private:
+  State &state_;
+  vector<Frame> frames_;
+  optional<types::TypeID> result_; // type of last finished expression
+};
+
+types::TypeID check_expr_iterative(nodes::ExprPtr expr, State &state) {
+  return IterativeChecker(state).run(*expr);
+}
+
+// ---------------
+
+types::TypeID check_decl(const nodes::Arg &name, nodes::ExprPtr body, State &state) {
+  types::TypeID new_type =
+      state.type_storage.introduce_new_generic(name.name, name.mode_hint);
+  state.annotate(name, new_type);
+
+  {
+    Context context(state.manager);
+    state.manager.add_var(name.name, new_type);
+
+    types::TypeID body_type = check_expr_iterative(body, state);
+
+    if (not state.type_storage.unify(new_type, body_type,
+                                     UnifyModePolicy::CheckLeftIsSubmode)) {
+      utils::throw_error("DIFFERENT_TYPES_OR_MODES");
+    }
+  }
+
+  state.manager.set_var(name.name, new_type);
+  return new_type;
+}
+
+void compact(State &state) {
+  types::TypeIDV roots;
+  state.manager.for_each_var_type(
+      [&roots](types::TypeID type) { roots.push_back(type); });
+
+  state.type_storage.compact(roots);
+  state.node_types.clear();
+
+  // same order, variables are not changed
+  size_t i = 0;
+  state.manager.for_each_var_type(
+      [&roots, &i](types::TypeID &type) { type = roots[i++]; });
+}
+
 } // namespace type_check
@@ -1,17 +1,28 @@
 #include "types.hpp"
+#include "utils.hpp"
 
 namespace types {
 
-const Type& TypeID::get() const {
-  return storage->get_type(id); 
-}
+namespace {
+
+thread_local const Storage *current_storage = nullptr;
+
+} // namespace
 
-Type& TypeID::get() {
-  return storage->get_type(id); 
+const Storage &Storage::current() {
+  if (current_storage == nullptr) {
+    utils::throw_error("NO_CURRENT_STORAGE");
+  }
+  return *current_storage;
 }
 
-TypeID TypeID::with_mode(Mode new_mode) const {
-  return storage->add(get().with_mode(new_mode)); 
+Type TypeID::get() const { return Storage::current().get(*this); }
+
+StorageScope::StorageScope(const Storage &storage)
+    : previous_(current_storage) {
+  current_storage = &storage;
 }
 
+StorageScope::~StorageScope() { current_storage = previous_; }
+
 } // namespace types
@@ -0,0 +1,213 @@
+#include "testing.hpp"
+
+#include "generator.hpp"
+#include "prelude.hpp"
+#include "pretty_printer.hpp"
+
+using namespace nodes;
+
+using testing::Checker;
+
+namespace {
+
+// printed type or error message with stage
+std::string outcome(const ExprPtr &expr, bool sum_uniq, Checker checker) {
+  return testing::check_expr(expr, {.sum_uniq = sum_uniq, .checker = checker})
+      .outcome();
+}
+
+} // namespace
+
+TEST(iterative_checkers_match_recursive) {
+  size_t errors = 0;
+  for (uint64_t seed = 1; seed <= 40; ++seed) {
+    gen::Options options;
+    options.seed = seed;
+    options.depth = 5;
+    options.error_rate = 0.3;
+    options.sum_uniq = seed % 2 == 0;
+    gen::Generator generator(options);
+
+    for (size_t i = 0; i < 5; ++i) {
+      bool injected = false;
+      const auto program = generator.program(&injected);
+      const auto recursive =
+          outcome(program, options.sum_uniq, Checker::Recursive);
+      CHECK(outcome(program, options.sum_uniq, Checker::Iterative) ==
+            recursive);
+      CHECK(recursive.starts_with("mode error: UNIQUE for e") == injected);
+      errors += injected;
+    }
+  }
+  CHECK(errors != 0);
+}
+
+TEST(iterative_checkers_handle_deep_programs) {
+  constexpr size_t depth = 200000;
+  ExprPtr program = make_expr<Var>("x");
+  for (size_t i = 0; i < depth; ++i) {
+    program = make_expr<Let>(
+        Arg("x"), operator_call("+", make_expr<Const>(1), make_expr<Const>(2)),
+        program);
+  }
+  CHECK(outcome(program, false, Checker::Iterative) == "int");
+
+  ExprPtr calls = make_expr<Const>(0);
+  for (size_t i = 0; i < depth; ++i) {
+    calls = operator_call("-", calls, make_expr<Const>(1));
+  }
+  CHECK(outcome(calls, false, Checker::Iterative) == "int");
+}
+
+TEST(checkers_report_errors) {
+  // unique binding used twice
+  const auto twice = make_expr<Let>(
+      with_unique_hint(Arg("x")), make_expr<Const>(1),
+      operator_call("+", make_expr<Var>("x"), make_expr<Var>("x")));
+  CHECK(outcome(twice, true, Checker::Iterative) == "mode error: UNIQUE for x");
+  CHECK(outcome(twice, true, Checker::Recursive) == "mode error: UNIQUE for x");
+
+  // condition on int
+  const auto condition = make_expr<Condition>(
+      make_expr<Const>(1), make_expr<Const>(2), make_expr<Const>(3));
+  CHECK(outcome(condition, false, Checker::Iterative)
+            .starts_with("type error: "));
+  CHECK(outcome(make_expr<Var>("y"), false, Checker::Iterative) ==
+        "type error: NO_VAR for y");
+}
+
+TEST(batch_solver_matches_iterative_checker) {
+  size_t checked = 0;
+  for (uint64_t seed = 1; seed <= 60; ++seed) {
+    gen::Options options;
+    options.seed = seed;
+    options.depth = 4 + seed % 3;
+    options.error_rate = 0.3;
+    options.sum_uniq = seed % 2 == 0;
+    gen::Generator generator(options);
+
+    for (size_t i = 0; i < 5; ++i) {
+      const auto program = generator.program();
+      const auto iterative =
+          outcome(program, options.sum_uniq, Checker::Iterative);
+      const auto batch = outcome(program, options.sum_uniq, Checker::Batch);
+      CHECK(batch == iterative);
+      checked += iterative.find(" error: ") == std::string::npos;
+    }
+  }
+  CHECK(checked != 0);
+
+  // wrong programs are rejected by both
+  const auto not_callable =
+      make_expr<Call>(make_expr<Const>(1), ExprPtrV{make_expr<Const>(2)});
+  CHECK(outcome(not_callable, false, Checker::Batch).starts_with(
+      "type error: "));
+  const auto wrong_arg = operator_call("+", make_expr<Const>(1),
+                                       lambda1("x", make_expr<Var>("x")));
+  CHECK(outcome(wrong_arg, false, Checker::Batch).starts_with("type error: "));
+}
+
+TEST(checkers_accept_repeated_nodes) {
+  // + x x with one node x
+  const auto one = make_expr<Const>(1);
+  const auto shared = operator_call("+", one, one);
+  for (const auto checker :
+       {Checker::Recursive, Checker::Iterative, Checker::Batch}) {
+    CHECK(outcome(shared, false, checker) == "int");
+  }
+
+  // the same arg in two lambdas
+  const Arg x("x");
+  const auto lambdas = operator_call(
+      "+",
+      make_expr<Call>(lambda1(x, make_expr<Var>("x")),
+                      ExprPtrV{make_expr<Const>(1)}),
+      make_expr<Call>(lambda1(x, make_expr<Var>("x")),
+                      ExprPtrV{make_expr<Const>(2)}));
+  CHECK(outcome(lambdas, false, Checker::Iterative) == "int");
+
+  // uses of repeated var node are counted by mode check
+  const auto y = make_expr<Var>("y");
+  const auto unique_y = make_expr<Let>(with_unique_hint(Arg("y")),
+                                       make_expr<Const>(1),
+                                       operator_call("+", y, y));
+  CHECK(outcome(unique_y, true, Checker::Iterative) ==
+        "mode error: UNIQUE for y");
+}
+
+TEST(repeated_nodes_are_annotated_per_occurrence) {
+  // if L (< 1 2) then L 1 else 0 with one node L = \x -> x
+  const auto lambda = lambda1("x", make_expr<Var>("x"));
+  const auto program = make_expr<Condition>(
+      make_expr<Call>(lambda, ExprPtrV{operator_call(
+                                  "<", make_expr<Const>(1),
+                                  make_expr<Const>(2))}),
+      make_expr<Call>(lambda, ExprPtrV{make_expr<Const>(1)}),
+      make_expr<Const>(0));
+  for (const auto checker :
+       {Checker::Recursive, Checker::Iterative, Checker::Batch}) {
+    CHECK(outcome(program, false, checker) == "int");
+  }
+
+  const auto checked = testing::check_expr(program);
+  const auto &state = checked.types;
+  const NodeId id = id_of(*lambda);
+  CHECK(pretty::to_string(state.type_storage, state.node_types.get(id, 0)) ==
+        "bool -> bool");
+  CHECK(pretty::to_string(state.type_storage, state.node_types.get(id, 1)) ==
+        "int -> int");
+  CHECK(not state.node_types.get(id, 2).is_valid());
+}
+
+TEST(subtrees_are_shared_between_trees) {
+  // lambda node is shared, each tree is checked with own side table
+  const auto lambda = lambda1("x", make_expr<Var>("x"));
+  const auto with_int =
+      make_expr<Call>(lambda, ExprPtrV{make_expr<Const>(1)});
+  const auto with_bool = make_expr<Call>(
+      lambda,
+      ExprPtrV{operator_call("<", make_expr<Const>(1), make_expr<Const>(2))});
+
+  const auto int_checked = testing::check_expr(with_int);
+  const auto bool_checked = testing::check_expr(with_bool);
+  const auto &int_state = int_checked.types;
+  const auto &bool_state = bool_checked.types;
+
+  const NodeId id = id_of(*lambda);
+  CHECK(pretty::to_string(int_state.type_storage,
+                          int_state.node_types.get(id)) == "int -> int");
+  CHECK(pretty::to_string(bool_state.type_storage,
+                          bool_state.node_types.get(id)) == "bool -> bool");
+}
+
+TEST(table_keeps_each_occurrence) {
+  TypeTable table;
+  const NodeId id = next_node_id();
+  CHECK(not table.get(id).is_valid());
+  table.add(id, types::TypeID(3));
+  CHECK(not table.has_repeats());
+  table.add(id, types::TypeID(4));
+  CHECK(table.has_repeats());
+  CHECK(table.get(id) == types::TypeID(3));
+  CHECK(table.get(id, 1) == types::TypeID(4));
+  table.set(id, types::TypeID(5));
+  CHECK(table.get(id) == types::TypeID(5));
+  table.clear();
+  CHECK(not table.has_repeats());
+  CHECK(not table.get(id, 1).is_valid());
+}
+
+TEST(compact_keeps_only_variable_types) {
+  const auto prelude = prelude::core(false);
+  type_check::State state(prelude->storage, prelude->types);
+  const auto body = lambda1("x", make_expr<Var>("x"));
+  type_check::check_decl(Arg("f"), body, state);
+  CHECK(not state.node_types.empty());
+
+  type_check::compact(state);
+  CHECK(state.node_types.empty());
+  CHECK(not state.node_types.get(id_of(*body)).is_valid());
+  const auto type = state.manager.find_var_type("f");
+  CHECK(type.has_value());
+  CHECK(pretty::to_string(state.type_storage, *type) == "'x -> 'x");
+}
@@ -0,0 +1,103 @@
+#include "testing.hpp"
+
+#include "closure.hpp"
+#include "program_io.hpp"
+
+using closure::CaptureKind;
+using closure::EnvKind;
+
+namespace {
+
+// program in JSON encoding (program_io.hpp), checked before conversion
+closure::Program convert(const std::string &text, bool sum_uniq = false) {
+  const auto expr = program_io::expr_from_json(json::parse(text));
+  const auto checked = testing::check_expr(expr, {.sum_uniq = sum_uniq});
+  CHECK(checked.error.empty());
+  return closure::convert(expr, checked.types.type_storage,
+                          checked.types.node_types);
+}
+
+} // namespace
+
+TEST(closure_fields_are_aligned_in_capture_order) {
+  // let b = < 1 2 in let y = 1 in let g = \z -> z in
+  // let f = \x -> if b then + x y else g x in f 1
+  const auto program = convert(
+      R"(["let","b",["call","<",1,2],["let","y",1,)"
+      R"(["let","g",["lambda",["z"],"z"],)"
+      R"(["let","f",["lambda",["x"],["if","b",["call","+","x","y"],)"
+      R"(["call","g","x"]]],["call","f",1]]]]])");
+
+  CHECK(program.functions.size() == 2);
+  CHECK(pretty::to_string(*program.main) ==
+        "let b = < 1 2 in let y = 1 in let g = g#0 in "
+        "let f = f#1 b y g in f 1");
+
+  const auto &g = program.functions[0];
+  CHECK(g.self_name == "g");
+  CHECK(g.captures.empty());
+  CHECK(g.env_size == 0);
+
+  // bool 1, int 8, closure 16
+  const auto &f = program.functions[1];
+  CHECK(f.self_name == "f");
+  CHECK(f.env == EnvKind::Heap);
+  CHECK(f.captures.size() == 3);
+  CHECK(f.captures[0].name == "b" and f.captures[0].offset == 0 and
+        f.captures[0].size == 1);
+  CHECK(f.captures[1].name == "y" and f.captures[1].offset == 8 and
+        f.captures[1].size == 8);
+  CHECK(f.captures[2].name == "g" and f.captures[2].offset == 16 and
+        f.captures[2].size == 16);
+  CHECK(f.env_size == 32);
+  for (const auto &capture : f.captures) {
+    CHECK(capture.kind == CaptureKind::Copy);
+  }
+
+  CHECK(program.stats.functions == 2);
+  CHECK(program.stats.captures == 3);
+  CHECK(program.stats.heap_bytes == 32);
+}
+
+TEST(closure_env_kind_follows_closure_mode) {
+  // let y = 1 in let g<hint> = \x -> x in (if < 1 2 then g else \z -> + z y) 3,
+  // branch join gives lambda mode of g
+  auto join = [](const std::string &hint, const std::string &y_arg) {
+    return R"(["let",)" + y_arg + R"(,1,["let",["g",")" + hint +
+           R"("],["lambda",["x"],"x"],["call",["if",["call","<",1,2],"g",)"
+           R"(["lambda",["z"],["call","+","z","y"]]],3]]])";
+  };
+
+  const auto local = convert(join("local", R"("y")"));
+  CHECK(local.functions[1].env == EnvKind::Stack);
+  CHECK(local.functions[1].env_size == 8);
+  CHECK(local.stats.stack_bytes == 8);
+
+  const auto once = convert(join("once", R"("y")"));
+  CHECK(once.functions[1].env == EnvKind::SingleUse);
+  CHECK(once.functions[1].captures[0].kind == CaptureKind::Copy);
+  CHECK(once.stats.single_use_bytes == 8);
+
+  // unique value is moved into environment
+  const auto moved = convert(join("once", R"(["y","unique"])"), true);
+  CHECK(moved.functions[1].captures[0].name == "y");
+  CHECK(moved.functions[1].captures[0].kind == CaptureKind::Move);
+  CHECK(moved.stats.moved == 1);
+}
+
+TEST(closure_nested_lambdas_capture_outer_names) {
+  // let y = 1 in (\x -> (\z -> + z y) x) 2
+  const auto program = convert(
+      R"(["let","y",1,["call",["lambda",["x"],)"
+      R"(["call",["lambda",["z"],["call","+","z","y"]],"x"]],2]])");
+
+  CHECK(pretty::to_string(*program.main) == "let y = 1 in (lambda#0 y) 2");
+  CHECK(program.functions.size() == 2);
+  CHECK(pretty::to_string(*program.functions[0].body) == "(lambda#1 y) x");
+  CHECK(program.functions[0].self_name.empty());
+  // inner lambda captures y of outer function
+  CHECK(program.functions[0].captures[0].name == "y");
+  CHECK(program.functions[1].captures[0].name == "y");
+  CHECK(program.stats.captures == 2);
+  CHECK(program.stats.heap_bytes == 16);
+}
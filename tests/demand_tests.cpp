@@ -0,0 +1,113 @@
+#include "testing.hpp"
+
+#include "demand.hpp"
+#include "generator.hpp"
+#include "pretty_printer.hpp"
+
+#include <chrono>
+
+using namespace nodes;
+
+namespace {
+
+const Let &as_let(const ExprPtr &expr) { return std::get<Let>(expr->value); }
+
+// printed type or error message, bodies of skipped lets are not checked
+std::string check(const ExprPtr &expr, bool sum_uniq,
+                  const demand::Plan *plan) {
+  return testing::check_expr(expr, {.sum_uniq = sum_uniq, .plan = plan})
+      .outcome();
+}
+
+} // namespace
+
+TEST(demand_skips_unused_bodies) {
+  // let x = + 1 2 in let y = 3 in y
+  const auto program = make_expr<Let>(
+      Arg("x"), operator_call("+", make_expr<Const>(1), make_expr<Const>(2)),
+      make_expr<Let>(Arg("y"), make_expr<Const>(3), make_expr<Var>("y")));
+
+  const auto plan = demand::plan(*program, *prelude::core(false));
+  CHECK(plan.lets == 2);
+  CHECK(plan.skipped.size() == 1);
+  CHECK(plan.skipped.contains(&as_let(program)));
+}
+
+TEST(demand_checks_dependent_bodies) {
+  // let z = 1 in let x = + z 1 in let w = (let v = z in 0) in z,
+  // bodies of x and w use checked z
+  const auto program = make_expr<Let>(
+      Arg("z"), make_expr<Const>(1),
+      make_expr<Let>(
+          Arg("x"),
+          operator_call("+", make_expr<Var>("z"), make_expr<Const>(1)),
+          make_expr<Let>(Arg("w"),
+                         make_expr<Let>(Arg("v"), make_expr<Var>("z"),
+                                        make_expr<Const>(0)),
+                         make_expr<Var>("z"))));
+
+  const auto plan = demand::plan(*program, *prelude::core(false));
+  CHECK(plan.lets == 4);
+  CHECK(plan.skipped.empty());
+}
+
+TEST(demand_checks_bodies_with_conditions) {
+  // let x = (let y = if < 1 2 then 1 else 2 in 0) in let u = 0 in 0
+  const auto condition = make_expr<Condition>(
+      operator_call("<", make_expr<Const>(1), make_expr<Const>(2)),
+      make_expr<Const>(1), make_expr<Const>(2));
+  const auto program = make_expr<Let>(
+      Arg("x"), make_expr<Let>(Arg("y"), condition, make_expr<Const>(0)),
+      make_expr<Let>(Arg("u"), make_expr<Const>(0), make_expr<Const>(0)));
+
+  const auto plan = demand::plan(*program, *prelude::core(false));
+  CHECK(plan.lets == 3);
+  CHECK(plan.skipped.size() == 1);
+  CHECK(plan.skipped.contains(&as_let(as_let(program).where)));
+}
+
+TEST(demand_check_matches_full_check) {
+  size_t skipped = 0;
+  for (uint64_t seed = 1; seed <= 40; ++seed) {
+    gen::Options options;
+    options.seed = seed;
+    options.condition_nesting = seed % 3;
+    options.sum_uniq = seed % 2 == 0;
+    gen::Generator generator(options);
+
+    for (size_t i = 0; i < 5; ++i) {
+      const auto program = generator.program();
+      const auto plan =
+          demand::plan(*program, *prelude::core(options.sum_uniq));
+      CHECK(check(program, options.sum_uniq, &plan) ==
+            check(program, options.sum_uniq, nullptr));
+      skipped += plan.skipped.size();
+    }
+  }
+  CHECK(skipped != 0);
+}
+
+TEST(demand_handles_deep_nesting) {
+  // let t = 1 in let a = (if < t 1 then (let a = ... in a) else t) in a,
+  // each level has condition and use of t, so all bodies are checked
+  constexpr size_t depth = 20000;
+  ExprPtr program = make_expr<Var>("t");
+  for (size_t i = 0; i < depth; ++i) {
+    program = make_expr<Let>(
+        Arg("a"),
+        make_expr<Condition>(
+            operator_call("<", make_expr<Var>("t"), make_expr<Const>(1)),
+            program, make_expr<Var>("t")),
+        make_expr<Var>("a"));
+  }
+  program = make_expr<Let>(Arg("t"), make_expr<Const>(1), program);
+
+  const auto begin = std::chrono::steady_clock::now();
+  const auto plan = demand::plan(*program, *prelude::core(false));
+  const auto elapsed = std::chrono::steady_clock::now() - begin;
+
+  CHECK(plan.lets == depth + 1);
+  CHECK(plan.skipped.empty());
+  // marking every enclosing level per use was quadratic in depth
+  CHECK(elapsed < std::chrono::seconds(5));
+}
@@ -0,0 +1,138 @@
+#include "testing.hpp"
+
+#include "eval.hpp"
+#include "fold.hpp"
+#include "generator.hpp"
+#include "pretty_printer.hpp"
+#include "program_io.hpp"
+
+namespace {
+
+struct Folded {
+  fold::Stats stats;
+  std::string text;         // printed simplified program
+  std::string value;        // value of original program
+  std::string folded_value; // value of simplified program
+  std::string error;        // error of check of simplified program
+};
+
+// checks and evaluates program before and after folding
+Folded fold_program(const nodes::ExprPtr &expr, bool sum_uniq = false) {
+  const auto checked = testing::check_expr(expr, {.sum_uniq = sum_uniq});
+  CHECK(checked.error.empty());
+  const auto &type_state = checked.types;
+
+  const eval::Options sequential{.threads = 1};
+  Folded result;
+  result.value = eval::to_string(eval::evaluate(
+      *expr, type_state.type_storage, type_state.node_types, sequential));
+
+  nodes::ExprPtr folded = expr;
+  result.stats =
+      fold::simplify(folded, type_state.type_storage, type_state.node_types);
+  result.text = pretty::to_string(*folded);
+
+  const auto refolded = testing::check_expr(folded, {.sum_uniq = sum_uniq});
+  result.error = refolded.error;
+  if (result.error.empty()) {
+    result.folded_value = eval::to_string(
+        eval::evaluate(*folded, refolded.types.type_storage,
+                       refolded.types.node_types, sequential));
+  }
+  return result;
+}
+
+// program in JSON encoding (program_io.hpp)
+Folded fold_program(const std::string &text, bool sum_uniq = false) {
+  return fold_program(program_io::expr_from_json(json::parse(text)),
+                      sum_uniq);
+}
+
+} // namespace
+
+TEST(fold_computes_builtin_calls) {
+  const auto folded =
+      fold_program(R"(["call","+",["call","*",2,3],["call","-",1,4]])");
+  CHECK(folded.text == "3");
+  CHECK(folded.stats.calls == 3);
+  CHECK(folded.value == "3");
+}
+
+TEST(fold_wraps_around_as_evaluator) {
+  const auto folded = fold_program(R"(["call","*",65536,65536])");
+  CHECK(folded.text == "0");
+  CHECK(folded.value == "0");
+  CHECK(folded.folded_value == "0");
+}
+
+TEST(fold_inlines_aliases) {
+  // let x = 5 in let f = \y -> let z = y in + z z in f x
+  const auto folded = fold_program(
+      R"(["let","x",5,["let","f",["lambda",["y"],)"
+      R"(["let","z","y",["call","+","z","z"]]],["call","f","x"]]])");
+  CHECK(folded.text == "let f = \\y -> + y y in f 5");
+  CHECK(folded.stats.lets == 2);
+  CHECK(folded.error.empty());
+  CHECK(folded.folded_value == folded.value);
+}
+
+TEST(fold_keeps_alias_of_shadowed_name) {
+  // let f = \y -> let x = y in let y = 1 in + x y in f 2
+  const auto folded = fold_program(
+      R"(["let","f",["lambda",["y"],["let","x","y",)"
+      R"(["let","y",1,["call","+","x","y"]]]],["call","f",2]])");
+  CHECK(folded.text == "let f = \\y -> let x = y in + x 1 in f 2");
+  CHECK(folded.stats.lets == 1);
+  CHECK(folded.value == "3");
+  CHECK(folded.folded_value == "3");
+}
+
+TEST(fold_skips_redefined_builtins) {
+  // let + = \a b -> - a b in + 5 3
+  const auto folded = fold_program(
+      R"(["let","+",["lambda",["a","b"],["call","-","a","b"]],)"
+      R"(["call","+",5,3]])");
+  CHECK(folded.stats.calls == 0);
+  CHECK(folded.value == "2");
+  CHECK(folded.folded_value == "2");
+}
+
+TEST(fold_inlines_unique_alias_used_once) {
+  // let f = \y<unique> -> let x<unique> = y in + x 1 in f 2
+  const auto folded = fold_program(
+      R"(["let","f",["lambda",[["y","unique"]],)"
+      R"(["let",["x","unique"],"y",["call","+","x",1]]],)"
+      R"(["call","f",2]])",
+      true);
+  CHECK(folded.text == "let f = \\y<unique> -> + y 1 in f 2");
+  CHECK(folded.stats.lets == 1);
+  CHECK(folded.error.empty());
+  CHECK(folded.folded_value == "3");
+}
+
+TEST(fold_replaces_decided_conditions) {
+  // if < 1 2 then (if == 1 2 then 10 else + 10 10) else 30
+  const auto folded = fold_program(
+      R"(["if",["call","<",1,2],["if",["call","==",1,2],10,)"
+      R"(["call","+",10,10]],30])");
+  CHECK(folded.text == "20");
+  CHECK(folded.stats.branches == 2);
+  CHECK(folded.stats.calls == 1);
+  CHECK(folded.value == "20");
+}
+
+TEST(fold_keeps_generated_programs_values) {
+  gen::Options options;
+  options.seed = 11;
+  options.condition_nesting = 3;
+  gen::Generator generator(options);
+
+  size_t changed = 0;
+  for (size_t i = 0; i < 100; ++i) {
+    const auto folded = fold_program(generator.program());
+    CHECK(folded.error.empty());
+    CHECK(folded.folded_value == folded.value);
+    changed += folded.stats.changed();
+  }
+  CHECK(changed != 0);
+}
@@ -0,0 +1,88 @@
+#include "testing.hpp"
+
+#include "generator.hpp"
+#include "pretty_printer.hpp"
+#include "program_io.hpp"
+
+using testing::field;
+
+namespace {
+
+std::vector<std::string> printed_programs(gen::Options options, size_t count) {
+  gen::Generator generator(options);
+  std::vector<std::string> result;
+  for (size_t i = 0; i < count; ++i) {
+    result.push_back(pretty::to_string(*generator.program()));
+  }
+  return result;
+}
+
+} // namespace
+
+TEST(generator_is_deterministic) {
+  gen::Options options;
+  options.seed = 17;
+  const auto first = printed_programs(options, 20);
+  CHECK(printed_programs(options, 20) == first);
+
+  options.seed = 18;
+  CHECK(printed_programs(options, 20) != first);
+}
+
+TEST(generated_programs_are_correct) {
+  for (const bool sum_uniq : {false, true}) {
+    gen::Options options;
+    options.seed = 5;
+    options.unique_density = 0.5;
+    options.sum_uniq = sum_uniq;
+    gen::Generator generator(options);
+    for (size_t i = 0; i < 100; ++i) {
+      CHECK(testing::check_program(generator.program(), sum_uniq).empty());
+    }
+  }
+}
+
+TEST(generated_errors_are_mode_errors) {
+  gen::Options options;
+  options.seed = 9;
+  options.error_rate = 0.5;
+  gen::Generator generator(options);
+
+  size_t injected = 0;
+  for (size_t i = 0; i < 100; ++i) {
+    bool error = false;
+    const auto program = generator.program(&error);
+    const auto message = testing::check_program(program);
+    CHECK(message.empty() == not error);
+    CHECK(not error or message.starts_with("UNIQUE for e"));
+    injected += error;
+  }
+  CHECK(injected != 0);
+}
+
+TEST(generated_declarations_are_correct_in_stream) {
+  gen::Options options;
+  options.seed = 3;
+  options.visible_declarations = 8;
+  gen::Generator generator(options);
+
+  std::vector<std::string> lines;
+  for (size_t i = 0; i < 100; ++i) {
+    const auto declaration = generator.declaration();
+    pretty::Buffer out;
+    out.append("[\"let\",");
+    program_io::print_arg_json(out, declaration.name);
+    out.append(',');
+    program_io::print_json(out, *declaration.body);
+    out.append(']');
+    lines.push_back(out.str());
+  }
+
+  const auto responses = testing::stream(lines);
+  CHECK(responses.size() == lines.size() + 1);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    CHECK(field(responses[i], "status").as_string() == "ok");
+  }
+  CHECK(field(responses.back(), "declarations").as_number() == 100);
+  CHECK(field(responses.back(), "errors").as_number() == 0);
+}
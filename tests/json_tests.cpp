@@ -0,0 +1,101 @@
+#include "testing.hpp"
+
+#include "program_io.hpp"
+
+using testing::field;
+
+namespace {
+
+constexpr size_t DEEP = 50000; // recursive reader crashed at 20k
+
+std::string repeat(std::string_view part, size_t count) {
+  std::string result;
+  result.reserve(part.size() * count);
+  for (size_t i = 0; i < count; ++i) {
+    result += part;
+  }
+  return result;
+}
+
+// let x = 1 in .. let x = 1 in x
+std::string deep_let_chain(size_t depth) {
+  return repeat(R"(["let","x",1,)", depth) + R"("x")" + repeat("]", depth);
+}
+
+} // namespace
+
+TEST(json_round_trip) {
+  const std::string text =
+      R"({"a":[1,-25,"s\"\n",true,false,null],"b":{},"c":[[]]})";
+  CHECK(json::dump(json::parse(text)) == text);
+  CHECK(json::dump(json::parse(" [ 1 , { \"k\" : [ ] } ] ")) ==
+        R"([1,{"k":[]}])");
+}
+
+TEST(json_rejects_malformed_input) {
+  for (const char *text : {"", "[1,", "[1 2]", "{\"a\" 1}", "{1:2}", "tru",
+                           "\"abc", "[1]]", "1e999", "--1"}) {
+    bool failed = false;
+    try {
+      json::parse(text);
+    } catch (utils::Error) {
+      failed = true;
+    }
+    CHECK(failed);
+  }
+}
+
+TEST(json_handles_deep_nesting) {
+  const std::string text = repeat("[", DEEP) + repeat("]", DEEP);
+  json::Value value = json::parse(text);
+  CHECK(json::dump(value) == text);
+
+  json::Value copy = std::move(value);
+  value = json::parse(repeat(R"({"k":)", DEEP) + "0" + repeat("}", DEEP));
+  CHECK(json::dump(value).size() == DEEP * 6 + 1);
+}
+
+TEST(program_io_reads_deep_programs) {
+  const auto expr =
+      program_io::expr_from_json(json::parse(deep_let_chain(DEEP)));
+  CHECK(testing::check_program(expr).empty());
+
+  pretty::Buffer out;
+  program_io::print_json(out, *expr);
+  CHECK(out.str() == deep_let_chain(DEEP));
+}
+
+TEST(program_io_rejects_wrong_constants) {
+  for (const char *text : {"1.5", "1e300", "-2147483649", "[\"call\",\"+\",1,0.1]"}) {
+    bool failed = false;
+    try {
+      program_io::expr_from_json(json::parse(text));
+    } catch (utils::Error error) {
+      failed = error.message == "JSON_NOT_INTEGER";
+    }
+    CHECK(failed);
+  }
+  CHECK(std::get<nodes::Const>(
+            program_io::expr_from_json(json::parse("-2147483648"))->value)
+            .value == -2147483648LL);
+}
+
+TEST(serve_and_stream_check_deep_programs) {
+  server::Options options;
+  options.threads = 1;
+  const auto responses = testing::serve(
+      {R"({"id":1,"op":"check","program":)" + deep_let_chain(DEEP) + "}",
+       R"({"id":2,"op":"check","program":)" +
+           repeat(R"(["call","-",)", DEEP) + "1" + repeat(",1]", DEEP) + "}"},
+      options);
+  CHECK(responses.size() == 2);
+  for (const auto &response : responses) {
+    CHECK(field(response, "status").as_string() == "ok");
+  }
+
+  const auto lines = testing::stream(
+      {R"(["let","y",)" + deep_let_chain(DEEP) + "]", R"(["call","+","y",1])"});
+  CHECK(lines.size() == 3);
+  CHECK(field(lines[0], "status").as_string() == "ok");
+  CHECK(field(lines[1], "status").as_string() == "ok");
+}
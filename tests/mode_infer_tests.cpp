@@ -0,0 +1,86 @@
+#include "testing.hpp"
+
+#include "generator.hpp"
+#include "mode_infer.hpp"
+
+using namespace nodes;
+using types::Mode;
+
+namespace {
+
+// mode check after inference
+testing::Checked infer(const ExprPtr &expr, bool sum_uniq) {
+  return testing::check_expr(expr,
+                             {.sum_uniq = sum_uniq, .infer_modes = true});
+}
+
+Mode mode_of(const testing::Checked &checked, NodeId id) {
+  return checked.types.type_storage.mode(checked.types.node_types.get(id));
+}
+
+} // namespace
+
+TEST(infer_binding_used_once_as_unique) {
+  // let x = 1 in + x 2
+  Arg x("x");
+  const NodeId id = x.id;
+  const auto program = make_expr<Let>(
+      x, make_expr<Const>(1),
+      operator_call("+", make_expr<Var>("x"), make_expr<Const>(2)));
+
+  const auto checked = infer(program, true);
+  CHECK(checked.error.empty());
+  CHECK(checked.inferred.bindings == 1);
+  CHECK(checked.inferred.refined == 1);
+  CHECK(mode_of(checked, id).uniq == Mode::Uniq::UNIQUE);
+}
+
+TEST(infer_binding_used_twice_as_shared) {
+  // let x = 1 in + x x
+  Arg x("x");
+  const NodeId id = x.id;
+  const auto program = make_expr<Let>(
+      x, make_expr<Const>(1),
+      operator_call("+", make_expr<Var>("x"), make_expr<Var>("x")));
+
+  const auto checked = infer(program, true);
+  CHECK(checked.error.empty());
+  CHECK(mode_of(checked, id).uniq == Mode::Uniq::SHARED);
+  CHECK(mode_of(checked, id).lin == Mode::Lin::MANY);
+}
+
+TEST(infer_keeps_default_for_results) {
+  // let y<unique> = 1 in let x = 2 in x, x is program result
+  Arg y = with_unique_hint(Arg("y"));
+  Arg x("x");
+  const auto program = make_expr<Let>(
+      y, make_expr<Const>(1),
+      make_expr<Let>(x, make_expr<Const>(2), make_expr<Var>("x")));
+
+  const auto checked = infer(program, false);
+  CHECK(checked.error.empty());
+  CHECK(checked.inferred.bindings == 1);
+  CHECK(checked.inferred.refined == 0);
+  CHECK(mode_of(checked, y.id).uniq == Mode::Uniq::UNIQUE);
+  CHECK(mode_of(checked, x.id) == Mode());
+}
+
+TEST(inferred_programs_still_check) {
+  size_t refined = 0;
+  for (uint64_t seed = 1; seed <= 40; ++seed) {
+    gen::Options options;
+    options.seed = seed;
+    options.error_rate = 0.2;
+    options.sum_uniq = seed % 2 == 0;
+    gen::Generator generator(options);
+
+    for (size_t i = 0; i < 5; ++i) {
+      bool injected = false;
+      const auto program = generator.program(&injected);
+      const auto checked = infer(program, options.sum_uniq);
+      CHECK(checked.error.empty() != injected);
+      refined += checked.inferred.refined;
+    }
+  }
+  CHECK(refined != 0);
+}
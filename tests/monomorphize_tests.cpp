@@ -0,0 +1,147 @@
+#include "testing.hpp"
+
+#include "generator.hpp"
+#include "monomorphize.hpp"
+#include "program_io.hpp"
+
+using namespace nodes;
+using testing::field;
+
+namespace {
+
+struct Specialized {
+  mono::Stats stats;
+  std::string text;  // printed specialized program
+  std::string error; // of check of specialized program
+};
+
+Specialized specialize(ExprPtr expr, bool sum_uniq = false) {
+  const auto checked = testing::check_expr(expr, {.sum_uniq = sum_uniq});
+  CHECK(checked.error.empty());
+
+  Specialized result;
+  result.stats = mono::specialize(expr, checked.types.type_storage,
+                                  checked.types.node_types);
+  result.text = pretty::to_string(*expr);
+  result.error = testing::check_program(expr, sum_uniq);
+  return result;
+}
+
+std::string request(size_t id, const ExprPtr &program, bool sum_uniq) {
+  pretty::Buffer out;
+  out.append(R"({"id":)" + std::to_string(id) + R"(,"op":"check",)");
+  out.append(sum_uniq ? R"("sum_uniq":true,)" : "");
+  out.append(R"("program":)");
+  program_io::print_json(out, *program);
+  out.append('}');
+  return out.str();
+}
+
+// let f = \x<unique> -> 0 in let r = f 2 in let g = \y<unique> -> f y in r
+ExprPtr sites_with_two_instantiations() {
+  const auto g = lambda1(
+      with_unique_hint(Arg("y")),
+      make_expr<Call>(make_expr<Var>("f"), ExprPtrV{make_expr<Var>("y")}));
+  return make_expr<Let>(
+      Arg("f"), lambda1(with_unique_hint(Arg("x")), make_expr<Const>(0)),
+      make_expr<Let>(
+          Arg("r"),
+          make_expr<Call>(make_expr<Var>("f"), ExprPtrV{make_expr<Const>(2)}),
+          make_expr<Let>(Arg("g"), g, make_expr<Var>("r"))));
+}
+
+} // namespace
+
+TEST(mono_specializes_in_place_when_sites_agree) {
+  // let f = \x<unique> -> 0 in + (f 1) (f 2)
+  const auto program = make_expr<Let>(
+      Arg("f"), lambda1(with_unique_hint(Arg("x")), make_expr<Const>(0)),
+      operator_call("+",
+                    make_expr<Call>(make_expr<Var>("f"),
+                                    ExprPtrV{make_expr<Const>(1)}),
+                    make_expr<Call>(make_expr<Var>("f"),
+                                    ExprPtrV{make_expr<Const>(2)})));
+
+  const auto result = specialize(program);
+  CHECK(result.stats.in_place == 1);
+  CHECK(result.stats.variants == 0);
+  CHECK(result.text == "let f = \\x -> 0 in + (f 1) (f 2)");
+  CHECK(result.error.empty());
+}
+
+TEST(mono_copies_when_sites_differ) {
+  // site in g is not called, but f is not changed in place for first site
+  const auto result = specialize(sites_with_two_instantiations());
+  CHECK(result.stats.in_place == 0);
+  CHECK(result.stats.variants == 1);
+  CHECK(result.stats.sites == 1);
+  CHECK(result.text == "let f#0 = \\x -> 0 in let f = \\x<unique> -> 0 in "
+                       "let r = f#0 2 in let g = \\y<unique> -> f y in r");
+  CHECK(result.error.empty());
+}
+
+TEST(mono_returns_specialized_program) {
+  const auto program = sites_with_two_instantiations();
+
+  server::Options server_options;
+  server_options.threads = 1;
+  server_options.monomorphize = true;
+  const auto responses =
+      testing::serve({request(1, program, false)}, server_options);
+  CHECK(field(responses[0], "variants").as_number() == 1);
+  const auto specialized =
+      program_io::expr_from_json(field(responses[0], "specialized"));
+  CHECK(pretty::to_string(*specialized) ==
+        "let f#0 = \\x -> 0 in let f = \\x<unique> -> 0 in "
+        "let r = f#0 2 in let g = \\y<unique> -> f y in r");
+  CHECK(testing::check_program(specialized).empty());
+}
+
+TEST(mono_keeps_program_rejected_by_check) {
+  // generated program, where raised hint of f10 param reaches unique param
+  // of f6 through resolved generic
+  gen::Options options;
+  options.seed = 199;
+  options.depth = 4;
+  options.width = 2;
+  options.sum_uniq = true;
+  const auto program = gen::Generator(options).program();
+
+  server::Options server_options;
+  server_options.threads = 1;
+  server_options.monomorphize = true;
+  const auto responses =
+      testing::serve({request(1, program, options.sum_uniq)}, server_options);
+  CHECK(field(responses[0], "status").as_string() == "ok");
+  CHECK(field(responses[0], "variants").is_number());
+  CHECK(testing::check_program(program_io::expr_from_json(field(
+                                   responses[0], "specialized")),
+                               options.sum_uniq)
+            .empty());
+}
+
+TEST(mono_accepts_generated_programs) {
+  std::vector<std::string> requests;
+  for (uint64_t seed = 1; seed <= 30; ++seed) {
+    gen::Options options;
+    options.seed = seed;
+    options.depth = 4 + seed % 3;
+    options.sum_uniq = seed % 2 == 0;
+    gen::Generator generator(options);
+    for (size_t i = 0; i < 10; ++i) {
+      requests.push_back(
+          request(requests.size(), generator.program(), options.sum_uniq));
+    }
+  }
+
+  server::Options options;
+  options.threads = 1;
+  options.monomorphize = true;
+  for (const auto &response : testing::serve(requests, options)) {
+    CHECK(field(response, "status").as_string() == "ok");
+  }
+  options.fold = true;
+  for (const auto &response : testing::serve(requests, options)) {
+    CHECK(field(response, "status").as_string() == "ok");
+  }
+}
@@ -0,0 +1,109 @@
+#include "testing.hpp"
+
+#include "prelude.hpp"
+
+using namespace nodes;
+
+namespace {
+
+// type and mode check with prelude of given declarations, error message or
+// empty
+std::string check_with(std::string_view declarations, const ExprPtr &expr) {
+  prelude::Builder builder;
+  builder.load(declarations);
+  return testing::check_expr(expr, {.prelude = builder.freeze()}).error;
+}
+
+ExprPtr call1(std::string func, ExprPtr arg) {
+  return make_expr<Call>(make_expr<Var>(std::move(func)), ExprPtrV{arg});
+}
+
+} // namespace
+
+TEST(prelude_generic_is_instantiated_per_use) {
+  constexpr std::string_view declarations = R"(
+id : 'a -> 'a
+< : int -> int -> bool
+)";
+  const auto bool_value =
+      operator_call("<", make_expr<Const>(1), make_expr<Const>(2));
+
+  // int use first, then bool use of the same declaration
+  const auto program = make_expr<Let>(
+      Arg("x"), call1("id", make_expr<Const>(1)),
+      make_expr<Condition>(call1("id", bool_value), make_expr<Var>("x"),
+                           make_expr<Const>(0)));
+  CHECK(check_with(declarations, program).empty());
+
+  // generic is still shared inside one use
+  const auto wrong = make_expr<Condition>(call1("id", make_expr<Const>(1)),
+                                          make_expr<Const>(1),
+                                          make_expr<Const>(0));
+  CHECK(not check_with(declarations, wrong).empty());
+}
+
+TEST(prelude_moded_generic_keeps_its_uses_linked) {
+  constexpr std::string_view declarations = R"(
+same : ('a)<unique> -> 'a -> int
+< : int -> int -> bool
+)";
+  const auto bool_value =
+      operator_call("<", make_expr<Const>(1), make_expr<Const>(2));
+  const auto same = [](ExprPtr left, ExprPtr right) {
+    return make_expr<Call>(make_expr<Var>("same"), ExprPtrV{left, right});
+  };
+
+  CHECK(check_with(declarations,
+                   same(make_expr<Const>(1), make_expr<Const>(2)))
+            .empty());
+  CHECK(check_with(declarations, same(make_expr<Const>(1), bool_value)) ==
+        "DIFFERENT_TYPES_OR_MODES");
+
+  prelude::Builder builder;
+  std::map<std::string, types::TypeID> generics;
+  builder.parse_type("('a)<unique> -> 'a", generics);
+  const auto prelude = builder.freeze();
+  CHECK(generics.size() == 1);
+  CHECK(prelude->storage->mode(generics["a"]).uniq ==
+        types::Mode::Uniq::UNIQUE);
+}
+
+TEST(prelude_is_shared_between_checks) {
+  const auto prelude = prelude::core(false);
+  const size_t base_size = prelude->storage->size();
+
+  for (int i = 0; i < 2; ++i) {
+    CHECK(testing::check_program(
+              operator_call("+", make_expr<Const>(i), make_expr<Const>(1)))
+              .empty());
+  }
+  CHECK(prelude->storage->size() == base_size);
+  CHECK(prelude::core(false) == prelude);
+  CHECK(prelude::core(true) != prelude);
+}
+
+TEST(prelude_sum_uniq_accepts_unique_operands) {
+  const auto program = make_expr<Let>(
+      with_unique_hint(Arg("x")), make_expr<Const>(1),
+      operator_call("+", make_expr<Var>("x"), make_expr<Const>(2)));
+
+  CHECK(testing::check_program(program, true).empty());
+  CHECK(not testing::check_program(program, false).empty());
+}
+
+TEST(prelude_reports_declaration_errors) {
+  const auto load = [](std::string_view declarations) {
+    prelude::Builder builder;
+    try {
+      builder.load(declarations);
+    } catch (utils::Error error) {
+      return error.message;
+    }
+    return std::string();
+  };
+
+  CHECK(load("f : int -> int\n# comment\n").empty());
+  CHECK(load("f int").starts_with("NO_DECL_SEPARATOR"));
+  CHECK(load("f : list").starts_with("UNKNOWN_TYPE"));
+  CHECK(load("f : int<big>").starts_with("UNKNOWN_MODE"));
+}
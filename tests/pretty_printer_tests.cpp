@@ -0,0 +1,86 @@
+#include "testing.hpp"
+
+#include "pretty_printer.hpp"
+#include "prelude.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace nodes;
+
+TEST(pretty_prints_expressions) {
+  const auto program = make_expr<Let>(
+      Arg("f"),
+      lambda1(with_unique_hint(Arg("x")),
+              operator_call("+", make_expr<Var>("x"), make_expr<Const>(1))),
+      make_expr<Condition>(
+          operator_call("<", make_expr<Const>(1), make_expr<Const>(2)),
+          make_expr<Call>(make_expr<Var>("f"), ExprPtrV{make_expr<Const>(3)}),
+          make_expr<Const>(4)));
+
+  CHECK(pretty::to_string(*program) ==
+        "let f = \\x<unique> -> + x 1 in if < 1 2 then f 3 else 4");
+}
+
+TEST(pretty_prints_prelude_types) {
+  const auto prelude = prelude::core(true);
+  const auto type = prelude->types->find_var_type("+");
+  CHECK(type.has_value());
+  CHECK(pretty::to_string(*prelude->storage, *type) ==
+        "int<unique> -> int<unique> -> int");
+}
+
+TEST(pretty_prints_deep_trees) {
+  constexpr size_t depth = 200000;
+  ExprPtr program = make_expr<Const>(0);
+  for (size_t i = 0; i < depth; ++i) {
+    program = make_expr<Let>(Arg("x"), make_expr<Const>(1), program);
+  }
+
+  const std::string text = pretty::to_string(*program);
+  CHECK(text.starts_with("let x = 1 in let x = 1 in "));
+  CHECK(text.ends_with(" in 0"));
+  CHECK(text.size() == depth * std::string_view("let x = 1 in ").size() + 1);
+}
+
+TEST(pretty_cuts_by_depth_and_width) {
+  ExprPtr program = make_expr<Const>(0);
+  for (size_t i = 0; i < 10; ++i) {
+    program = make_expr<Let>(Arg("x"), make_expr<Const>(1), program);
+  }
+
+  pretty::Options deep_options;
+  deep_options.max_depth = 2;
+  const std::string shallow = pretty::to_string(*program, deep_options);
+  CHECK(shallow.ends_with("..."));
+  CHECK(shallow.size() < pretty::to_string(*program).size());
+
+  pretty::Options wide_options;
+  wide_options.max_width = 20;
+  const std::string narrow = pretty::to_string(*program, wide_options);
+  // cut after the item that crosses the width
+  CHECK(narrow.size() >= 23 and narrow.size() < 30);
+  CHECK(narrow.ends_with("..."));
+}
+
+TEST(pretty_buffer_reports_write_errors) {
+  const int fd = open("/dev/full", O_WRONLY);
+  if (fd < 0) {
+    return; // no such device here
+  }
+
+  {
+    pretty::Buffer out(fd, 4);
+    bool failed = false;
+    try {
+      out.append("some text");
+    } catch (utils::Error error) {
+      failed = error.message == "WRITE_FAILED";
+    }
+    CHECK(failed);
+
+    // pending data on destruction, error is dropped
+    out.append("abc");
+  }
+  close(fd);
+}
@@ -0,0 +1,166 @@
+#include "testing.hpp"
+
+#include "generator.hpp"
+#include "program_io.hpp"
+
+using testing::field;
+
+namespace {
+
+server::Options one_worker() {
+  server::Options options;
+  options.threads = 1;
+  return options;
+}
+
+// ["let", arg, body] line of stream
+std::string declaration_line(const gen::Declaration &declaration) {
+  pretty::Buffer out;
+  out.append("[\"let\",");
+  program_io::print_arg_json(out, declaration.name);
+  out.append(',');
+  program_io::print_json(out, *declaration.body);
+  out.append(']');
+  return out.str();
+}
+
+} // namespace
+
+TEST(serve_checks_program) {
+  const auto responses = testing::serve(
+      {R"({"id":1,"op":"check","program":["call","+",1,2]})",
+       R"({"id":2,"op":"check","program":["call","+",1]})",
+       R"({"id":3,"op":"check","sum_uniq":true,"program":)"
+       R"(["let",["x","unique"],1,["call","+","x","x"]]})"},
+      one_worker());
+
+  CHECK(responses.size() == 3);
+  CHECK(field(responses[0], "status").as_string() == "ok");
+  CHECK(field(responses[0], "type").as_string() == "int");
+  CHECK(field(responses[1], "stage").as_string() == "type");
+  CHECK(field(responses[2], "stage").as_string() == "mode");
+}
+
+TEST(serve_edits_stored_program) {
+  const auto responses = testing::serve(
+      {R"({"id":1,"op":"check","name":"p","program":)"
+       R"(["let","x",1,["call","+","x","x"]]})",
+       R"({"id":2,"op":"check","name":"p","program":)"
+       R"(["let","x",1,["call","+","x","x"]]})",
+       R"({"id":3,"op":"edit","name":"p","path":[1],"expr":)"
+       R"(["call","x",1]})",
+       R"({"id":4,"op":"drop","name":"p"})",
+       R"({"id":5,"op":"check_all","name":"p"})"},
+      one_worker());
+
+  CHECK(responses.size() == 5);
+  CHECK(field(responses[0], "status").as_string() == "ok");
+  CHECK(field(responses[1], "cached").is_bool());
+  CHECK(field(responses[2], "stage").as_string() == "type");
+  CHECK(field(responses[3], "status").as_string() == "ok");
+  CHECK(field(responses[4], "stage").as_string() == "request");
+}
+
+TEST(serve_rejects_malformed_requests) {
+  const auto responses = testing::serve(
+      {R"({"id":1,"op":"check","program":1e300})",
+       R"({"id":2,"op":"check","program":1.5})",
+       R"({"id":3,"op":"unknown"})",
+       R"({"id":4,"op":"check","program":["loop"]})",
+       R"({"id":5,"op":"check","name":"p","program":1})",
+       R"({"id":6,"op":"edit","name":"p","path":[-1],"expr":1})",
+       R"({"id":7,"op":"check","program":1e999})", R"({"id":8,)"},
+      one_worker());
+
+  CHECK(responses.size() == 8);
+  for (const auto &response : responses) {
+    CHECK(field(response, "status").as_string() != "ok" or
+          field(response, "id").as_number() == 5);
+  }
+  CHECK(field(responses[0], "message").as_string() == "JSON_NOT_INTEGER");
+  CHECK(field(responses[1], "message").as_string() == "JSON_NOT_INTEGER");
+  CHECK(field(responses[6], "message").as_string().starts_with(
+      "JSON_WRONG_NUMBER"));
+  CHECK(field(responses[7], "message").as_string().starts_with(
+      "JSON_UNEXPECTED_END"));
+}
+
+TEST(serve_keeps_order_for_one_name) {
+  std::vector<std::string> requests;
+  for (int i = 0; i < 40; ++i) {
+    requests.push_back(R"({"id":)" + std::to_string(2 * i) +
+                       R"(,"op":"check","name":"p)" + std::to_string(i % 4) +
+                       R"(","program":)" + std::to_string(i) + "}");
+    requests.push_back(R"({"id":)" + std::to_string(2 * i + 1) +
+                       R"(,"op":"check_all","name":"p)" +
+                       std::to_string(i % 4) + R"("})");
+  }
+
+  server::Options options;
+  options.threads = 4;
+  const auto responses = testing::serve(requests, options);
+
+  CHECK(responses.size() == requests.size());
+  for (const auto &response : responses) {
+    CHECK(field(response, "status").as_string() == "ok");
+  }
+}
+
+TEST(stream_checks_declarations) {
+  const auto responses = testing::stream(
+      {R"(["let","x",1])", R"(["call","+","x",2])",
+       R"(["let","y",["call","x",1]])", R"("y")",
+       R"(["let","x",["lambda",["a"],"a"]])", R"(["call","x",3])"},
+      one_worker());
+
+  CHECK(responses.size() == 7);
+  CHECK(field(responses[0], "name").as_string() == "x");
+  CHECK(field(responses[1], "type").as_string() == "int");
+  // failed declaration is not visible
+  CHECK(field(responses[2], "stage").as_string() == "type");
+  CHECK(field(responses[3], "message").as_string().starts_with("NO_VAR"));
+  // later declaration shadows earlier one
+  CHECK(field(responses[4], "type").as_string() == "'a -> 'a");
+  CHECK(field(responses[5], "type").as_string() == "int");
+
+  const auto &totals = responses.back();
+  CHECK(field(totals, "status").as_string() == "done");
+  CHECK(field(totals, "declarations").as_number() == 3);
+  CHECK(field(totals, "errors").as_number() == 2);
+}
+
+TEST(stream_compacts_types) {
+  gen::Options generator_options;
+  generator_options.error_rate = 0.1;
+  gen::Generator generator(generator_options);
+
+  std::vector<std::string> lines;
+  size_t injected = 0;
+  for (size_t i = 0; i < 300; ++i) {
+    const auto declaration = generator.declaration();
+    lines.push_back(declaration_line(declaration));
+    injected += declaration.error;
+  }
+
+  auto options = one_worker();
+  const auto full = testing::stream(lines, options);
+  options.compact_types = 64;
+  const auto compacted = testing::stream(lines, options);
+
+  CHECK(compacted.size() == lines.size() + 1);
+  CHECK(full.size() == compacted.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    CHECK(field(compacted[i], "status").as_string() ==
+          field(full[i], "status").as_string());
+    CHECK(field(compacted[i], "type").as_string() ==
+          field(full[i], "type").as_string());
+  }
+
+  const auto &totals = compacted.back();
+  CHECK(injected != 0);
+  CHECK(field(totals, "errors").as_number() == injected);
+  CHECK(field(totals, "compactions").as_number() >
+        field(full.back(), "compactions").as_number());
+  CHECK(field(totals, "types").as_number() <
+        field(full.back(), "types").as_number());
+}
@@ -0,0 +1,120 @@
+#include "testing.hpp"
+
+#include "eval.hpp"
+#include "generator.hpp"
+#include "task_pool.hpp"
+
+#include <chrono>
+#include <ctime>
+
+namespace {
+
+// fork-join sum of [begin, end), nested deeper than helping limit
+uint64_t sum(task_pool::Pool &pool, uint64_t begin, uint64_t end) {
+  if (end - begin <= 4) {
+    uint64_t result = 0;
+    for (uint64_t i = begin; i < end; ++i) {
+      result += i;
+    }
+    return result;
+  }
+
+  const uint64_t middle = begin + (end - begin) / 2;
+  uint64_t left = 0;
+  task_pool::Group group;
+  pool.spawn(group, [&] { left = sum(pool, begin, middle); });
+  const uint64_t right = sum(pool, middle, end);
+  pool.wait(group);
+  return left + right;
+}
+
+// printed value of program or error message
+std::string evaluate(const nodes::ExprPtr &expr, bool sum_uniq,
+                     const eval::Options &options, eval::Stats *stats) {
+  const auto checked = testing::check_expr(expr, {.sum_uniq = sum_uniq});
+  CHECK(checked.error.empty());
+  try {
+    return eval::to_string(eval::evaluate(*expr, checked.types.type_storage,
+                                          checked.types.node_types, options,
+                                          stats));
+  } catch (utils::Error error) {
+    return "error: " + error.message;
+  }
+}
+
+} // namespace
+
+TEST(task_pool_joins_nested_groups) {
+  for (size_t threads : {1, 2, 4}) {
+    task_pool::Pool pool(threads);
+    CHECK(pool.threads() == threads);
+    constexpr uint64_t count = 1 << 14;
+    CHECK(sum(pool, 0, count) == count * (count - 1) / 2);
+  }
+}
+
+TEST(task_pool_rethrows_task_error) {
+  task_pool::Pool pool(2);
+  task_pool::Group group;
+  for (int i = 0; i < 8; ++i) {
+    pool.spawn(group, [i] {
+      if (i == 3) {
+        utils::throw_error("TASK_FAILED");
+      }
+    });
+  }
+
+  bool thrown = false;
+  try {
+    pool.wait(group);
+  } catch (utils::Error error) {
+    thrown = error.message == "TASK_FAILED";
+  }
+  CHECK(thrown);
+  CHECK(group.finished());
+}
+
+TEST(task_pool_wait_blocks_without_tasks) {
+  task_pool::Pool pool(2);
+  task_pool::Group group;
+  std::atomic<bool> started = false;
+  pool.spawn(group, [&started] {
+    started = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  });
+  while (not started) {
+    std::this_thread::yield();
+  }
+
+  // worker sleeps in task, waiting thread has nothing to run
+  const std::clock_t begin = std::clock();
+  pool.wait(group);
+  const double cpu_ms =
+      1000.0 * static_cast<double>(std::clock() - begin) / CLOCKS_PER_SEC;
+  CHECK(cpu_ms < 150);
+}
+
+TEST(parallel_eval_matches_sequential) {
+  size_t tasks = 0;
+  for (uint64_t seed = 1; seed <= 30; ++seed) {
+    gen::Options options;
+    options.seed = seed;
+    options.depth = 4 + seed % 3;
+    options.sum_uniq = seed % 2 == 0;
+    gen::Generator generator(options);
+
+    for (size_t i = 0; i < 4; ++i) {
+      const auto program = generator.program();
+      const auto sequential = evaluate(program, options.sum_uniq,
+                                       eval::Options{.threads = 1}, nullptr);
+
+      eval::Stats stats;
+      const auto parallel = evaluate(
+          program, options.sum_uniq,
+          eval::Options{.threads = 4, .min_parallel_size = 8}, &stats);
+      CHECK(parallel == sequential);
+      tasks += stats.tasks;
+    }
+  }
+  CHECK(tasks != 0);
+}
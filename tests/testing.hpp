@@ -0,0 +1,93 @@
+#pragma once
+
+#include "demand.hpp"
+#include "json.hpp"
+#include "mode_infer.hpp"
+#include "parsing_tree.hpp"
+#include "server.hpp"
+
+#include <source_location>
+#include <string>
+#include <vector>
+
+// Minimal test registry, all tests are linked into lang_tests:
+//
+//   TEST(let_is_checked) {
+//     CHECK(check_program(program).empty());
+//   }
+//
+// failed checks are reported with location and don't stop the test, test
+// is also failed by uncaught utils::Error. `lang_tests <part>` runs only
+// tests with names containing part.
+namespace testing {
+
+struct Case {
+  const char *name;
+  void (*run)();
+};
+
+std::vector<Case> &cases();
+
+struct Registration {
+  Registration(const char *name, void (*run)()) {
+    cases().push_back(Case{name, run});
+  }
+};
+
+void check(bool ok, const char *expression,
+           std::source_location location = std::source_location::current());
+
+enum class Checker { Recursive, Iterative, Batch };
+
+struct CheckOptions {
+  bool sum_uniq = false;
+  Checker checker = Checker::Iterative;
+  // prelude::core(sum_uniq) if null
+  std::shared_ptr<const prelude::Prelude> prelude = nullptr;
+  const demand::Plan *plan = nullptr; // bodies of skipped lets not checked
+  bool infer_modes = false;           // mode_infer runs before mode check
+};
+
+struct Checked {
+  explicit Checked(std::shared_ptr<const prelude::Prelude> prelude)
+      : prelude(std::move(prelude)),
+        types(this->prelude->storage, this->prelude->types) {}
+
+  std::shared_ptr<const prelude::Prelude> prelude;
+  type_check::State types; // node types of program, if type check passed
+  types::TypeID type;      // of program, invalid after type error
+  mode_infer::Stats inferred;
+  std::string stage; // of error: "type", "infer" or "mode"
+  std::string error; // empty if program is correct
+
+  // printed type of program, or "<stage> error: <message>"
+  std::string outcome() const;
+};
+
+// type check, optional mode inference and mode check
+Checked check_expr(const nodes::ExprPtr &expr,
+                   const CheckOptions &options = {});
+
+// type and mode check with prelude::core, empty string if program is
+// correct, error message otherwise
+std::string check_program(const nodes::ExprPtr &expr, bool sum_uniq = false);
+
+// runs server::serve on request lines, responses are ordered by "id"
+std::vector<json::Value> serve(const std::vector<std::string> &requests,
+                               server::Options options = {});
+
+// runs server::stream on lines, responses are in input order
+std::vector<json::Value> stream(const std::vector<std::string> &lines,
+                                server::Options options = {});
+
+// field of response object, null if missing
+const json::Value &field(const json::Value &response, const std::string &key);
+
+} // namespace testing
+
+#define TEST(name)                                                             \
+  static void name();                                                          \
+  static const testing::Registration name##_registration(#name, &name);        \
+  static void name()
+
+#define CHECK(...) testing::check(static_cast<bool>(__VA_ARGS__), #__VA_ARGS__)
@@ -1,14 +1,184 @@
-#include "parsing_tree.hpp"
+#include "testing.hpp"
 
+#include "constraints.hpp"
+#include "prelude.hpp"
+#include "pretty_printer.hpp"
+
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <string_view>
 
 using namespace nodes;
 
-int main() {
-  const auto program =
-      Expr(Let(Arg("f"),
-               lambda1("x", operator_call("+", make_expr<Var>("x"),
-                                          make_expr<Var>("x"))),
-               make_expr<Var>("f")));
+namespace testing {
+
+namespace {
+
+size_t failed_checks = 0;
+
+std::vector<json::Value> parse_lines(const std::string &text) {
+  std::vector<json::Value> result;
+  std::istringstream lines(text);
+  std::string line;
+  while (std::getline(lines, line)) {
+    result.push_back(json::parse(line));
+  }
+  return result;
+}
+
+std::string join_lines(const std::vector<std::string> &lines) {
+  std::string result;
+  for (const auto &line : lines) {
+    result += line;
+    result += '\n';
+  }
+  return result;
+}
+
+} // namespace
+
+std::vector<Case> &cases() {
+  static std::vector<Case> cases;
+  return cases;
+}
+
+void check(bool ok, const char *expression, std::source_location location) {
+  if (ok) {
+    return;
+  }
+  ++failed_checks;
+  std::cerr << location.file_name() << ":" << location.line()
+            << ": check failed: " << expression << "\n";
+}
+
+std::string Checked::outcome() const {
+  return error.empty() ? pretty::to_string(types.type_storage, type)
+                       : stage + " error: " + error;
+}
+
+Checked check_expr(const nodes::ExprPtr &expr, const CheckOptions &options) {
+  auto prelude = options.prelude != nullptr ? options.prelude
+                                            : prelude::core(options.sum_uniq);
+  Checked result(std::move(prelude));
+  auto &type_state = result.types;
+  const auto *skipped =
+      options.plan != nullptr ? &options.plan->skipped : nullptr;
+  type_state.skipped_lets = skipped;
+
+  result.stage = "type";
+  try {
+    switch (options.checker) {
+    case Checker::Recursive:
+      result.type = type_check::check_expr(expr, type_state);
+      break;
+    case Checker::Iterative:
+      result.type = type_check::check_expr_iterative(expr, type_state);
+      break;
+    case Checker::Batch:
+      result.type = constraints::check_expr_batch(expr, type_state);
+      break;
+    }
+
+    if (options.infer_modes) {
+      result.stage = "infer";
+      result.inferred = mode_infer::infer(expr, type_state.type_storage,
+                                          type_state.node_types, skipped);
+    }
+
+    result.stage = "mode";
+    mode_check::State mode_state(result.prelude->modes,
+                                 type_state.type_storage,
+                                 type_state.node_types);
+    mode_state.skipped_lets = skipped;
+    if (options.checker == Checker::Recursive) {
+      mode_check::check_expr(expr, mode_state);
+    } else {
+      mode_check::check_expr_iterative(expr, mode_state);
+    }
+  } catch (utils::Error error) {
+    result.error = error.message;
+    return result;
+  }
+  result.stage.clear();
+  return result;
+}
+
+std::string check_program(const nodes::ExprPtr &expr, bool sum_uniq) {
+  return check_expr(expr, {.sum_uniq = sum_uniq}).error;
+}
+
+std::vector<json::Value> serve(const std::vector<std::string> &requests,
+                               server::Options options) {
+  std::istringstream in(join_lines(requests));
+  std::ostringstream out;
+  server::serve(in, out, options);
+
+  // responses to unparsed lines have no id, they go last
+  auto order = [](const json::Value &response) {
+    const auto *id = response.find("id");
+    return id != nullptr ? id->as_number()
+                         : std::numeric_limits<double>::infinity();
+  };
+
+  auto responses = parse_lines(out.str());
+  std::stable_sort(responses.begin(), responses.end(),
+                   [&order](const json::Value &left, const json::Value &right) {
+                     return order(left) < order(right);
+                   });
+  return responses;
+}
+
+std::vector<json::Value> stream(const std::vector<std::string> &lines,
+                                server::Options options) {
+  std::istringstream in(join_lines(lines));
+  std::ostringstream out;
+  server::stream(in, out, options);
+  return parse_lines(out.str());
+}
+
+const json::Value &field(const json::Value &response, const std::string &key) {
+  static const json::Value missing;
+  const auto *value = response.find(key);
+  return value != nullptr ? *value : missing;
+}
+
+} // namespace testing
+
+TEST(lambda_with_shared_arg_is_correct) {
+  const auto program = make_expr<Let>(
+      Arg("f"),
+      lambda1("x", operator_call("+", make_expr<Var>("x"), make_expr<Var>("x"))),
+      make_expr<Call>(make_expr<Var>("f"), ExprPtrV{make_expr<Const>(1)}));
+
+  CHECK(testing::check_program(program).empty());
+}
+
+int main(int argc, char **argv) {
+  const std::string_view filter = argc > 1 ? argv[1] : "";
+
+  size_t failed = 0;
+  size_t run = 0;
+  for (const auto &test : testing::cases()) {
+    if (std::string_view(test.name).find(filter) == std::string_view::npos) {
+      continue;
+    }
+    ++run;
+
+    const size_t checks_before = testing::failed_checks;
+    try {
+      test.run();
+    } catch (utils::Error error) {
+      std::cerr << test.name << ": uncaught error: " << error.message << "\n";
+      ++testing::failed_checks;
+    }
+    if (testing::failed_checks != checks_before) {
+      std::cerr << "FAILED " << test.name << "\n";
+      ++failed;
+    }
+  }
 
+  std::cerr << run - failed << "/" << run << " tests passed\n";
+  return failed == 0 ? 0 : 1;
 }
@@ -0,0 +1,140 @@
+#include "testing.hpp"
+
+#include "types.hpp"
+
+#include <thread>
+
+using namespace types;
+
+TEST(type_id_is_small_handle) {
+  CHECK(sizeof(TypeID) == 4);
+  CHECK(not TypeID().is_valid());
+  CHECK(TypeID(7).get_id() == 7);
+  CHECK(TypeID(7) == TypeID(7));
+}
+
+TEST(storage_scope_resolves_ids) {
+  Storage outer;
+  const TypeID int_type = outer.get_int_type();
+  Storage inner;
+  const TypeID bool_type = inner.get_bool_type();
+  CHECK(int_type == bool_type);
+
+  bool thrown = false;
+  try {
+    int_type.get();
+  } catch (utils::Error error) {
+    thrown = error.message == "NO_CURRENT_STORAGE";
+  }
+  CHECK(thrown);
+
+  {
+    StorageScope outer_scope(outer);
+    CHECK(int_type.get().type.index() == 2);
+    {
+      StorageScope inner_scope(inner);
+      CHECK(bool_type.get().type.index() == 1);
+    }
+    CHECK(int_type.get().type.index() == 2);
+
+    // scope is per thread
+    bool other_thread_thrown = false;
+    std::thread([&int_type, &other_thread_thrown] {
+      try {
+        int_type.get();
+      } catch (utils::Error) {
+        other_thread_thrown = true;
+      }
+    }).join();
+    CHECK(other_thread_thrown);
+  }
+}
+
+TEST(arrow_parts_are_pooled) {
+  Storage storage;
+  const TypeID int_type = storage.get_int_type();
+  const TypeID bool_type = storage.get_bool_type();
+  CHECK(storage.get_int_type() == int_type);
+
+  const size_t pool_before = storage.pool_size();
+  const TypeID arrow =
+      storage.add_arrow(TypeIDV{int_type, int_type, bool_type});
+  CHECK(storage.pool_size() == pool_before + 3);
+  CHECK(storage.is_arrow(arrow));
+
+  const auto parts = storage.parts(arrow);
+  CHECK(parts.size() == 3);
+  CHECK(parts[0] == int_type and parts[2] == bool_type);
+  CHECK(storage.parts(int_type).empty());
+
+  const Mode unique{Mode::Uniq::UNIQUE};
+  const TypeID generic = storage.introduce_new_generic("T", unique);
+  CHECK(storage.is_generic(generic));
+  CHECK(storage.generic_name(generic) == "T");
+  CHECK(storage.mode(generic) == unique);
+
+  // resolved generic shares parts of the arrow
+  CHECK(storage.unify(generic, arrow, UnifyModePolicy::Ignore));
+  CHECK(storage.is_arrow(generic));
+  CHECK(storage.parts(generic).data() == storage.parts(arrow).data());
+  CHECK(storage.mode(generic) == unique);
+  CHECK(storage.pool_size() == pool_before + 3);
+}
+
+TEST(layered_storage_keeps_base) {
+  auto base = std::make_shared<Storage>();
+  const TypeID generic = base->introduce_new_generic("T");
+  const TypeID arrow = base->add_arrow(TypeIDV{generic, base->get_int_type()});
+  const size_t base_size = base->size();
+  const size_t base_pool_size = base->pool_size();
+  const std::shared_ptr<const Storage> frozen = base;
+
+  Storage local(frozen);
+  const TypeID bool_type = local.get_bool_type();
+  CHECK(bool_type.get_id() >= base_size);
+  CHECK(local.get_int_type() == base->get_int_type());
+  CHECK(local.unify(generic, bool_type, UnifyModePolicy::Ignore));
+
+  CHECK(local.kind(generic) == TypeKind::Bool);
+  CHECK(local.kind(local.parts(arrow)[0]) == TypeKind::Bool);
+  CHECK(frozen->kind(generic) == TypeKind::Generic);
+  CHECK(frozen->size() == base_size);
+  CHECK(frozen->pool_size() == base_pool_size);
+
+  // other layer sees unchanged base
+  Storage other(frozen);
+  CHECK(other.kind(generic) == TypeKind::Generic);
+  CHECK(other.introduce_new_generic("U") != generic);
+}
+
+TEST(compact_keeps_roots) {
+  auto base = std::make_shared<Storage>();
+  base->get_int_type();
+  const std::shared_ptr<const Storage> frozen = base;
+
+  Storage storage(frozen);
+  const TypeID int_type = storage.get_int_type();
+  TypeID generic = storage.introduce_new_generic("T");
+  TypeID arrow = storage.add_arrow(TypeIDV{generic, int_type});
+  for (size_t i = 0; i < 1000; ++i) {
+    storage.add_arrow(TypeIDV{storage.introduce_new_generic("G"), arrow});
+  }
+  const size_t size_before = storage.size();
+
+  std::vector<TypeID> roots{arrow, int_type};
+  storage.compact(roots);
+  CHECK(storage.size() < size_before);
+  CHECK(roots[1] == int_type);
+
+  arrow = roots[0];
+  CHECK(storage.is_arrow(arrow));
+  generic = storage.parts(arrow)[0];
+  CHECK(storage.is_generic(generic));
+  CHECK(storage.generic_name(generic) == "T");
+  CHECK(storage.parts(arrow)[1] == int_type);
+
+  // compacted generics are still resolved
+  CHECK(storage.unify(generic, storage.get_bool_type(),
+                      UnifyModePolicy::Ignore));
+  CHECK(storage.kind(storage.parts(arrow)[0]) == TypeKind::Bool);
+}
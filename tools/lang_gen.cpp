@@ -0,0 +1,142 @@
+// Generator of program corpora for load tests, see include/generator.hpp.
+//
+// Formats, one item per line:
+//   stream - top-level declarations ["let", name, body], input of
+//            `lang --stream`
+//   serve  - check requests {"op":"check","name":"pN","program":..},
+//            input of `lang --serve`
+//   text   - pretty printed programs
+// Programs are correct for prelude::core(sum_uniq), so checker should be run
+// with --sum-uniq if corpus is generated with it. Output is written while it
+// is generated, so memory use doesn't depend on corpus size.
+
+#include "generator.hpp"
+#include "pretty_printer.hpp"
+#include "program_io.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <unistd.h>
+
+namespace {
+
+enum class Format { Stream, Serve, Text };
+
+void write_item(pretty::Buffer &out, gen::Generator &generator, Format format,
+                size_t id, bool &error) {
+  switch (format) {
+  case Format::Stream: {
+    const auto declaration = generator.declaration();
+    error = declaration.error;
+    out.append("[\"let\",");
+    program_io::print_arg_json(out, declaration.name);
+    out.append(',');
+    program_io::print_json(out, *declaration.body);
+    out.append(']');
+    break;
+  }
+  case Format::Serve: {
+    const auto program = generator.program(&error);
+    out.append("{\"op\":\"check\",\"name\":\"p");
+    out.append(static_cast<long long>(id));
+    out.append("\",\"program\":");
+    program_io::print_json(out, *program);
+    out.append('}');
+    break;
+  }
+  case Format::Text:
+    pretty::print_expr(out, *generator.program(&error));
+    break;
+  default:
+    utils::unreachable();
+  }
+  out.append('\n');
+}
+
+int usage(const char *name) {
+  std::cerr << "usage: " << name
+            << " [--seed N] [--count N] [--bytes N] [--depth N]"
+               " [--width N] [--arity N] [--unique P] [--conditions N]"
+               " [--errors P] [--sum-uniq] [--format stream|serve|text]\n";
+  return 1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  gen::Options options;
+  Format format = Format::Stream;
+  size_t count = 1000;
+  size_t bytes = 0; // 0 - not limited, otherwise count is ignored
+  // numbers are parsed by std::sto*, which throw on malformed values
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string_view arg = argv[i];
+      const bool has_value = i + 1 < argc;
+      if (arg == "--seed" and has_value) {
+        options.seed = std::stoull(argv[++i]);
+      } else if (arg == "--count" and has_value) {
+        count = std::stoull(argv[++i]);
+      } else if (arg == "--bytes" and has_value) {
+        bytes = std::stoull(argv[++i]);
+      } else if (arg == "--depth" and has_value) {
+        options.depth = std::stoul(argv[++i]);
+      } else if (arg == "--width" and has_value) {
+        options.width = std::max<size_t>(1, std::stoul(argv[++i]));
+      } else if (arg == "--arity" and has_value) {
+        options.arity = std::max<size_t>(1, std::stoul(argv[++i]));
+      } else if (arg == "--unique" and has_value) {
+        options.unique_density = std::stod(argv[++i]);
+      } else if (arg == "--conditions" and has_value) {
+        options.condition_nesting = std::stoul(argv[++i]);
+      } else if (arg == "--errors" and has_value) {
+        options.error_rate = std::stod(argv[++i]);
+      } else if (arg == "--sum-uniq") {
+        options.sum_uniq = true;
+      } else if (arg == "--format" and has_value) {
+        std::string_view name = argv[++i];
+        if (name == "stream") {
+          format = Format::Stream;
+        } else if (name == "serve") {
+          format = Format::Serve;
+        } else if (name == "text") {
+          format = Format::Text;
+        } else {
+          std::cerr << "unknown format: " << name << "\n";
+          return 1;
+        }
+      } else {
+        return usage(argv[0]);
+      }
+    }
+  } catch (const std::invalid_argument &) {
+    return usage(argv[0]);
+  } catch (const std::out_of_range &) {
+    return usage(argv[0]);
+  }
+
+  gen::Generator generator(options);
+  size_t items = 0;
+  size_t errors = 0;
+  size_t written = 0;
+  try {
+    pretty::Buffer out(STDOUT_FILENO);
+    while (bytes != 0 ? out.written() < bytes : items < count) {
+      bool error = false;
+      write_item(out, generator, format, items, error);
+      ++items;
+      errors += error;
+    }
+    out.flush();
+    written = out.written();
+  } catch (utils::Error error) {
+    std::cerr << "write error: " << error.message << "\n";
+    return 1;
+  }
+
+  std::cerr << "items: " << items << ", with errors: " << errors
+            << ", bytes: " << written << "\n";
+  return 0;
+}